@@ -40,7 +40,7 @@ startup_32:
     call setup_idt          # 设置中断描述符表
     call setup_gdt          # 设置全局描述符表
     
-    # 因为修改了gdt（段描述符中的段限长8MB改成了16MB），所以需要重新装载所有的段寄存器。CS代码段寄存器
+    # 因为修改了gdt（段描述符中的段限长8MB改成了1GB），所以需要重新装载所有的段寄存器。CS代码段寄存器
     # 已经在setup_gdt中重新加载过了。
 
     movl $0x10, %eax        # reload all the segment registers
@@ -170,8 +170,8 @@ setup_gdt:
  * more than 16MB will have to expand this.
  */
 /*
- * Linus将内核的内存页表直接放在页目录之后，使用了4个表来寻址16MB的物理内存。如果你有
- * 多于16MB的内存，就需要在这里进行扩充修改。
+ * Linus将内核的内存页表直接放在页目录之后，使用了4个表来寻址16MB的物理内存。16MB以上的物理
+ * 内存由mm/memory.c中的paging_init()在启动后映射，页表从主内存区开头分配。
  */
 
  # 每个页表长为4KB字节(1页内存页面)
@@ -337,8 +337,8 @@ idt_descr:
 
 .word 0
 gdt_descr:
-    .word 256 * 8 - 1				# so does gdt (not that that's any
-    .long gdt						# magic number, but it works for me :^)
+    .word (4 + 2 * 256) * 8 - 1		# 4 fixed entries, then TSS+LDT for
+    .long gdt						# each of NR_TASKS=256 tasks
 
 .align 8
 # 中断描述符表（空表）
@@ -346,11 +346,11 @@ idt:	.fill 256, 8, 0					# idt is uninitialized
 
 # 全局描述符表
 # 前4项分别是空项(不用)、代码段描述符、数据段描述符、系统调用段描述符（没有使用）
-# 同时还预留了252项的空间，用于放置所创建任务的局部描述符(LDT)和对应的任务状态段TSS的描述符
+# 同时还为NR_TASKS(256)个任务预留了512项的空间，用于放置所创建任务的局部描述符(LDT)和对应的任务状态段TSS的描述符
 # (0-nul, 1-cs, 2-ds, 3-syscall, 4-TSS0, 5-LDT0, 6-TSS1, 7-LDT1, 8-TSS2 etc...)
 gdt:
     .quad 0x0000000000000000			/* NULL descriptor */
-    .quad 0x00c09a0000000fff			/* 16Mb */		# 0x08，内核代码段，长度16MB
-    .quad 0x00c0920000000fff			/* 16Mb */		# 0x10，内核数据段，长度16MB
+    .quad 0x00c39a000000ffff			/* 1Gb */		# 0x08，内核代码段，长度1GB
+    .quad 0x00c392000000ffff			/* 1Gb */		# 0x10，内核数据段，长度1GB
     .quad 0x0000000000000000			/* TEMPORARY - don't use */
-    .fill 252, 8, 0						/* space for LDT's and TSS's etc */
+    .fill 2 * 256, 8, 0					/* space for LDT's and TSS's etc */
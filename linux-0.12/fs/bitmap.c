@@ -47,31 +47,140 @@
 			:"0" (0), "r" (nr), "m" (*(addr))); 						\
 		res;})
 
-/**
- * 从addr开始寻找第1个0值位
- * 在addr指定地址开始的位图中寻找第1个是0的位，并将其距离addr的位偏移值返回。addr是缓冲块数据区
- * 的地址，扫描寻找的范围是1024字节(8192位)。
- * @param[in]	addr	指定地址
- * @retval		返回第一个0值位距离addr的位偏移值
- */
-#define find_first_zero(addr) ({ 										\
+/* 取x中最低的1值位的位号(x不能为0) */
+#define find_first_set(x) ({ 											\
 	int __res; 															\
-	__asm__(															\
-			"cld\n"														\
-		"1:\tlodsl\n\t"													\
-			"notl %%eax\n\t"                							\
-			"bsfl %%eax, %%edx\n\t"										\
-			"je 2f\n\t"													\
-			"addl %%edx, %%ecx\n\t"										\
-			"jmp 3f\n"													\
-		"2:\taddl $32, %%ecx\n\t"										\
-			"cmpl $8192, %%ecx\n\t"										\
-			"jl 1b\n"													\
-		"3:"															\
-		:"=c" (__res)													\
-		:"c" (0), "S" (addr)); 											\
+	__asm__("bsfl %1, %0" : "=r" (__res) : "rm" (x)); 					\
 	__res;})
 
+/*
+ * 空闲空间统计。超级块中记着每个位图块的空闲位数和总的空闲数，分配和释放时随位图一起修改，这样
+ * 搜索时可以跳过全满的位图块，ustat()也不用扫描位图。另外记着一个位号，其前面的位都已占用，没
+ * 有分配目标时从这里找起。
+ */
+
+/* 设备上逻辑块block在逻辑块位图中的位号(位0保留不用) */
+#define zone_bit(sb, block)	((block) - ((sb)->s_firstdatazone - 1))
+
+/* 逻辑块位图和i节点位图中有效的位数 */
+#define zone_bits(sb)		((sb)->s_nzones - (sb)->s_firstdatazone + 1)
+#define inode_bits(sb)		((sb)->s_ninodes + 1)
+
+/* 逻辑块位图中的第bit位被占用 */
+static inline void zone_taken(struct super_block * sb, int bit)
+{
+	sb->s_zmap[bit >> 13]->b_dirt = 1;
+	sb->s_zmap_free[bit >> 13]--;
+	sb->s_zfree--;
+	if (bit == sb->s_zhint) {
+		sb->s_zhint++;
+	}
+}
+
+/* 逻辑块位图中的第bit位被释放 */
+static inline void zone_freed(struct super_block * sb, int bit)
+{
+	sb->s_zmap[bit >> 13]->b_dirt = 1;
+	sb->s_zmap_free[bit >> 13]++;
+	sb->s_zfree++;
+	if (bit < sb->s_zhint) {
+		sb->s_zhint = bit;
+	}
+}
+
+/* 在一个位图块中数出前nbits位中的0值位个数 */
+static int count_zero(struct buffer_head * bh, int nbits)
+{
+	unsigned long x;
+	int i, n = 0;
+
+	for (i = 0 ; i < nbits ; i += 32) {
+		x = ~((unsigned long *) bh->b_data)[i >> 5];
+		if (nbits - i < 32) {
+			x &= (1UL << (nbits - i)) - 1;
+		}
+		while (x) {
+			x &= x - 1;
+			n++;
+		}
+	}
+	return n;
+}
+
+/**
+ * 统计超级块中各位图块的空闲位数
+ * 在读入超级块及位图后调用一次，此后由分配和释放函数维护。
+ * @param[in]	sb		超级块
+ * @retval		void
+ */
+void count_free_bits(struct super_block * sb)
+{
+	int i, n;
+
+	sb->s_ifree = sb->s_zfree = 0;
+	sb->s_ihint = sb->s_zhint = 0;
+	for (i = 0 ; i < sb->s_imap_blocks ; i++) {
+		sb->s_imap_free[i] = 0;
+		n = inode_bits(sb) - (i << 13);
+		if (sb->s_imap[i] && n > 0) {
+			sb->s_ifree += sb->s_imap_free[i] = count_zero(sb->s_imap[i], n < 8192 ? n : 8192);
+		}
+	}
+	for (i = 0 ; i < sb->s_zmap_blocks ; i++) {
+		sb->s_zmap_free[i] = 0;
+		n = zone_bits(sb) - (i << 13);
+		if (sb->s_zmap[i] && n > 0) {
+			sb->s_zfree += sb->s_zmap_free[i] = count_zero(sb->s_zmap[i], n < 8192 ? n : 8192);
+		}
+	}
+}
+
+/**
+ * 从位号goal开始在位图中向后寻找第1个0值位，到位图末尾后再从头找起
+ * 位图按32位的字扫描，每个位图块8192位即256个字，没有空闲位的位图块整块跳过。
+ * @param[in]	map		位图缓冲块指针数组
+ * @param[in]	nfree	各位图块中的空闲位数
+ * @param[in]	nbits	位图中有效的位数
+ * @param[in]	goal	开始寻找的位号
+ * @retval		找到的位号，没有空闲位返回-1
+ */
+static int find_zero_from(struct buffer_head ** map, unsigned short * nfree, int nbits, int goal)
+{
+	struct buffer_head * bh;
+	unsigned long x;
+	int words, w, k, n, bit;
+
+	words = (nbits + 31) >> 5;
+	if (goal < 0 || goal >= nbits) {
+		goal = 0;
+	}
+	w = goal >> 5;
+	/* 最后一次(k == words)重新检查goal所在的字，以找到该字中goal之前的空闲位 */
+	for (k = 0 ; k <= words ; k++, w++) {
+		if (w >= words) {
+			w = 0;
+		}
+		if (!(bh = map[w >> 8]) || !nfree[w >> 8]) {
+			/* 跳到本块最后一个字，但最后一个位图块可能不满256个字，不能越过words */
+			n = 255 - (w & 255);
+			if (n > words - 1 - w) {
+				n = words - 1 - w;
+			}
+			k += n;
+			w += n;
+			continue;
+		}
+		x = ~((unsigned long *) bh->b_data)[w & 255];
+		if (!k) {
+			x &= ~0UL << (goal & 31);
+		}
+		if (x && (bit = (w << 5) + find_first_set(x)) < nbits) {
+			return bit;
+		}
+	}
+	return -1;
+}
+
 /**
  * 释放设备dev上数据区中的逻辑块block
  * @param[in]	dev		设备号
@@ -96,7 +205,7 @@ int free_block(int dev, int block)
 			brelse(bh);
 			return 0;
 		}
-		bh->b_dirt = 0;
+		mark_buffer_clean(bh);
 		bh->b_uptodate = 0;
 		if (bh->b_count) {		/* 若此时b_count为1, 则调用brelse()释放之 */
 			brelse(bh);
@@ -107,64 +216,153 @@ int free_block(int dev, int block)
 	if (clear_bit(block & 8191, sb->s_zmap[block/8192]->b_data)) {
 		printk("block (%04x:%d) ", dev, block + sb->s_firstdatazone - 1);
 		printk("free_block: bit already cleared\n");
+		return 1;
 	}
-	/* 最后置相应逻辑块位图所在缓冲区的已修改标志 */
-	sb->s_zmap[block/8192]->b_dirt = 1;
+	/* 最后置相应逻辑块位图所在缓冲区的已修改标志，并更新空闲统计 */
+	zone_freed(sb, block);
 	return 1;
 }
 
+/* 给顺序追加的文件预留的后续块数 */
+#define PREALLOC_BLOCKS		8
+
+/* 在高速缓冲中把新分配的逻辑块block清零，并设置已更新和已修改标志 */
+static void init_block(int dev, int block)
+{
+	struct buffer_head * bh;
+
+	/* 在高速缓冲区中为该设备上指定的逻辑块号取得一个缓冲块 */
+	if (!(bh = getblk(dev, block))) {
+		panic("new_block: cannot get block");
+	}
+	/* 因为新取出的逻辑块其引用次数一定为1，若不是1，说明内核有问题。*/
+	if (bh->b_count != 1) {
+		panic("new block: count is != 1");
+	}
+	/* 将新逻辑块清零，并设置其已更新标志和已修改标志。然后释放对应缓冲块 */
+	clear_block(bh->b_data);
+	bh->b_uptodate = 1;
+	bh->b_dirt = 1;
+	brelse(bh);
+}
+
 /**
  * 向设备dev申请一个逻辑块
+ * 从目标块goal开始向后找第一个空闲块(找到末尾后再从头开始)。调用者给出同一文件上一块之后的块
+ * 作为目标，文件的各块就会尽量连续存放。
  * @param[in]	dev		设备号
+ * @param[in]	goal	希望分配的逻辑块号，不在数据区中(如0)则从头找起
  * @retval		成功返回逻辑块号，失败返回0。
  */
-int new_block(int dev)
+int new_block(int dev, int goal)
 {
 	struct buffer_head * bh;
 	struct super_block * sb;
-	int i, j;
+	int j;
 
 	if (!(sb = get_super(dev))) {
 		panic("trying to get new block from nonexistant device");
 	}
-	/* 扫描文件系统的8块逻辑块位图，寻找首个0值位，以寻找空闲逻辑块，获取设置该逻辑块的块号 */
-	j = 8192;
-	for (i = 0 ; i < 8 ; i++) {
-		if ((bh = sb->s_zmap[i])) {
-			if ((j = find_first_zero(bh->b_data)) < 8192) {
-				break;
-			}
-		}
+	if (!sb->s_zfree) {
+		return 0;
+	}
+	/* 没有目标时从第一个可能空闲的块找起，找到的块之前的块就都已占用 */
+	if (goal >= sb->s_firstdatazone && goal < sb->s_nzones) {
+		goal = zone_bit(sb, goal);
+		j = find_zero_from(sb->s_zmap, sb->s_zmap_free, zone_bits(sb), goal);
+	} else if ((j = find_zero_from(sb->s_zmap, sb->s_zmap_free, zone_bits(sb),
+		sb->s_zhint)) >= 0) {
+		sb->s_zhint = j;
 	}
-	/* 然后如果全部扫描完8块逻辑块位图的所有位还没有找到0值位或者位图所在的缓冲块指针无效
-	 (bn = NULL)则表示当前没有空闲逻辑块 */
-	if (i >= 8 || !bh || j >= 8192) {
+	/* 位图中没有0值位或者位图所在的缓冲块指针无效则表示当前没有空闲逻辑块 */
+	if (j < 0) {
 		return 0;
 	}
 	/* 设置找到的新逻辑块j对应逻辑块位图中的位，若对应位已经置位，则出错停机 */
-	if (set_bit(j, bh->b_data)) {
+	bh = sb->s_zmap[j >> 13];
+	if (set_bit(j & 8191, bh->b_data)) {
 		panic("new_block: bit already set");
 	}
-	bh->b_dirt = 1;
-	/* 计算该块在逻辑块位图中位偏移值，偏移值大于该设备上的总逻辑块数，则出错 */
-	j += i * 8192 + sb->s_firstdatazone - 1;
-	if (j >= sb->s_nzones) {
+	zone_taken(sb, j);
+	j += sb->s_firstdatazone - 1;
+	init_block(dev, j);
+	return j;
+}
+
+/**
+ * 为文件申请一个逻辑块
+ * i节点的预分配窗口是紧接在文件上次分配的块之后、已在位图中为该文件占用的几个块。目标块正好是
+ * 窗口中的下一块时直接从窗口中取，不再搜索位图，这样别的文件同时写入也不会插到该文件的块之间。
+ * 目标不在窗口上(如向文件中间的空洞写入)时先放弃窗口，再按目标正常分配。
+ * @param[in]	inode		文件i节点
+ * @param[in]	goal		希望分配的逻辑块号
+ * @param[in]	prealloc	文件正被顺序追加，分配后为其预留后续的空闲块
+ * @retval		成功返回逻辑块号，失败返回0
+ */
+int new_file_block(struct m_inode * inode, int goal, int prealloc)
+{
+	struct super_block * sb;
+	struct buffer_head * bh;
+	int block, bit, n;
+
+	if (inode->i_prealloc_count) {
+		if (goal == inode->i_prealloc_block) {
+			inode->i_prealloc_block++;
+			inode->i_prealloc_count--;
+			init_block(inode->i_dev, goal);
+			return goal;
+		}
+		discard_prealloc(inode);
+	}
+	if (!(block = new_block(inode->i_dev, goal))) {
 		return 0;
 	}
-	/* 在高速缓冲区中为该设备上指定的逻辑块号取得一个缓冲块，并返回缓冲块头指针 */
-	if (!(bh = getblk(dev, j))) {
-		panic("new_block: cannot get block");
+	if (!prealloc || !(sb = get_super(inode->i_dev))) {
+		return block;
 	}
-	/* 因为新取出的逻辑块其引用次数一定为1，若不是1，说明内核有问题。*/
-	if (bh->b_count != 1) {
-		panic("new block: count is != 1");
+	/* 把新块之后连续的空闲块在位图中占用，留给该文件后面的写入，遇到已占用的块为止 */
+	for (n = 0 ; n < PREALLOC_BLOCKS && block + 1 + n < sb->s_nzones ; n++) {
+		bit = zone_bit(sb, block + 1 + n);
+		if (!(bh = sb->s_zmap[bit >> 13]) || set_bit(bit & 8191, bh->b_data)) {
+			break;
+		}
+		zone_taken(sb, bit);
+	}
+	inode->i_prealloc_block = block + 1;
+	inode->i_prealloc_count = n;
+	return block;
+}
+
+/**
+ * 放弃i节点的预分配窗口，把其中还没有用到的块在位图中释放
+ * 在文件最后一次被放回、被截断或者不再顺序写入时调用。
+ * @param[in]	inode	文件i节点
+ * @retval		void
+ */
+void discard_prealloc(struct m_inode * inode)
+{
+	struct super_block * sb;
+	struct buffer_head * bh;
+	int bit;
+
+	if (!inode->i_prealloc_count) {
+		return;
+	}
+	if (!(sb = get_super(inode->i_dev))) {
+		inode->i_prealloc_count = 0;
+		return;
+	}
+	while (inode->i_prealloc_count) {
+		bit = zone_bit(sb, inode->i_prealloc_block);
+		bh = sb->s_zmap[bit >> 13];
+		if (clear_bit(bit & 8191, bh->b_data)) {
+			printk("discard_prealloc: block %d not reserved\n", inode->i_prealloc_block);
+		} else {
+			zone_freed(sb, bit);
+		}
+		inode->i_prealloc_block++;
+		inode->i_prealloc_count--;
 	}
-	/* 将新逻辑块清零，并设置其已更新标志和已修改标志。然后释放对应缓冲块，返回逻辑块号 */
-	clear_block(bh->b_data);
-	bh->b_uptodate = 1;
-	bh->b_dirt = 1;
-	brelse(bh);
-	return j;
 }
 
 // 下面两个函数与上面逻辑块操作类似，只是对象换成了i节点
@@ -184,7 +382,7 @@ void free_inode(struct m_inode * inode)
 	}
 	/* i节点上的设备号字段为0,说明该节点没有使用 */
 	if (!inode->i_dev) {
-		memset(inode, 0, sizeof(*inode));
+		clear_inode(inode);
 		return;
 	}
 	/* 如果此i节点还有其他程序引用，则不释放，说明内核有问题，停机 */ 
@@ -209,10 +407,16 @@ void free_inode(struct m_inode * inode)
 	/* 现在我们复位i节点对应的节点位图中的位 */
 	if (clear_bit(inode->i_num & 8191, bh->b_data)) {
 		printk("free_inode: bit already cleared.\n\r");
+	} else {
+		sb->s_imap_free[inode->i_num >> 13]++;
+		sb->s_ifree++;
+		if (inode->i_num < sb->s_ihint) {
+			sb->s_ihint = inode->i_num;
+		}
 	}
 	/* 置i节点位图所在缓冲区已修改标志，并清空该i节点结构所占内存区 */
 	bh->b_dirt = 1;
-	memset(inode, 0, sizeof(*inode));
+	clear_inode(inode);
 }
 
 /**
@@ -225,36 +429,31 @@ struct m_inode * new_inode(int dev)
 	struct m_inode * inode;
 	struct super_block * sb;
 	struct buffer_head * bh;
-	int i, j;
+	int j;
 
-	/* 首先从内存i节点表(inode_table)中获取一个空闲i节点项，并读取指定设备的超级块结构。*/ 
+	/* 首先从内存i节点缓存中获取一个空闲i节点项，并读取指定设备的超级块结构。*/ 
 	if (!(inode = get_empty_inode())) {
 		return NULL;
 	}
 	if (!(sb = get_super(dev))) {
 		panic("new_inode with unknown device");
 	}
-	/*扫描超级块中8块i节点位图，寻找第1个0位(空闲节点)，获取并设置该i节点的节点号。*/
-	j = 8192;
-	for (i = 0 ; i < 8 ; i++) {
-		if ((bh = sb->s_imap[i])) {
-			if ((j = find_first_zero(bh->b_data)) < 8192) {
-				break;
-			}
-		}
-	}
-	/* 如果全部扫描完还没找到空闲i节点或者位图所在的缓冲块无效(bh = NULL)，则放回先前申请的i节
-	 点表中的i节点，并返回空指针退出 */
-	if (!bh || j >= 8192 || j + i * 8192 > sb->s_ninodes) {
+	/* 从第一个可能空闲的i节点开始在i节点位图中寻找0值位(空闲节点)，获取该i节点的节点号 */
+	if (!sb->s_ifree ||
+		(j = find_zero_from(sb->s_imap, sb->s_imap_free, inode_bits(sb), sb->s_ihint)) < 0) {
 		iput(inode);
 		return NULL;
 	}
 	/* 现在已经找到了还未使用的i节点号j。于是置位i节点j对应的i节点位图相应比特位。然后置i节点位
-	 图所在缓冲块已修改标志 */
-	if (set_bit(j, bh->b_data)) {
+	 图所在缓冲块已修改标志，并更新空闲统计 */
+	bh = sb->s_imap[j >> 13];
+	if (set_bit(j & 8191, bh->b_data)) {
 		panic("new_inode: bit already set");
 	}
 	bh->b_dirt = 1;
+	sb->s_imap_free[j >> 13]--;
+	sb->s_ifree--;
+	sb->s_ihint = j + 1;
 	/* 初始化该i节点结构 */
 	inode->i_count = 1;
 	inode->i_nlinks = 1;
@@ -262,7 +461,8 @@ struct m_inode * new_inode(int dev)
 	inode->i_uid = current->euid;
 	inode->i_gid = current->egid;
 	inode->i_dirt = 1;
-	inode->i_num = j + i * 8192;
+	inode->i_num = j;
 	inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
+	insert_inode_hash(inode);
 	return inode;
 }
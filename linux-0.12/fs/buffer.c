@@ -29,6 +29,8 @@
  */
 
 #include <stdarg.h>
+#include <errno.h>
+#include <string.h>
 
 #include <linux/config.h>
 #include <linux/sched.h>
@@ -36,6 +38,7 @@
 #include <linux/fs.h>
 #include <asm/system.h>
 #include <asm/io.h>
+#include <asm/segment.h>
 
 // buffer_wait变量是等待空闲缓冲块而睡眠的任务队列头指针。它与缓冲块头部结构中b_wait指针的作用
 // 不同。当任务申请一个缓冲块而正好遇到系统缺乏可用空闲缓冲块时，当前任务就会被添加到buffer_wait
@@ -54,8 +57,16 @@ struct buffer_head *start_buffer = (struct buffer_head *) &end;
 /* 缓冲区Hash表数组 */
 struct buffer_head *hash_table[NR_HASH];
 
-/* 空闲缓冲块链表头指针 */
-static struct buffer_head *free_list;
+/*
+ * 未被使用(b_count = 0)的缓冲块按状态分别挂在干净、上锁、脏三个LRU循环链表上，表头最久未用，
+ * 正在使用的缓冲块不在任何表上。缓冲块的状态可能在表上时改变(例如被回写或被上锁)，所以取用时
+ * 还要检查，不符的就移到正确的表中。
+ */
+static struct buffer_head * lru_list[NR_LIST];
+static int nr_list[NR_LIST];
+
+/* 高速缓冲统计 */
+static struct buffer_stat buf_stat;
 
 /* 等待空闲缓冲块而睡眠的任务队列 */
 static struct task_struct *buffer_wait = NULL;
@@ -63,6 +74,22 @@ static struct task_struct *buffer_wait = NULL;
 /* 系统所含缓冲个数 */
 int NR_BUFFERS = 0;
 
+/*
+ * 缓冲块回写(write-behind)。缓冲块每次变脏后第一次被发现时记下其应写盘的时间b_flushtime，bdflush守护
+ * 进程每隔一个扫描周期把到期的脏块写盘；脏块数超过总数的一定比例时则不等到期，立即写出多出的
+ * 部分。brelse()在脏块过多时、getblk()在找不到干净的空闲块时唤醒守护进程。
+ */
+static long bdf_param[4] = { 0, 30 * HZ, 5 * HZ, 40 };	/* 下标为BDF_xxx */
+#define bdf_age			bdf_param[BDF_AGE]
+#define bdf_interval	bdf_param[BDF_INTERVAL]
+#define bdf_ratio		bdf_param[BDF_RATIO]
+
+static struct task_struct * bdflush_task = NULL;	/* 回写守护进程 */
+static struct task_struct * bdflush_wait = NULL;	/* 守护进程在此睡眠 */
+static int nr_dirty = 0;							/* 脏缓冲块数(近似值，每次扫描时重新统计) */
+
+#define TOO_MANY_DIRTY(n)	((n) * 100 > bdf_ratio * NR_BUFFERS)
+
 
 // wait_on_buffer中，虽然是在关闭中断(cli)之后去睡眠的，但这样做并不会影响在其他进程上下文中响应
 // 中断。因为每个进程都在自己的TSS段中保存了标志寄存器EFLAGS的值，所在在进程切换时CPU中当前
@@ -97,6 +124,7 @@ int sys_sync(void)
 	int i;
 	struct buffer_head *bh;
 
+	sync_cache_pages(0, 0);			/* 先写出脏的文件页面，可能分配块而改动i节点 */
 	sync_inodes();					/* write out inodes into buffers */
 									/* 将修改过的i节点写入缓冲区 */
 	bh = start_buffer;
@@ -123,7 +151,8 @@ int sync_dev(int dev)
 	struct buffer_head *bh;
 
 	/* 这里采用两遍同步操作是为了提高内核执行效率。第一遍缓冲区同步操作可以让内核中许多“脏块”
-	 变干净，使得inode的同步操作能够高效执行。*/
+	 变干净，使得inode的同步操作能够高效执行。脏的文件页面在这之前写出。*/
+	sync_cache_pages(dev, 0);
 	bh = start_buffer;
 	for (i = 0; i < NR_BUFFERS; i++, bh++) {
 		if (bh->b_dev != dev) {
@@ -167,11 +196,119 @@ void inline invalidate_buffers(int dev)
 		wait_on_buffer(bh);
 		/* 由于进程执行过睡眠等待，所以需要再判断一下缓冲区是否是指定设备 */
 		if (bh->b_dev == dev) {
-			bh->b_uptodate = bh->b_dirt = 0;
+			bh->b_uptodate = 0;
+			mark_buffer_clean(bh);
 		}
 	}
 }
 
+/* 唤醒缓冲块回写守护进程 */
+void wakeup_bdflush(void)
+{
+	if (bdflush_task) {
+		wake_up(&bdflush_wait);
+	}
+}
+
+/*
+ * 回写守护进程的一次扫描：先写出到期的脏文件页面并把脏i节点写入缓冲区，再统计脏块并为新发现的脏块记下写盘时间，然后
+ * 写出所有到期的脏块；若脏块数超过了比例，再多写出一些，直到降到该比例的一半。
+ */
+static void bdflush_pass(void)
+{
+	int i, dirty = 0, excess = 0;
+	struct buffer_head * bh;
+
+	sync_cache_pages(0, bdf_age);
+	sync_inodes();
+	bh = start_buffer;
+	for (i = 0; i < NR_BUFFERS; i++, bh++) {
+		if (!bh->b_dirt) {
+			bh->b_flushtime = 0;
+			continue;
+		}
+		if (!bh->b_flushtime) {
+			bh->b_flushtime = jiffies + bdf_age;
+		}
+		dirty++;
+	}
+	nr_dirty = dirty;
+	if (TOO_MANY_DIRTY(dirty)) {
+		excess = dirty - bdf_ratio * NR_BUFFERS / 200;
+	}
+	bh = start_buffer;
+	for (i = 0; i < NR_BUFFERS; i++, bh++) {
+		if (!bh->b_dirt || bh->b_lock) {
+			continue;
+		}
+		if (excess > 0 || (long) (jiffies - bh->b_flushtime) >= 0) {
+			ll_rw_block(WRITE, bh);
+			excess--;
+			nr_dirty--;
+		}
+	}
+}
+
+/**
+ * 缓冲块回写 系统调用
+ * BDF_DAEMON使当前进程成为回写守护进程，在内核中循环执行回写扫描，永不返回。其他功能号读取
+ * (data < 0)或设置(需超级用户)相应的回写参数。BDF_STATS把高速缓冲统计复制到data所指的用户
+ * 缓冲区中。
+ * @param[in]	func	功能号BDF_xxx
+ * @param[in]	data	参数的新值，小于0表示只读取；BDF_STATS时为struct buffer_stat指针
+ * @retval		读取时返回参数值，设置成功返回0，失败返回出错码
+ */
+int sys_bdflush(int func, long data)
+{
+	unsigned long * p;
+	int i;
+
+	if (func < BDF_DAEMON || func > BDF_STATS) {
+		return -EINVAL;
+	}
+	if (func == BDF_STATS) {
+		buf_stat.nr_buffers = NR_BUFFERS;
+		buf_stat.nr_clean = nr_list[BUF_CLEAN];
+		buf_stat.nr_locked = nr_list[BUF_LOCKED];
+		buf_stat.nr_dirty = nr_list[BUF_DIRTY];
+		verify_area((void *) data, sizeof(struct buffer_stat));
+		p = (unsigned long *) &buf_stat;
+		for (i = 0 ; i < sizeof(struct buffer_stat) / sizeof(long) ; i++) {
+			put_fs_long(p[i], (unsigned long *) data + i);
+		}
+		return 0;
+	}
+	if (func != BDF_DAEMON) {
+		if (data < 0) {
+			return bdf_param[func];
+		}
+		if (!suser()) {
+			return -EPERM;
+		}
+		if (!data || (func == BDF_RATIO && data > 100)) {
+			return -EINVAL;
+		}
+		bdf_param[func] = data;
+		wakeup_bdflush();
+		return 0;
+	}
+	if (!suser() || bdflush_task) {
+		return -EPERM;
+	}
+	bdflush_task = current;
+	/* 守护进程不处理任何信号。SIGKILL和SIGSTOP屏蔽不了，收到后interruptible_sleep_on()会立即
+	   返回，所以要退出循环，回到用户态去处理 */
+	current->blocked = ~((1 << (SIGKILL - 1)) | (1 << (SIGSTOP - 1)));
+	while (!(current->signal & ~current->blocked)) {
+		bdflush_pass();
+		set_timeout(jiffies + bdf_interval);
+		interruptible_sleep_on(&bdflush_wait);
+	}
+	set_timeout(0);
+	bdflush_task = NULL;
+	return -EINTR;
+}
+
 /*
  * This routine checks whether a floppy has been changed, and
  * invalidates all buffer-cache-entries in that case. This
@@ -233,15 +370,9 @@ void check_disk_change(int dev)
 #define _hashfn(dev, block) (((unsigned)(dev ^ block)) % NR_HASH)
 #define hash(dev, block) 	hash_table[_hashfn(dev, block)]
 
-/**
- * 从hash队列和空闲缓冲队列中移走缓冲块。
- * @param[in]	bh		要移除的缓冲区头指针
- * @retval 		void
- */
-static inline void remove_from_queues(struct buffer_head * bh)
+/* 把缓冲块从hash队列中移走 */
+static inline void remove_from_hash(struct buffer_head * bh)
 {
-	/* remove from hash-queue */
-	/* 从hash队列中移除缓冲块 */
 	if (bh->b_next) {
 		bh->b_next->b_prev = bh->b_prev;
 	}
@@ -252,34 +383,11 @@ static inline void remove_from_queues(struct buffer_head * bh)
 	if (hash(bh->b_dev,bh->b_blocknr) == bh) {
 		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
 	}
-	/* remove from free list */
-	/* 从空闲缓冲块表中移除缓冲块 */
-	if (!(bh->b_prev_free) || !(bh->b_next_free)) {
-		panic("Free block list corrupted");
-	}
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	/* 如果空闲链表头指向本缓冲区，则让其指向下一缓冲区 */
-	if (free_list == bh) {
-		free_list = bh->b_next_free;
-	}
 }
 
-/**
- * 将缓冲块插入空闲链表尾部，同时放入hash队列中
- * @param[in]	bh		要插入的缓冲区头指针
- * @retval 		void
- */
-static inline void insert_into_queues(struct buffer_head * bh)
+/* 如果该缓冲块对应一个设备,则将其插入新hash队列中 */
+static inline void insert_into_hash(struct buffer_head * bh)
 {
-	/* put at end of free list */
-	/* 放在空闲链表末尾处 */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-	/* put the buffer in new hash-queue if it has a device */
-	/* 如果该缓冲块对应一个设备,则将其插入新hash队列中 */
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
 	if (!bh->b_dev) {
@@ -293,6 +401,85 @@ static inline void insert_into_queues(struct buffer_head * bh)
 	}
 }
 
+/* 缓冲块按状态应放的LRU表 */
+#define buffer_list(bh)	((bh)->b_lock ? BUF_LOCKED : ((bh)->b_dirt ? BUF_DIRTY : BUF_CLEAN))
+
+/* 把缓冲块从所在的LRU表中取下(须已关中断) */
+static inline void lru_remove(struct buffer_head * bh)
+{
+	int list = bh->b_list;
+
+	if (list >= NR_LIST) {
+		return;
+	}
+	if (bh->b_next_free == bh) {
+		lru_list[list] = NULL;
+	} else {
+		bh->b_prev_free->b_next_free = bh->b_next_free;
+		bh->b_next_free->b_prev_free = bh->b_prev_free;
+		if (lru_list[list] == bh) {
+			lru_list[list] = bh->b_next_free;
+		}
+	}
+	bh->b_next_free = bh->b_prev_free = NULL;
+	nr_list[list]--;
+	bh->b_list = BUF_USED;
+}
+
+/* 把缓冲块放到list表的表尾(最近使用)，mru为0时放在表头(优先重用)。须已关中断 */
+static inline void lru_insert(struct buffer_head * bh, int list, int mru)
+{
+	struct buffer_head * head = lru_list[list];
+
+	if (!head) {
+		bh->b_next_free = bh->b_prev_free = bh;
+		lru_list[list] = bh;
+	} else {
+		bh->b_next_free = head;
+		bh->b_prev_free = head->b_prev_free;
+		head->b_prev_free->b_next_free = bh;
+		head->b_prev_free = bh;
+		if (!mru) {
+			lru_list[list] = bh;
+		}
+	}
+	nr_list[list]++;
+	bh->b_list = list;
+}
+
+/**
+ * 把未被使用的缓冲块按当前状态放到对应的LRU表上
+ * 引用计数变为0、或者空闲缓冲块解锁时调用(后者在中断处理过程中)。已失效的干净块放在表头优先
+ * 重用，其余放在表尾。
+ * @param[in]	bh		缓冲块头指针
+ * @retval		void
+ */
+void refile_buffer(struct buffer_head * bh)
+{
+	unsigned long flags;
+	int list;
+
+	if (bh->b_count || (list = buffer_list(bh)) == bh->b_list) {
+		return;
+	}
+	save_flags(flags);
+	cli();
+	lru_remove(bh);
+	lru_insert(bh, list, list != BUF_CLEAN || bh->b_uptodate);
+	restore_flags(flags);
+}
+
+/* 缓冲块将被使用(引用计数由0变为1)，把它从LRU表中取下 */
+static inline void take_buffer(struct buffer_head * bh)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	lru_remove(bh);
+	restore_flags(flags);
+}
+
 /**
  * 在hash表查找指定缓冲块
  * @param[in] 	dev		设备号
@@ -338,12 +525,16 @@ struct buffer_head * get_hash_table(int dev, int block)
 		if (!(bh = find_buffer(dev, block))) {
 			return NULL;
 		}
-		bh->b_count ++;
+		if (!bh->b_count++) {
+			take_buffer(bh);
+		}
 		wait_on_buffer(bh);
 		if (bh->b_dev == dev && bh->b_blocknr == block) {
 			return bh;
 		}
-		bh->b_count--;
+		if (!--bh->b_count) {
+			refile_buffer(bh);
+		}
 		#if 0
 		// Q: 上面为什么不是这样? 
 		// A: bh->b_count先自增，会告诉系统，这个块还要用，别释放。
@@ -369,7 +560,33 @@ struct buffer_head * get_hash_table(int dev, int block)
  *
  * 算法已经作了改变：希望能更好，而且一个难以琢磨的错误已经去除。
  */
-#define BADNESS(bh) (((bh)->b_dirt << 1) + (bh)->b_lock)
+/*
+ * 选一个空闲缓冲块来重用：先取干净表的表头(最久未用)；没有干净块时取上锁表的表头(等待它解锁)，
+ * 再没有才取脏表的表头(由调用者写盘)。表上状态已改变的块顺便移到正确的表中，每个块在状态改变
+ * 后最多被移动一次，所以平均是O(1)。
+ */
+static struct buffer_head * find_victim(void)
+{
+	struct buffer_head * bh;
+	int list;
+
+	cli();
+repeat:
+	for (list = 0 ; list < NR_LIST ; list++) {
+		if (!(bh = lru_list[list])) {
+			continue;
+		}
+		if (buffer_list(bh) != list) {
+			lru_remove(bh);
+			lru_insert(bh, buffer_list(bh), 1);
+			goto repeat;
+		}
+		sti();
+		return bh;
+	}
+	sti();
+	return NULL;
+}
 
 /**
  * 取高速缓冲中指定的缓冲块
@@ -384,27 +601,14 @@ struct buffer_head * get_hash_table(int dev, int block)
  */
 struct buffer_head * getblk(int dev, int block)
 {
-	struct buffer_head *tmp, *bh;
+	struct buffer_head * bh;
 
 repeat:
 	if ((bh = get_hash_table(dev, block))) {
+		buf_stat.hits++;
 		return bh;
 	}
-	tmp = free_list;
-	do {
-		if (tmp->b_count) {
-			continue;
-		}
-		if (!bh || BADNESS(tmp) < BADNESS(bh)) {
-			bh = tmp;
-			if (!BADNESS(tmp)) {
-				break;
-			}
-		}
-	/* and repeat until we find something good */
-	/* 重复操作直到找到适合的缓冲块 */
-	} while ((tmp = tmp->b_next_free) != free_list);
-	if (!bh) {
+	if (!(bh = find_victim())) {
 		sleep_on(&buffer_wait);
 		goto repeat;
 	}
@@ -412,8 +616,11 @@ repeat:
 	if (bh->b_count) {
 		goto repeat;
 	}
+	/* 找到的最好的空闲块也是脏的，说明脏块太多：唤醒回写守护进程，这里只把这一块写出 */
 	while (bh->b_dirt) {
-		sync_dev(bh->b_dev);
+		buf_stat.dirty_evictions++;
+		wakeup_bdflush();
+		ll_rw_block(WRITE, bh);
 		wait_on_buffer(bh);
 		if (bh->b_count) {
 			goto repeat;
@@ -430,15 +637,20 @@ repeat:
 	/* and that it's unused (b_count=0), unlocked (b_lock=0), and clean */
 	/* OK，最终我们知道该缓冲块是指定参数的唯一一块，而且目前还没有被占用(b_count=0)，也未被上
 	 锁(b_lock=0)，并且是干净的(未被修改的) */
+	buf_stat.misses++;
+	if (bh->b_dev && bh->b_uptodate) {
+		buf_stat.evictions++;
+	}
+	take_buffer(bh);
 	bh->b_count = 1;
-	bh->b_dirt = 0;
+	mark_buffer_clean(bh);
 	bh->b_uptodate = 0;
-	/* 从hash队列和空闲块链表中移出该缓冲头，让该缓冲区用于指定块。然后根据此新设备号和块号重新
-	 插入空闲链表和hash队列新位置处，并最终返回缓冲头指针。*/
-	remove_from_queues(bh);
+	/* 从hash队列中移出该缓冲头，让该缓冲区用于指定块。然后根据此新设备号和块号重新插入hash队
+	 列新位置处，并最终返回缓冲头指针。*/
+	remove_from_hash(bh);
 	bh->b_dev = dev;
 	bh->b_blocknr = block;
-	insert_into_queues(bh);
+	insert_into_hash(bh);
 	return bh;
 }
 
@@ -457,6 +669,16 @@ void brelse(struct buffer_head * buf)
 	if (!(buf->b_count--)) {
 		panic("Trying to free free buffer");
 	}
+	/* 新变脏的块：记下写盘时间，脏块太多时开始后台回写 */
+	if (buf->b_dirt && !buf->b_flushtime) {
+		buf->b_flushtime = jiffies + bdf_age;
+		if (TOO_MANY_DIRTY(++nr_dirty)) {
+			wakeup_bdflush();
+		}
+	}
+	if (!buf->b_count) {
+		refile_buffer(buf);
+	}
 	wake_up(&buffer_wait);
 }
 
@@ -515,43 +737,160 @@ __asm__(												\
 /*
  * bread_page 一次读四个缓冲块数据读到内存指定的地址处。它是一个完整的函数，因为同时读取四块可以
  * 获得速度上的好处，不用等着读一块，再读一块了。
+ *
+ * 读入的页面由页面高速缓冲保存，所以不在高速缓冲中的块用临时缓冲头直接读到页面里，不再占用缓冲
+ * 块；已在高速缓冲中的块(例如预读的块，或者刚被写过的脏块)则从缓冲块复制，复制后该缓冲块优先被
+ * 重用。
  */
 
+/* 设置一个指向页面中数据的临时缓冲头。它不在hash表和LRU表上，直接用于读写请求 */
+static void init_tmp_buffer(struct buffer_head * bh, unsigned long address, int dev, int block)
+{
+	bh->b_data = (char *) address;
+	bh->b_blocknr = block;
+	bh->b_dev = dev;
+	bh->b_uptodate = 0;
+	bh->b_dirt = 0;
+	bh->b_count = 1;		/* 使unlock_buffer()不把它放到LRU表上 */
+	bh->b_lock = 0;
+	bh->b_wait = NULL;
+	bh->b_prev = bh->b_next = NULL;
+	bh->b_prev_free = bh->b_next_free = NULL;
+	bh->b_reqnext = NULL;
+	bh->b_flushtime = 0;
+	bh->b_list = BUF_USED;
+}
+
 /**
  * 读设备的一个页面的内容到指定内存地址处
- * @note 该函数仅用于mm/memory.c文件的do_no_page()函数中
- * @param[in] 	address	保存页面数据的地址
+ * @note 该函数仅用于mm/filemap.c文件的get_cache_page()函数中
+ * @param[in] 	address	保存页面数据的地址(页面不必事先清零)
  * @param[in] 	dev		设备号
- * @param[in] 	b[4]	含有4个设备数据块号的数组
+ * @param[in] 	b[4]	含有4个设备数据块号的数组，0表示该块为空(页面中对应部分清零)
  * @retval 		void
  */
 void bread_page(unsigned long address, int dev, int b[4])
 {
 	struct buffer_head * bh[4];
+	struct buffer_head tmp[4];
+	unsigned long flags;
 	int i;
 
-	/* 从高速缓冲中取指定设备和块号的的缓冲块。如果缓冲块中数据无效(未更新)，则产生读设备请求从
-	 设备上读取相应数据块 */
+	/* 先对不在高速缓冲中的块发出直接读入页面的请求 */
+	for (i = 0; i < 4; i ++) {
+		bh[i] = NULL;
+		if (!b[i] || find_buffer(dev, b[i])) {
+			continue;
+		}
+		bh[i] = tmp + i;
+		init_tmp_buffer(bh[i], address + i * BLOCK_SIZE, dev, b[i]);
+		ll_rw_block(READ, bh[i]);
+	}
+	/* 其余的块从高速缓冲中取。如果缓冲块中数据无效(未更新)，则产生读设备请求从设备上读取 */
 	for (i = 0; i < 4; i ++) {
-		if (b[i]) {
+		if (b[i] && !bh[i]) {
 			if ((bh[i] = getblk(dev, b[i]))) {
 				if (!bh[i]->b_uptodate) {
 					ll_rw_block(READ, bh[i]);
 				}
 			}
-		} else {
-			bh[i] = NULL;
 		}
 	}
-	/* 随后将4个缓冲块上的内容顺序复制到指定地址处，随后释放相应缓冲块 */
+	/* 随后等待各块读入，并把缓冲块中的内容复制到页面中相应位置处，随后释放相应缓冲块 */
 	for (i = 0; i < 4; i++, address += BLOCK_SIZE) {
-		if (bh[i]) {
-			wait_on_buffer(bh[i]);
-			if (bh[i]->b_uptodate) {
-				COPYBLK((unsigned long) bh[i]->b_data, address);
+		/* 空块以及读不出的块对应的部分清零 */
+		if (!bh[i]) {
+			memset((void *) address, 0, BLOCK_SIZE);
+			continue;
+		}
+		wait_on_buffer(bh[i]);
+		if (bh[i] == tmp + i) {
+			if (!bh[i]->b_uptodate) {
+				memset((void *) address, 0, BLOCK_SIZE);
+			}
+			continue;
+		}
+		if (bh[i]->b_uptodate) {
+			COPYBLK((unsigned long) bh[i]->b_data, address);
+		} else {
+			memset((void *) address, 0, BLOCK_SIZE);
+		}
+		brelse(bh[i]);
+		save_flags(flags);
+		cli();
+		if (bh[i]->b_list == BUF_CLEAN) {
+			lru_remove(bh[i]);
+			lru_insert(bh[i], BUF_CLEAN, 0);
+		}
+		restore_flags(flags);
+	}
+}
+
+/**
+ * 把页面中的各块写到设备上，并等待写完(用于页面高速缓冲的回写)
+ * 块在高速缓冲中时，若缓冲块没有别人在用就作废它，否则把页面中的数据复制进去由缓冲块写盘，这样
+ * 高速缓冲中不会留下比页面旧的数据；其余的块用临时缓冲头直接从页面写出。
+ * @param[in] 	address	页面地址
+ * @param[in] 	dev		设备号
+ * @param[in] 	b[4]	各块的设备块号，0表示该块不写
+ * @retval 		void
+ */
+void bwrite_page(unsigned long address, int dev, int b[4])
+{
+	struct buffer_head * bh[4];
+	struct buffer_head tmp[4];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		bh[i] = NULL;
+		if (!b[i]) {
+			continue;
+		}
+		if ((bh[i] = get_hash_table(dev, b[i]))) {
+			if (bh[i]->b_count == 1) {
+				bh[i]->b_uptodate = 0;
+				mark_buffer_clean(bh[i]);
+			} else {
+				COPYBLK(address + i * BLOCK_SIZE, (unsigned long) bh[i]->b_data);
+				bh[i]->b_uptodate = 1;
+				bh[i]->b_dirt = 1;
+				brelse(bh[i]);
+				bh[i] = NULL;
+				continue;
 			}
 			brelse(bh[i]);
 		}
+		bh[i] = tmp + i;
+		init_tmp_buffer(bh[i], address + i * BLOCK_SIZE, dev, b[i]);
+		bh[i]->b_uptodate = 1;
+		bh[i]->b_dirt = 1;
+		ll_rw_block(WRITE, bh[i]);
+	}
+	for (i = 0; i < 4; i++) {
+		if (bh[i]) {
+			wait_on_buffer(bh[i]);
+		}
+	}
+}
+
+/**
+ * 对指定块发出预读请求
+ * 如果块不在高速缓冲中则发出READA请求，但不等待读入完成，也不保留对该缓冲块的引用。
+ * @param[in]	dev		设备号
+ * @param[in]	block	块号
+ * @retval		void
+ */
+void read_ahead(int dev, int block)
+{
+	struct buffer_head * bh;
+
+	if ((bh = getblk(dev, block))) {
+		if (!bh->b_uptodate) {
+			ll_rw_block(READA, bh);
+		}
+		if (!--bh->b_count) {	/* 暂时释放掉该预读块 */
+			refile_buffer(bh);
+		}
 	}
 }
 
@@ -570,7 +909,7 @@ void bread_page(unsigned long address, int dev, int b[4])
 struct buffer_head * breada(int dev, int first, ...)
 {
 	va_list args;
-	struct buffer_head * bh, *tmp;
+	struct buffer_head * bh;
 
 	va_start(args, first);
 	/* 读取第一块缓冲块 */
@@ -582,13 +921,7 @@ struct buffer_head * breada(int dev, int first, ...)
 	}
 	/* 预读取可变参数表中的其他预读块号，但不引用 */
 	while ((first = va_arg(args, int)) >= 0) {
-		tmp = getblk(dev, first);
-		if (tmp) {
-			if (!tmp->b_uptodate) {
-				ll_rw_block(READA, tmp); /* bug修复! 这里的 bh 改为 tmp */
-			}
-			tmp->b_count --; /* 暂时释放掉该预读块 */
-		}
+		read_ahead(dev, first);
 	}
 	va_end(args);
 	wait_on_buffer(bh);
@@ -627,6 +960,9 @@ void buffer_init(long buffer_end)
 		h->b_wait = NULL;
 		h->b_next = NULL;
 		h->b_prev = NULL;
+		h->b_reqnext = NULL;
+		h->b_flushtime = 0;
+		h->b_list = BUF_CLEAN;
 		h->b_data = (char *) b;
 		/* 以下两句形成双向链表 */
 		h->b_prev_free = h - 1;
@@ -638,9 +974,10 @@ void buffer_init(long buffer_end)
 			b = (void *) 0xA0000;
 	}
 	h --;						/* 让h指向最后一个有效缓冲块头 */
-	free_list = start_buffer;	/* 让空闲链表头指向头一个缓冲块 */
-	free_list->b_prev_free = h; /* 链表头的b_prev_free指向前一项(即最后一项) */
-	h->b_next_free = free_list; /* 表尾指向表头，形成环形双向链表 */
+	lru_list[BUF_CLEAN] = start_buffer;	/* 所有缓冲块都在干净表上 */
+	start_buffer->b_prev_free = h; 		/* 链表头的b_prev_free指向前一项(即最后一项) */
+	h->b_next_free = start_buffer; 		/* 表尾指向表头，形成环形双向链表 */
+	nr_list[BUF_CLEAN] = NR_BUFFERS;
 	/* 初始化hash表 */
 	for (i = 0; i < NR_HASH; i++) {
 		hash_table[i]=NULL;
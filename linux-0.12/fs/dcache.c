@@ -0,0 +1,239 @@
+/*
+ *  linux/fs/dcache.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * 目录项名字缓存。把(设备号, 目录i节点号, 文件名)映射到文件的i节点号，i节点号为0表示该名字在目
+ * 录中不存在(否定项)。路径解析时先查这里，命中则完全不用读目录块。所有会改变目录内容的操作(添加
+ * 目录项、unlink、rmdir)都必须使对应的缓存项失效。
+ *
+ * 这里的名字都在内核空间中，调用者负责先把用户空间的名字复制进来。
+ */
+
+#include <string.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+#include <asm/segment.h>
+
+#define NR_DCACHE	128		/* 缓存项数 */
+#define NR_DHASH	61		/* hash表项数 */
+
+struct dcache_entry {
+	struct dcache_entry * d_hash_next;
+	struct dcache_entry ** d_hash_pprev;
+	struct dcache_entry * d_lru_next;	/* LRU循环链表，表头最久未用 */
+	struct dcache_entry * d_lru_prev;
+	unsigned short d_dev;				/* 目录所在设备，0表示空闲项 */
+	unsigned short d_dir;				/* 目录i节点号 */
+	unsigned short d_ino;				/* 文件i节点号，0为否定项 */
+	unsigned char d_len;				/* 名字长度 */
+	char d_name[NAME_LEN];
+};
+
+static struct dcache_entry dcache[NR_DCACHE];
+static struct dcache_entry * dcache_hash[NR_DHASH];
+static struct dcache_entry * dcache_lru = NULL;
+
+/*
+ * 每次使缓存项失效都加1。查找未命中后要去读目录块(可能睡眠)，再用查找时记下的序号调用
+ * dcache_add()，若期间目录被修改过则不加入，避免把过时的结果放进缓存。
+ */
+static unsigned long dcache_seq = 0;
+
+static inline unsigned int dcache_hashfn(int dev, int dir, const char * name, int len)
+{
+	unsigned int hash = dev ^ (dir << 4);
+
+	while (len--) {
+		hash = (hash << 3) ^ (hash >> 28) ^ (unsigned char) *name++;
+	}
+	return hash % NR_DHASH;
+}
+
+static void dcache_setup(void)
+{
+	int i;
+
+	for (i = 0 ; i < NR_DCACHE ; i++) {
+		dcache[i].d_lru_next = dcache + (i + 1) % NR_DCACHE;
+		dcache[i].d_lru_prev = dcache + (i + NR_DCACHE - 1) % NR_DCACHE;
+	}
+	dcache_lru = dcache;
+}
+
+/* 把缓存项移到LRU表尾(最近使用) */
+static inline void dcache_touch(struct dcache_entry * de)
+{
+	if (de == dcache_lru) {
+		dcache_lru = de->d_lru_next;
+		return;
+	}
+	de->d_lru_prev->d_lru_next = de->d_lru_next;
+	de->d_lru_next->d_lru_prev = de->d_lru_prev;
+	de->d_lru_next = dcache_lru;
+	de->d_lru_prev = dcache_lru->d_lru_prev;
+	dcache_lru->d_lru_prev->d_lru_next = de;
+	dcache_lru->d_lru_prev = de;
+}
+
+/* 释放缓存项，并把它放到LRU表头以便优先重用 */
+static void dcache_drop(struct dcache_entry * de)
+{
+	if (de->d_hash_pprev) {
+		if (de->d_hash_next) {
+			de->d_hash_next->d_hash_pprev = de->d_hash_pprev;
+		}
+		*de->d_hash_pprev = de->d_hash_next;
+		de->d_hash_next = NULL;
+		de->d_hash_pprev = NULL;
+	}
+	de->d_dev = 0;
+	dcache_touch(de);
+	dcache_lru = de;
+}
+
+static struct dcache_entry * dcache_find(int dev, int dir, const char * name, int len)
+{
+	struct dcache_entry * de;
+
+	for (de = dcache_hash[dcache_hashfn(dev, dir, name, len)] ; de ; de = de->d_hash_next) {
+		if (de->d_dev == dev && de->d_dir == dir && de->d_len == len &&
+			!memcmp(de->d_name, name, len)) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * 在名字缓存中查找目录dir中的名字
+ * @param[in]	dir		目录i节点
+ * @param[in]	name	文件名(内核空间)
+ * @param[in]	len		文件名长度(不超过NAME_LEN)
+ * @param[out]	seq		未命中时返回当前失效序号，供随后的dcache_add()使用
+ * @retval		命中返回i节点号(否定项为0)，未命中返回-1
+ */
+int dcache_lookup(struct m_inode * dir, const char * name, int len, unsigned long * seq)
+{
+	struct dcache_entry * de;
+
+	if (!dcache_lru) {
+		dcache_setup();
+	}
+	if ((de = dcache_find(dir->i_dev, dir->i_num, name, len))) {
+		dcache_touch(de);
+		return de->d_ino;
+	}
+	*seq = dcache_seq;
+	return -1;
+}
+
+/**
+ * 把查找结果加入名字缓存
+ * @param[in]	dir		目录i节点
+ * @param[in]	name	文件名(内核空间)
+ * @param[in]	len		文件名长度(不超过NAME_LEN)
+ * @param[in]	ino		文件i节点号，0表示不存在
+ * @param[in]	seq		dcache_lookup()返回的失效序号
+ * @retval		void
+ */
+void dcache_add(struct m_inode * dir, const char * name, int len, int ino,
+	unsigned long seq)
+{
+	struct dcache_entry * de, ** head;
+
+	if (seq != dcache_seq || !dir->i_dev || len > NAME_LEN) {
+		return;
+	}
+	if ((de = dcache_find(dir->i_dev, dir->i_num, name, len))) {
+		de->d_ino = ino;
+		dcache_touch(de);
+		return;
+	}
+	de = dcache_lru;
+	dcache_drop(de);
+	de->d_dev = dir->i_dev;
+	de->d_dir = dir->i_num;
+	de->d_ino = ino;
+	de->d_len = len;
+	memcpy(de->d_name, name, len);
+	head = dcache_hash + dcache_hashfn(de->d_dev, de->d_dir, name, len);
+	if ((de->d_hash_next = *head)) {
+		de->d_hash_next->d_hash_pprev = &de->d_hash_next;
+	}
+	*head = de;
+	de->d_hash_pprev = head;
+	dcache_touch(de);
+}
+
+/**
+ * 使目录dir中名字name的缓存项失效(目录项被添加或删除时调用)
+ * @param[in]	dir		目录i节点
+ * @param[in]	name	文件名(用户空间，即fs段中)
+ * @param[in]	len		文件名长度
+ * @retval		void
+ */
+void dcache_remove(struct m_inode * dir, const char * name, int len)
+{
+	char buf[NAME_LEN];
+	struct dcache_entry * de;
+	int i;
+
+	dcache_seq++;
+	if (!dcache_lru) {
+		return;
+	}
+	if (len > NAME_LEN) {
+		len = NAME_LEN;
+	}
+	for (i = 0 ; i < len ; i++) {
+		buf[i] = get_fs_byte(name + i);
+	}
+	if ((de = dcache_find(dir->i_dev, dir->i_num, buf, len))) {
+		dcache_drop(de);
+	}
+}
+
+/**
+ * 使某个目录中的所有缓存项失效(目录被删除时调用，其i节点号随后可能被重用)
+ * @param[in]	dir		目录i节点
+ * @retval		void
+ */
+void dcache_purge_dir(struct m_inode * dir)
+{
+	int i;
+
+	dcache_seq++;
+	if (!dcache_lru) {
+		return;
+	}
+	for (i = 0 ; i < NR_DCACHE ; i++) {
+		if (dcache[i].d_dev == dir->i_dev && dcache[i].d_dir == dir->i_num) {
+			dcache_drop(dcache + i);
+		}
+	}
+}
+
+/**
+ * 使设备dev上的所有缓存项失效(卸载文件系统或更换软盘时调用)
+ * @param[in]	dev		设备号
+ * @retval		void
+ */
+void dcache_invalidate(int dev)
+{
+	int i;
+
+	dcache_seq++;
+	if (!dcache_lru) {
+		return;
+	}
+	for (i = 0 ; i < NR_DCACHE ; i++) {
+		if (dcache[i].d_dev == dev) {
+			dcache_drop(dcache + i);
+		}
+	}
+}
@@ -0,0 +1,479 @@
+/*
+ *  linux/fs/dirindex.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * 大目录的内存hash索引。MINIX的目录是16字节目录项的线性数组，find_entry()和add_entry()都要从
+ * 头扫描，目录里有几千个文件时每次查找和建立文件都要读遍整个目录。
+ *
+ * 目录项数达到DIR_INDEX_MIN后，第一次查找时读一遍目录建立索引：按名字hash把所有在用的目录项号
+ * (第几个目录项)链在hash表中，空闲的目录项链成一个空闲表。查找时只检查hash相同的目录项，添加时
+ * 直接从空闲表中取，都只需读一个目录块。索引只在内存中，磁盘格式不变，被替换或内存不够时丢掉，
+ * 下次查找时重建。
+ *
+ * 每个目录项在索引中占一个长字：高16位是名字hash的高16位，用来在读目录块之前排除大部分不同的
+ * 名字；低16位是所在链表(hash链或空闲表)中下一项的目录项号。
+ *
+ * 查找和添加在读目录块时可能睡眠，期间索引可能被修改甚至被重建成别的目录的索引，所以每次修改都
+ * 会改变x_seq，睡眠后发现x_seq变了就重新开始。
+ */
+
+#include <string.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+
+#define NR_DIR_INDEX	8							/* 最多同时索引的目录数 */
+#define DIR_INDEX_MIN	(4 * DIR_ENTRIES_PER_BLOCK)	/* 目录项数达到该值才建立索引 */
+#define DIR_INDEX_PAGES	16							/* 目录项数组最多占用的页面数 */
+#define SLOTS_PER_PAGE	(PAGE_SIZE / 4)
+#define NR_BUCKETS		(PAGE_SIZE / 2)				/* hash表占一页 */
+#define SLOT_END		0xffff						/* 链表结束 */
+
+struct dir_index {
+	unsigned short x_dev;				/* 目录所在设备，0表示空闲项 */
+	unsigned short x_ino;				/* 目录i节点号 */
+	unsigned char x_lock;				/* 正在建立 */
+	unsigned char x_stale;				/* 建立期间目录被修改，建好后作废 */
+	unsigned short x_free;				/* 空闲目录项链表头 */
+	unsigned long x_slots;				/* 已索引的目录项数 */
+	unsigned long x_max;				/* 已分配页面能容纳的目录项数 */
+	unsigned long x_seq;				/* 每次修改都从index_seq取一个新值 */
+	unsigned long x_used;				/* 最近使用的时刻(index_clock)，用于替换 */
+	unsigned short * x_hash;			/* hash表，每项为链表头的目录项号 */
+	unsigned long * x_pages[DIR_INDEX_PAGES];
+};
+
+static struct dir_index dir_index[NR_DIR_INDEX];
+static unsigned long index_seq = 0;
+static unsigned long index_clock = 0;
+
+#define slot_word(x, n)		((x)->x_pages[(n) / SLOTS_PER_PAGE][(n) % SLOTS_PER_PAGE])
+#define slot_next(x, n)		(slot_word(x, n) & 0xffff)
+#define slot_tag(x, n)		(slot_word(x, n) >> 16)
+#define set_slot(x, n, tag, next)	(slot_word(x, n) = ((tag) << 16) | (next))
+#define bucket(x, hash)		((x)->x_hash[(hash) % NR_BUCKETS])
+
+static unsigned long name_hash(const char * name, int len)
+{
+	unsigned long hash = 0;
+
+	while (len--) {
+		hash = (hash << 5) + hash + (unsigned char) *name++;
+	}
+	return hash ^ (hash >> 16) * 0x9e37;
+}
+
+/* 目录项中名字的长度(名字占满NAME_LEN字节时没有结尾的0) */
+static int entry_len(struct dir_entry * de)
+{
+	int len = 0;
+
+	while (len < NAME_LEN && de->name[len]) {
+		len++;
+	}
+	return len;
+}
+
+/* 目录项中的名字是否就是name(内核空间，长度len不超过NAME_LEN) */
+static int name_match(const char * name, int len, struct dir_entry * de)
+{
+	if (!de->inode || (len < NAME_LEN && de->name[len])) {
+		return 0;
+	}
+	return !memcmp(de->name, name, len);
+}
+
+/* 释放索引占用的页面，使其成为空闲项 */
+static void index_free(struct dir_index * x)
+{
+	int i;
+
+	if (x->x_hash) {
+		free_page((unsigned long) x->x_hash);
+		x->x_hash = NULL;
+	}
+	for (i = 0 ; i < DIR_INDEX_PAGES ; i++) {
+		if (x->x_pages[i]) {
+			free_page((unsigned long) x->x_pages[i]);
+			x->x_pages[i] = NULL;
+		}
+	}
+	x->x_dev = 0;
+	x->x_seq = ++index_seq;
+}
+
+static struct dir_index * index_find(struct m_inode * dir)
+{
+	struct dir_index * x;
+
+	for (x = dir_index ; x < dir_index + NR_DIR_INDEX ; x++) {
+		if (x->x_dev == dir->i_dev && x->x_ino == dir->i_num) {
+			return x;
+		}
+	}
+	return NULL;
+}
+
+/* 取目录的可用索引(不在建立中)，并记下使用时刻 */
+static struct dir_index * index_get(struct m_inode * dir)
+{
+	struct dir_index * x;
+
+	if (!(x = index_find(dir)) || x->x_lock) {
+		return NULL;
+	}
+	x->x_used = ++index_clock;
+	return x;
+}
+
+/* 从hash链中取下目录项slot，不在链中返回0 */
+static int index_unlink(struct dir_index * x, unsigned long hash, int slot)
+{
+	unsigned short * p = &bucket(x, hash);
+
+	while (*p != SLOT_END) {
+		if (*p == slot) {
+			*p = slot_next(x, slot);
+			return 1;
+		}
+		/* 链表中下一项的目录项号在当前项长字的低16位中 */
+		p = (unsigned short *) &slot_word(x, *p);
+	}
+	return 0;
+}
+
+/**
+ * 为目录dir建立索引
+ * 先占用一个索引项(空闲的，或最久未用的)并加锁，再读遍目录的所有块。建立期间目录被修改
+ * (x_stale)或目录长度变了，建好的索引就不能用，直接丢掉。
+ * @param[in]	dir		目录i节点
+ * @retval		建好的索引，目录太小、太大或者内存不够返回NULL
+ */
+static struct dir_index * index_build(struct m_inode * dir)
+{
+	struct dir_index * x, * p;
+	struct buffer_head * bh;
+	struct dir_entry * de;
+	unsigned long hash, size = dir->i_size;
+	int slots, slot, i, block;
+
+	slots = size / sizeof(struct dir_entry);
+	if (slots < DIR_INDEX_MIN || slots >= (DIR_INDEX_PAGES - 1) * SLOTS_PER_PAGE) {
+		return NULL;
+	}
+	x = NULL;
+	for (p = dir_index ; p < dir_index + NR_DIR_INDEX ; p++) {
+		if (p->x_lock) {
+			continue;
+		}
+		if (!p->x_dev) {
+			x = p;
+			break;
+		}
+		if (!x || p->x_used < x->x_used) {
+			x = p;
+		}
+	}
+	if (!x) {
+		return NULL;
+	}
+	index_free(x);
+	x->x_dev = dir->i_dev;
+	x->x_ino = dir->i_num;
+	x->x_lock = 1;
+	x->x_stale = 0;
+	x->x_used = ++index_clock;
+	/* 多留一页，目录增长时不用马上重建 */
+	x->x_max = (slots / SLOTS_PER_PAGE + 2) * SLOTS_PER_PAGE;
+	if (!(x->x_hash = (unsigned short *) get_free_page())) {
+		goto fail;
+	}
+	for (i = 0 ; i < x->x_max / SLOTS_PER_PAGE ; i++) {
+		if (!(x->x_pages[i] = (unsigned long *) get_free_page())) {
+			goto fail;
+		}
+	}
+	memset(x->x_hash, 0xff, PAGE_SIZE);
+	x->x_free = SLOT_END;
+	/* 从后向前把目录项放入链表，这样空闲表中目录项号小的在前 */
+	for (i = (slots - 1) / DIR_ENTRIES_PER_BLOCK ; i >= 0 ; i--) {
+		if (!(block = bmap(dir, i)) || !(bh = bread(dir->i_dev, block))) {
+			continue;		/* 空洞中的目录项不进入任何链表 */
+		}
+		if (x->x_stale) {
+			brelse(bh);
+			goto fail;
+		}
+		slot = i * DIR_ENTRIES_PER_BLOCK + DIR_ENTRIES_PER_BLOCK - 1;
+		if (slot >= slots) {
+			slot = slots - 1;
+		}
+		for ( ; slot >= i * DIR_ENTRIES_PER_BLOCK ; slot--) {
+			de = (struct dir_entry *) bh->b_data + slot % DIR_ENTRIES_PER_BLOCK;
+			if (de->inode) {
+				hash = name_hash(de->name, entry_len(de));
+				set_slot(x, slot, hash >> 16, bucket(x, hash));
+				bucket(x, hash) = slot;
+			} else {
+				set_slot(x, slot, 0, x->x_free);
+				x->x_free = slot;
+			}
+		}
+		brelse(bh);
+	}
+	if (x->x_stale || dir->i_size != size) {
+		goto fail;
+	}
+	x->x_slots = slots;
+	x->x_lock = 0;
+	x->x_seq = ++index_seq;
+	return x;
+fail:
+	x->x_lock = 0;
+	index_free(x);
+	return NULL;
+}
+
+/**
+ * 用索引在目录中查找名字
+ * @param[in]	dir		目录i节点
+ * @param[in]	name	文件名(内核空间)
+ * @param[in]	len		文件名长度(1 ~ NAME_LEN)
+ * @param[out]	res_dir	找到的目录项
+ * @retval		找到时返回含有目录项的缓冲块；目录没有索引(调用者应顺序查找)或名字不存在都返回NULL，
+ *				由*res_dir区分：前者为NULL，后者为(struct dir_entry *) -1
+ */
+struct buffer_head * dir_index_lookup(struct m_inode * dir, const char * name, int len,
+	struct dir_entry ** res_dir)
+{
+	struct dir_index * x;
+	struct buffer_head * bh;
+	struct dir_entry * de;
+	unsigned long hash, seq;
+	int slot, block;
+
+	*res_dir = NULL;
+	/* 索引正在建立时顺序查找 */
+	if (!(x = index_find(dir))) {
+		x = index_build(dir);
+	} else {
+		x = index_get(dir);
+	}
+	if (!x) {
+		return NULL;
+	}
+	hash = name_hash(name, len);
+repeat:
+	seq = x->x_seq;
+	for (slot = bucket(x, hash) ; slot != SLOT_END ; slot = slot_next(x, slot)) {
+		if (slot_tag(x, slot) != hash >> 16) {
+			continue;
+		}
+		block = bmap(dir, slot / DIR_ENTRIES_PER_BLOCK);
+		bh = block ? bread(dir->i_dev, block) : NULL;
+		/* 睡眠期间索引被修改过，重新开始；索引没了则由调用者顺序查找 */
+		if (x->x_seq != seq) {
+			brelse(bh);
+			if (!(x = index_get(dir))) {
+				return NULL;
+			}
+			goto repeat;
+		}
+		if (!bh) {
+			continue;
+		}
+		de = (struct dir_entry *) bh->b_data + slot % DIR_ENTRIES_PER_BLOCK;
+		if (name_match(name, len, de)) {
+			*res_dir = de;
+			return bh;
+		}
+		brelse(bh);
+	}
+	*res_dir = (struct dir_entry *) -1;
+	return NULL;
+}
+
+/**
+ * 从目录的索引中取一个空闲目录项
+ * 空闲表为空时取目录末尾之后的一项(调用者负责增加目录长度)。取出后目录项就不在任何链表中，调用
+ * 者填好名字后用dir_index_insert()把它放入hash链。
+ * @param[in]	dir		目录i节点
+ * @param[out]	seq		取出后索引的修改序号，调用者读目录块后用dir_index_valid()检查
+ * @retval		目录项号，目录没有可用的索引返回-1
+ */
+int dir_index_get_slot(struct m_inode * dir, unsigned long * seq)
+{
+	struct dir_index * x;
+	int slot;
+
+	if (!(x = index_get(dir))) {
+		return -1;
+	}
+	if ((slot = x->x_free) != SLOT_END) {
+		x->x_free = slot_next(x, slot);
+	} else if (x->x_slots < x->x_max) {
+		slot = x->x_slots++;
+	} else {
+		index_free(x);			/* 索引已满，下次查找时重建 */
+		return -1;
+	}
+	set_slot(x, slot, 0, SLOT_END);
+	*seq = x->x_seq = ++index_seq;
+	return slot;
+}
+
+/* 自dir_index_get_slot()以来目录的索引没有被修改过 */
+int dir_index_valid(struct m_inode * dir, unsigned long seq)
+{
+	struct dir_index * x;
+
+	return (x = index_find(dir)) && !x->x_lock && x->x_seq == seq;
+}
+
+/**
+ * 目录项slot刚填入了名字，把它加入索引
+ * 目录项由dir_index_get_slot()取得时只需放入hash链；由add_entry()顺序查找得到时目录若有索引
+ * (在建立中，或者在add_entry()睡眠期间建好)，为简单起见丢掉该索引。
+ * @param[in]	dir		目录i节点
+ * @param[in]	slot	目录项号
+ * @param[in]	de		目录项(名字已填好)
+ * @param[in]	indexed	目录项是否由dir_index_get_slot()取得
+ * @retval		void
+ */
+void dir_index_insert(struct m_inode * dir, int slot, struct dir_entry * de, int indexed)
+{
+	struct dir_index * x;
+	unsigned long hash;
+
+	if (!(x = index_find(dir))) {
+		return;
+	}
+	if (x->x_lock) {
+		x->x_stale = 1;
+		return;
+	}
+	if (!indexed) {
+		index_free(x);
+		return;
+	}
+	hash = name_hash(de->name, entry_len(de));
+	set_slot(x, slot, hash >> 16, bucket(x, hash));
+	bucket(x, hash) = slot;
+	x->x_seq = ++index_seq;
+}
+
+/**
+ * 目录项de被删除(i节点号已清零)，把它从hash链移到空闲表
+ * 在hash链中找名字hash相同、在同一目录块同一位置的目录项。找不到说明索引与目录不一致，丢掉索引。
+ * @param[in]	dir		目录i节点
+ * @param[in]	bh		目录项所在的缓冲块
+ * @param[in]	de		目录项
+ * @retval		void
+ */
+void dir_index_remove(struct m_inode * dir, struct buffer_head * bh, struct dir_entry * de)
+{
+	struct dir_index * x;
+	unsigned long hash, seq;
+	int slot, pos, block, restarted;
+
+	if (!(x = index_find(dir))) {
+		return;
+	}
+	if (x->x_lock) {
+		x->x_stale = 1;
+		return;
+	}
+	hash = name_hash(de->name, entry_len(de));
+	pos = de - (struct dir_entry *) bh->b_data;
+	restarted = 0;
+repeat:
+	seq = x->x_seq;
+	for (slot = bucket(x, hash) ; slot != SLOT_END ; slot = slot_next(x, slot)) {
+		if (slot_tag(x, slot) != hash >> 16 || slot % DIR_ENTRIES_PER_BLOCK != pos) {
+			continue;
+		}
+		/* 间接块中的块号可能要读盘，睡眠期间索引被修改过则重新开始 */
+		block = bmap(dir, slot / DIR_ENTRIES_PER_BLOCK);
+		if (x->x_seq != seq) {
+			if (!(x = index_get(dir))) {
+				return;
+			}
+			restarted = 1;
+			goto repeat;
+		}
+		if (block != bh->b_blocknr) {
+			continue;
+		}
+		index_unlink(x, hash, slot);
+		set_slot(x, slot, 0, x->x_free);
+		x->x_free = slot;
+		x->x_seq = ++index_seq;
+		return;
+	}
+	/* 重新开始后找不到，可能是索引在睡眠期间重建过(已不含该目录项)，否则索引有错 */
+	if (!restarted) {
+		index_free(x);
+	}
+}
+
+/**
+ * 丢掉目录dir的索引(目录被删除时调用，其i节点号随后可能被重用；索引可能与目录不一致时也调用)
+ * @param[in]	dir		目录i节点
+ * @retval		void
+ */
+void dir_index_purge(struct m_inode * dir)
+{
+	struct dir_index * x;
+
+	if ((x = index_find(dir))) {
+		if (x->x_lock) {
+			x->x_stale = 1;
+		} else {
+			index_free(x);
+		}
+	}
+}
+
+/**
+ * 丢掉设备dev上所有目录的索引(卸载文件系统或更换软盘时调用)
+ * @param[in]	dev		设备号
+ * @retval		void
+ */
+void dir_index_invalidate(int dev)
+{
+	struct dir_index * x;
+
+	for (x = dir_index ; x < dir_index + NR_DIR_INDEX ; x++) {
+		if (x->x_dev == dev) {
+			if (x->x_lock) {
+				x->x_stale = 1;
+			} else {
+				index_free(x);
+			}
+		}
+	}
+}
+
+/**
+ * 丢掉最久未用的一个目录索引，把页面还给系统(在get_free_page()没有空闲页面时调用)
+ * @retval		释放了页面返回1，否则返回0
+ */
+int shrink_dir_index(void)
+{
+	struct dir_index * x, * p = NULL;
+
+	for (x = dir_index ; x < dir_index + NR_DIR_INDEX ; x++) {
+		if (x->x_dev && !x->x_lock && (!p || x->x_used < p->x_used)) {
+			p = x;
+		}
+	}
+	if (!p) {
+		return 0;
+	}
+	index_free(p);
+	return 1;
+}
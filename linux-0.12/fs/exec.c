@@ -66,7 +66,7 @@ int sys_uselib(const char * library)
 	unsigned long base;
 
 	/* 根据进程的空间长度，判断是否为普通进程 */
-	if (get_limit(0x17) != TASK_SIZE) {
+	if (get_limit(0x17) != TASK_SIZE || (current->flags & PF_VFORK)) {
 		return -EINVAL;
 	}
 	if (library) {
@@ -82,7 +82,7 @@ int sys_uselib(const char * library)
 	current->library = NULL;
 	base = get_base(current->ldt[2]);
 	base += LIBRARY_OFFSET;
-	free_page_tables(base, LIBRARY_SIZE);
+	free_page_tables(task_pg_dir(current), base, LIBRARY_SIZE);
 	current->library = inode;
 	return 0;
 }
@@ -270,7 +270,7 @@ static unsigned long copy_strings(int argc, char ** argv, unsigned long *page,
  * 修改局部描述符表LDT中描述符的段基址和段限长，并将参数和环境空间页面放置在数据段末端。
  * @param[in]	text_size	执行文件头部中a_text字段给出的代码段长度值
  * @param[in]	page		参数和环境空间页面指针数组
- * @retval		数据段限长值(64MB)
+ * @retval		数据段限长值(TASK_SIZE)
  */
 static unsigned long change_ldt(unsigned long text_size, unsigned long * page)
 {
@@ -332,6 +332,7 @@ int do_execve(unsigned long * eip, long tmp, char * filename,
 	int retval;
 	int sh_bang = 0;
 	unsigned long p = PAGE_SIZE * MAX_ARG_PAGES - 4;
+	unsigned long * new_dir = NULL;
 
 	/* 参数eip[1]是调用本次系统调用的原用户程序代码段寄存器CS值，其中的段选择符当然必须是
 	当前任务的代码段选择符（0x000f）。 若不是该值，那么CS只能会是内核代码段的选择符0x0008。
@@ -491,6 +492,11 @@ restart_interp:
 			goto exec_error2;
 		}
 	}
+	/* vfork()的子进程在这里换上自己的页目录 */
+	if ((current->flags & PF_VFORK) && !(new_dir = new_page_dir())) {
+		retval = -ENOMEM;
+		goto exec_error2;
+	}
 /* OK, This is the point of no return */
 /* note that current->library stays unchanged by an exec */
 /* OK，下面开始就没有返回的地方了 */
@@ -515,9 +521,17 @@ restart_interp:
 		}
 	}
 	current->close_on_exec = 0;
-	/* 释放原进程的代码段和数据段占用的物理页面及页表 */
-	free_page_tables(get_base(current->ldt[1]), get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]), get_limit(0x17));
+	exit_mmap();
+	/* 释放原进程的代码段和数据段占用的物理页面及页表。vfork()的子进程用的是父进程的页表，不释放，
+	 换上新页目录后让父进程继续运行 */
+	if (current->flags & PF_VFORK) {
+		current->tss.cr3 = (long) new_dir;
+		load_cr3(new_dir);
+		mm_release();
+	} else {
+		free_page_tables(task_pg_dir(current), get_base(current->ldt[1]), get_limit(0x0f));
+		free_page_tables(task_pg_dir(current), get_base(current->ldt[2]), get_limit(0x17));
+	}
 	if (last_task_used_math == current) {
 		last_task_used_math = NULL;
 	}
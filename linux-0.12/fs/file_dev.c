@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <linux/sched.h>
 #include <linux/kernel.h>
@@ -14,6 +15,48 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/* 预读窗口的最小/最大块数 */
+#define RA_MIN	4
+#define RA_MAX	32
+
+/**
+ * 顺序读时的预读
+ * 窗口内还没读到的预读块不足一半时，就对接下来的f_ra_size个块发出预读请求(包括当前块，随后的
+ * bread()会等待它)。每次接着上一窗口预读，说明访问确实是顺序的，窗口加倍，直到RA_MAX。常规文
+ * 件所在页面已在页面高速缓冲中的块不用预读。
+ * @param[in]	inode	i节点
+ * @param[in]	filp	文件结构指针
+ * @param[in]	block	当前要读的逻辑块号
+ * @param[in]	nr		当前块对应的设备块号
+ * @retval		void
+ */
+static void file_readahead(struct m_inode * inode, struct file * filp,
+	unsigned long block, int nr)
+{
+	unsigned long end;
+
+	if (!filp->f_ra_size || filp->f_ra_end > block + filp->f_ra_size / 2) {
+		return;
+	}
+	if (filp->f_ra_end > block) {
+		filp->f_ra_size = MIN(filp->f_ra_size * 2, RA_MAX);
+	} else {
+		filp->f_ra_end = block + 1;
+	}
+	if (!S_ISREG(inode->i_mode) || !page_cached(inode, block & ~3)) {
+		read_ahead(inode->i_dev, nr);
+	}
+	end = MIN(block + 1 + filp->f_ra_size, (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	for ( ; filp->f_ra_end < end ; filp->f_ra_end++) {
+		if (S_ISREG(inode->i_mode) && page_cached(inode, filp->f_ra_end & ~3)) {
+			continue;
+		}
+		if ((nr = bmap(inode, filp->f_ra_end))) {
+			read_ahead(inode->i_dev, nr);
+		}
+	}
+}
+
 /**
  * 文件读函数
  * 根据i节点和文件结构，读取文件中数据。
@@ -26,13 +69,47 @@
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	int left, chars, nr;
+	unsigned long block, page;
 	struct buffer_head * bh;
 
 	if ((left = count) <= 0) {
 		return 0;
 	}
+	/* 从上次读到的块(或其下一块)接着读是顺序访问，打开预读；否则是随机访问，窗口减半 */
+	block = filp->f_pos / BLOCK_SIZE;
+	if (block == filp->f_ra_next || block + 1 == filp->f_ra_next) {
+		if (!filp->f_ra_size) {
+			filp->f_ra_size = RA_MIN;
+		}
+	} else {
+		if ((filp->f_ra_size >>= 1) < RA_MIN) {
+			filp->f_ra_size = 0;
+		}
+		filp->f_ra_end = 0;
+	}
 	while (left) {
-		if ((nr = bmap(inode, (filp->f_pos)/BLOCK_SIZE))) {
+		block = filp->f_pos / BLOCK_SIZE;
+		/* 常规文件从页面高速缓冲中读，一次最多读到页面末尾 */
+		if (S_ISREG(inode->i_mode)) {
+			if ((nr = bmap(inode, block))) {
+				file_readahead(inode, filp, block, nr);
+			}
+			if (!(page = get_cache_page(inode, block & ~3))) {
+				break;
+			}
+			nr = filp->f_pos % PAGE_SIZE;
+			chars = MIN( PAGE_SIZE-nr, left );
+			filp->f_pos += chars;
+			left -= chars;
+			filp->f_ra_next = (filp->f_pos - 1) / BLOCK_SIZE + 1;
+			copy_to_user(buf, nr + (char *) page, chars);
+			buf += chars;
+			free_page(page);
+			continue;
+		}
+		filp->f_ra_next = block + 1;
+		if ((nr = bmap(inode, block))) {
+			file_readahead(inode, filp, block, nr);
 			if (!(bh = bread(inode->i_dev, nr))) {
 				break;
 			}
@@ -44,16 +121,12 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 		filp->f_pos += chars;
 		left -= chars;
 		if (bh) {
-			char * p = nr + bh->b_data;
-			while (chars-- > 0) {
-				put_fs_byte(*(p++), buf++);
-			}
+			copy_to_user(buf, nr + bh->b_data, chars);
 			brelse(bh);
 		} else {
-			while (chars-- > 0) {
-				put_fs_byte(0, buf++);
-			}
+			clear_user(buf, chars);
 		}
+		buf += chars;
 	}
 	inode->i_atime = CURRENT_TIME;
 	return (count-left) ? (count-left) : -ERROR;
@@ -71,9 +144,8 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 int file_write(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	off_t pos;
-	int block, c;
+	int block, c, off;
 	struct buffer_head * bh;
-	char * p;
 	int i = 0;
 
 /*
@@ -90,27 +162,32 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 		if (!(block = create_block(inode, pos/BLOCK_SIZE))) {
 			break;
 		}
-		/* 读取指定数据块 */
-		if (!(bh = bread(inode->i_dev, block))) {
-			break;
-		}
-		c = pos % BLOCK_SIZE;
-		p = c + bh->b_data;
-		bh->b_dirt = 1;
-		c = BLOCK_SIZE - c;
+		off = pos % BLOCK_SIZE;
+		c = BLOCK_SIZE - off;
 		if (c > count - i) {
 			c = count - i;
 		}
-		pos += c;
-		if (pos > inode->i_size) {
-			inode->i_size = pos;
+		/* 先扩展文件长度，回写只写文件长度以内的块 */
+		if (pos + c > inode->i_size) {
+			inode->i_size = pos + c;
 			inode->i_dirt = 1;
 		}
-		i += c;
-		while (c-- > 0) {
-			*(p++) = get_fs_byte(buf++);
+		/* 常规文件写到页面高速缓冲中，页面不能进入缓冲时才读入数据块直接写 */
+		if (!S_ISREG(inode->i_mode) ||
+			!write_cache_block(inode, pos / BLOCK_SIZE, off, buf, c)) {
+			if (!(bh = bread(inode->i_dev, block))) {
+				break;
+			}
+			copy_from_user(off + bh->b_data, buf, c);
+			bh->b_dirt = 1;
+			brelse(bh);
+			if (S_ISREG(inode->i_mode)) {
+				invalidate_block_pages(inode, pos / BLOCK_SIZE, 1);
+			}
 		}
-		brelse(bh);
+		pos += c;
+		buf += c;
+		i += c;
 	}
 	inode->i_mtime = CURRENT_TIME;
 	if (!(filp->f_flags & O_APPEND)) {
@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <stddef.h>
 #include <sys/stat.h>
 
 #include <linux/sched.h>
@@ -16,7 +17,22 @@
  应子设备号确定的一个子设备上所拥有的数据块总数(1块大小 = 1KB) */
 extern int *blk_size[];
 
-struct m_inode inode_table[NR_INODE]={{0, }, };		/* 内存中i节点表(NR_INODE=64项) */
+/*
+ * 内存i节点缓存。i节点按页从主内存中分配，总数不超过启动时设置的max_inodes。所有在用或缓存着的
+ * i节点按(设备号, i节点号)挂在hash表中；引用计数为0的i节点挂在LRU表上(表头最久未用)，它们仍保留
+ * 在hash表中，以便再次iget()时直接命中，只有在需要空闲i节点时才从LRU表头取出重用。
+ */
+static struct m_inode * inode_hash[NR_IHASH];	/* i节点hash表 */
+static struct m_inode * inode_lru = NULL;		/* LRU表头(最久未用的空闲i节点) */
+static struct m_inode * first_inode = NULL;		/* 所有已分配i节点的链表 */
+static int nr_inodes = 0;						/* 已分配的i节点数 */
+static int max_inodes = NR_INODE;				/* i节点数上限 */
+
+/* i节点结构中hash/LRU等链表指针以前的部分，清空i节点时只清这部分 */
+#define INODE_CLEAR_SIZE	offsetof(struct m_inode, i_hash_next)
+
+#define _inode_hashfn(dev, nr)	(((unsigned)((dev) ^ (nr))) % NR_IHASH)
+#define inode_hash_head(dev, nr)	(inode_hash + _inode_hashfn(dev, nr))
 
 static void read_inode(struct m_inode *inode);		/* 读指定i节点号的i节点信息 */
 static void write_inode(struct m_inode *inode);		/* 写i节点信息到高速缓冲中 */
@@ -66,6 +82,118 @@ static inline void unlock_inode(struct m_inode *inode)
 	wake_up(&inode->i_wait);
 }
 
+/* 把i节点加入hash表(i_dev和i_num须已设置好) */
+void insert_inode_hash(struct m_inode * inode)
+{
+	struct m_inode ** head = inode_hash_head(inode->i_dev, inode->i_num);
+
+	if ((inode->i_hash_next = *head)) {
+		inode->i_hash_next->i_hash_pprev = &inode->i_hash_next;
+	}
+	*head = inode;
+	inode->i_hash_pprev = head;
+}
+
+/* 把i节点从hash表中取下 */
+static inline void unhash_inode(struct m_inode * inode)
+{
+	if (!inode->i_hash_pprev) {
+		return;
+	}
+	if (inode->i_hash_next) {
+		inode->i_hash_next->i_hash_pprev = inode->i_hash_pprev;
+	}
+	*inode->i_hash_pprev = inode->i_hash_next;
+	inode->i_hash_next = NULL;
+	inode->i_hash_pprev = NULL;
+}
+
+/* 在hash表中查找i节点(dev, nr) */
+static struct m_inode * find_inode(int dev, int nr)
+{
+	struct m_inode * inode;
+
+	for (inode = *inode_hash_head(dev, nr) ; inode ; inode = inode->i_hash_next) {
+		if (inode->i_dev == dev && inode->i_num == nr) {
+			return inode;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * 把引用计数变为0的i节点放入LRU表
+ * @param[in]	inode	i节点指针
+ * @param[in]	mru		1则放在表尾(最近使用，留作缓存)，0则放在表头(优先重用，用于已清空的i节点)
+ * @retval		void
+ */
+static void lru_add(struct m_inode * inode, int mru)
+{
+	if (inode->i_lru_next) {
+		return;
+	}
+	if (!inode_lru) {
+		inode->i_lru_next = inode->i_lru_prev = inode;
+		inode_lru = inode;
+		return;
+	}
+	inode->i_lru_next = inode_lru;
+	inode->i_lru_prev = inode_lru->i_lru_prev;
+	inode_lru->i_lru_prev->i_lru_next = inode;
+	inode_lru->i_lru_prev = inode;
+	if (!mru) {
+		inode_lru = inode;
+	}
+}
+
+/* 把i节点从LRU表中取下 */
+static void lru_del(struct m_inode * inode)
+{
+	if (!inode->i_lru_next) {
+		return;
+	}
+	if (inode->i_lru_next == inode) {
+		inode_lru = NULL;
+	} else {
+		inode->i_lru_next->i_lru_prev = inode->i_lru_prev;
+		inode->i_lru_prev->i_lru_next = inode->i_lru_next;
+		if (inode_lru == inode) {
+			inode_lru = inode->i_lru_next;
+		}
+	}
+	inode->i_lru_next = inode->i_lru_prev = NULL;
+}
+
+/* 再分配一页i节点放入LRU表。达到上限或没有空闲内存时返回0 */
+static int grow_inodes(void)
+{
+	struct m_inode * inode;
+	unsigned long page;
+	int i;
+
+	if (nr_inodes >= max_inodes || !(page = get_free_page())) {
+		return 0;
+	}
+	inode = (struct m_inode *) page;
+	for (i = PAGE_SIZE / sizeof(struct m_inode) ; i ; i--, inode++) {
+		inode->i_list = first_inode;
+		first_inode = inode;
+		lru_add(inode, 0);
+		nr_inodes++;
+	}
+	return 1;
+}
+
+/**
+ * 设置内存i节点缓存的最大i节点数，在系统初始化时调用
+ * @param[in]	max		最大i节点数，不少于NR_INODE
+ * @retval		void
+ */
+void inode_init(int max)
+{
+	max_inodes = (max < NR_INODE) ? NR_INODE : max;
+}
+
 /** 
  * 释放设备dev在内存i节点表中的所有i节点
  * @param[in]	dev		设备号
@@ -73,19 +201,38 @@ static inline void unlock_inode(struct m_inode *inode)
  */
 void invalidate_inodes(int dev)
 {
-	int i;
 	struct m_inode *inode;
 
-	inode = 0 + inode_table;		/* 指向i节点表指针数组首项 */
-	for(i = 0; i < NR_INODE; i++, inode++) {
+	for (inode = first_inode ; inode ; inode = inode->i_list) {
 		wait_on_inode(inode);
 		if (inode->i_dev == dev) {
 			if (inode->i_count)	{	/* 若其引用数不为0，则显示出错警告 */
 				printk("inode in use on removed disk\n\r");
 			}
+			unhash_inode(inode);
 			inode->i_dev = inode->i_dirt = 0;	/* 释放i节点(置设备号为0) */
 		}
 	}
+	dcache_invalidate(dev);
+	dir_index_invalidate(dev);
+	invalidate_dev_pages(dev);
+}
+
+/**
+ * 检查设备dev上是否还有正在使用的i节点(卸载文件系统前调用)
+ * @param[in]	dev		设备号
+ * @retval		没有则返回1，否则返回0
+ */
+int fs_may_umount(int dev)
+{
+	struct m_inode *inode;
+
+	for (inode = first_inode ; inode ; inode = inode->i_list) {
+		if (inode->i_dev == dev && inode->i_count) {
+			return 0;
+		}
+	}
+	return 1;
 }
 
 /**
@@ -95,11 +242,9 @@ void invalidate_inodes(int dev)
  */
 void sync_inodes(void)
 {
-	int i;
 	struct m_inode *inode;
 
-	inode = 0 + inode_table;		/* 指向i节点表指针数组首项 */
-	for(i = 0; i < NR_INODE; i++, inode++) {
+	for (inode = first_inode ; inode ; inode = inode->i_list) {
 		wait_on_inode(inode);
 		/* 判断该i节点是否已被修改并且不是管道节点 */
 		if (inode->i_dirt && !inode->i_pipe) {
@@ -117,111 +262,142 @@ void sync_inodes(void)
  * @param[in]	create	创建块标志
  * @retval		成功返回对应block的逻辑块块号，失败返回0
  */
+static int _bmap(struct m_inode * inode, int block, int create);
+
+/**
+ * 确定文件数据块block的分配目标
+ * 优先放在文件前一块之后：刚创建过前一块时i节点中记着目标，否则查前一块的逻辑块号。前一块不
+ * 存在(文件开头或空洞)时，按i节点号在数据区中的相应位置分配，使不同文件从不同区域开始，而同
+ * 一目录下先后建立的文件(i节点号相近)彼此靠近。
+ * @param[in]	inode	文件i节点
+ * @param[in]	block	文件中的数据块号
+ * @retval		目标逻辑块号
+ */
+static int block_goal(struct m_inode * inode, int block)
+{
+	struct super_block * sb;
+	int nr;
+
+	if (block && block == inode->i_next_block) {
+		return inode->i_next_goal;
+	}
+	if (block && (nr = _bmap(inode, block - 1, 0))) {
+		return nr + 1;
+	}
+	if (!(sb = get_super(inode->i_dev)) || !sb->s_ninodes) {
+		return 0;
+	}
+	/* 即数据区块数 * i_num / s_ninodes，分成两部分计算以免MINIX 2.0的大分区溢出 */
+	nr = sb->s_nzones - sb->s_firstdatazone;
+	return sb->s_firstdatazone + nr / sb->s_ninodes * inode->i_num +
+		nr % sb->s_ninodes * inode->i_num / sb->s_ninodes;
+}
+
+/**
+ * _bmap()中为文件申请一个逻辑块(数据块或间接块)
+ * 申请成功后把目标移到新块之后，这样同一次申请的间接块和数据块相邻。
+ * @param[in]		inode		文件i节点
+ * @param[in]		block		文件中的数据块号
+ * @param[in/out]	goal		分配目标，小于0表示还没有计算
+ * @param[in]		prealloc	文件正被顺序追加
+ * @retval			成功返回逻辑块号，失败返回0
+ */
+static int alloc_block(struct m_inode * inode, int block, int * goal, int prealloc)
+{
+	int nr;
+
+	if (*goal < 0) {
+		*goal = block_goal(inode, block);
+	}
+	if ((nr = new_file_block(inode, *goal, prealloc))) {
+		*goal = nr + 1;
+	}
+	return nr;
+}
+
+/* 间接块bh中第n项的逻辑块号，v2表示MINIX 2.0格式(每项4字节) */
+#define get_zone(bh, n, v2)		((v2) ? ((unsigned long *) (bh)->b_data)[n] : \
+								((unsigned short *) (bh)->b_data)[n])
+#define set_zone(bh, n, v2, nr)	((v2) ? (((unsigned long *) (bh)->b_data)[n] = (nr)) : \
+								(((unsigned short *) (bh)->b_data)[n] = (nr)))
+
 static int _bmap(struct m_inode * inode, int block, int create)
 {
+	struct super_block * sb;
 	struct buffer_head * bh;
-	int i;
+	int i, v2, shift, slot, depth;
+	int nr = block;		/* 文件中的数据块号(下面block会减去直接块数等) */
+	int goal = -1;		/* 分配目标，要申请块时才计算 */
+	int prealloc;
 
 	if (block < 0) {
 		panic("_bmap: block<0");
 	}
-	/* block >= 直接块数 + 间接块数 + 二次间接块数 */
-	if (block >= 7 + 512 + 512 * 512) {
-		panic("_bmap: block>big");
+	if (!(sb = get_super(inode->i_dev))) {
+		return 0;
 	}
+	/* 写入位置在文件末尾或之后，说明普通文件正被追加，分配时为它预留后续的块 */
+	prealloc = create && S_ISREG(inode->i_mode) &&
+		(unsigned long) block >= (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
 	
 	/**** block < 7，即直接块 ****/
 	if (block < 7) {
 		/* create=1且i节点中对应该块的逻辑块字段为0,则需申请一磁盘块 */
 		if (create && !inode->i_zone[block]) {
-			if ((inode->i_zone[block] = new_block(inode->i_dev))) {
+			if ((inode->i_zone[block] = alloc_block(inode, nr, &goal, prealloc))) {
 				inode->i_ctime = CURRENT_TIME;
 				inode->i_dirt = 1;
 			}
 		}
 		return inode->i_zone[block];
 	}
-	
-	/**** 7 <= block < 7+512，即一次间接块 ****/
+
+	/* 确定要经过几级间接块：一次间接块i_zone[7]、二次间接块i_zone[8]，MINIX 2.0还有三次间接
+	 块i_zone[9]。每个间接块有2^shift项(1.0为512项，2.0为256项) */
+	v2 = (sb->s_version == 2);
+	shift = v2 ? 8 : 9;
 	block -= 7;
-	if (block < 512) {
-		/*  create=1且i_zone[7]是0，表明文件是首次使用间接块，则需申请一磁盘块 */
-		if (create && !inode->i_zone[7]) {
-			if ((inode->i_zone[7] = new_block(inode->i_dev))) {
-				inode->i_dirt = 1;
-				inode->i_ctime = CURRENT_TIME;
-			}
+	if (block < (1 << shift)) {
+		slot = 7;
+		depth = 1;
+	} else if ((block -= 1 << shift) < (1 << (2 * shift))) {
+		slot = 8;
+		depth = 2;
+	} else if (v2 && (block -= 1 << (2 * shift)) < (1 << (3 * shift))) {
+		slot = 9;
+		depth = 3;
+	} else {
+		panic("_bmap: block>big");
+	}
+
+	/* create=1且顶层间接块还不存在，表明文件是首次使用这一级间接块，则需申请一磁盘块 */
+	if (create && !inode->i_zone[slot]) {
+		if ((inode->i_zone[slot] = alloc_block(inode, nr, &goal, prealloc))) {
+			inode->i_dirt = 1;
+			inode->i_ctime = CURRENT_TIME;
 		}
-		/* new_block()失败时，i_zone[7]为0；create=0时，i_zone[7]也为0。*/
-		//// I think：下面改成 return inode->i_zone[8]也是可以的
-		if (!inode->i_zone[7]) {
+	}
+	/* 从顶层间接块开始逐级向下，每级取出下一级间接块(最后一级则是数据块)的逻辑块号，不存在
+	 且create=1时申请新块并填入上一级间接块中 */
+	i = inode->i_zone[slot];
+	while (depth--) {
+		/* new_block()失败时或create=0时块号为0 */
+		if (!i) {
 			return 0;
 		}
-		/* 读取设备上该i节点的一次间接块 */
-		if (!(bh = bread(inode->i_dev, inode->i_zone[7]))) {
+		if (!(bh = bread(inode->i_dev, i))) {
 			return 0;
 		}
-		/* 间接块中第block项中的逻辑块号(盘块号)i，每一项占2个字节（这里的block已经减去7了） */
-		i = ((unsigned short *)(bh->b_data))[block];
-		/* i=0说明需要创建一个新逻辑块 */
+		i = get_zone(bh, (block >> (depth * shift)) & ((1 << shift) - 1), v2);
 		if (create && !i) {
-			if ((i = new_block(inode->i_dev))) {
-				((unsigned short *) (bh->b_data))[block] = i;
+			if ((i = alloc_block(inode, nr, &goal, prealloc))) {
+				set_zone(bh, (block >> (depth * shift)) & ((1 << shift) - 1), v2, i);
 				bh->b_dirt = 1;
 			}
 		}
-		/* 最后释放该间接块占用的缓冲块，并返回磁盘上对应block的逻辑块块号 */
 		brelse(bh);
-		return i;
 	}
-	
-	/**** 到这里，block已经减去7+512了，二次间接块 ****/
-	block -= 512;
-	/* create && inode->i_zone[8]=0，则需申请一个磁盘块用于存放二次间接块的一级块信息 */
-	if (create && !inode->i_zone[8]) {
-		if ((inode->i_zone[8] = new_block(inode->i_dev))) {
-			inode->i_dirt = 1;
-			inode->i_ctime = CURRENT_TIME;
-		}
-	}
-	/* new_block()失败时，i_zone[8]为0；create=0时，i_zone[8]也为0。*/
-	//// I think：下面改成 return inode->i_zone[8]也是可以的
-	if (!inode->i_zone[8]){
-		return 0;
-	}
-	/* 读取二次间接块的一级块 */
-	if (!(bh = bread(inode->i_dev, inode->i_zone[8]))) {
-		return 0;
-	}
-	/* block>>9即block/512，即取该一级块上第(block/512)项中的逻辑块号i */
-	i = ((unsigned short *)bh->b_data)[block >> 9];
-	/* i=0则需申请一磁盘块(逻辑块)作为二次间接块的二级块，并让二次间接块的一级块中第(block/512)
-	 项等于该二级块的块号i */
-	if (create && !i) {
-		if ((i = new_block(inode->i_dev))) {
-			((unsigned short *) (bh->b_data))[block >> 9] = i;
-			bh->b_dirt=1; /* 置位一级块的已修改标志 */
-		}
-	}
-	brelse(bh);	/* 释放二次间接块的一级块 */
-	if (!i) {
-		return 0;
-	}
-	/* 读取二次间接块的二级块 */
-	if (!(bh = bread(inode->i_dev, i))) {
-		return 0;
-	}
-	/* 取低9位，即第block项在二级块中的位置 */
-	i = ((unsigned short *)bh->b_data)[block & 511];
-	/* 第block项中逻辑块号为0的话，则申请一磁盘块(逻辑块)，作为最终存放数据信息的块 */
-	if (create && !i) {
-		if ((i = new_block(inode->i_dev))) {
-			((unsigned short *) (bh->b_data))[block & 511] = i;
-			bh->b_dirt = 1;
-		}
-	}
-	/* 最后释放该二次间接块的二级块，返回磁盘上新申请的或原有的对应block的逻辑块块号 */
-	brelse(bh);
+	/* 返回磁盘上新申请的或原有的对应block的逻辑块块号 */
 	return i;
 }
 
@@ -244,7 +420,14 @@ int bmap(struct m_inode * inode, int block)
  */
 int create_block(struct m_inode * inode, int block)
 {
-	return _bmap(inode, block, 1);
+	int nr;
+
+	/* 记下下一块的分配目标，顺序写入时就不用再查前一块的逻辑块号 */
+	if ((nr = _bmap(inode, block, 1))) {
+		inode->i_next_block = block + 1;
+		inode->i_next_goal = nr + 1;
+	}
+	return nr;
 }
 
 /**
@@ -273,16 +456,19 @@ void iput(struct m_inode * inode)
 		if (--inode->i_count) {
 			return;
 		}
-		/* 对于管道节点，inode->i_size存放着内存页地址。参见get_pipe_inode() */
-		free_page(inode->i_size);
+		/* 对于管道节点，inode->i_size存放着管道缓冲区的地址。参见get_pipe_inode() */
+		free_pages(inode->i_size, PIPE_ORDER);
 		inode->i_count = 0;
 		inode->i_dirt = 0;
 		inode->i_pipe = 0;
+		lru_add(inode, 0);
 		return;
 	}
 	/* 设备号=0，则将此节点的引用计数递减1，返回。例如用于管道操作的i节点，其i节点的设备号为0 */
 	if (!inode->i_dev) {
-		inode->i_count--;
+		if (!--inode->i_count) {
+			lru_add(inode, 0);
+		}
 		return;
 	}
 	/* 如果是块设备文件的i节点，则i_zone[0]中是设备号，则刷新该设备。并等待i节点解锁 */
@@ -296,6 +482,8 @@ repeat:
 		inode->i_count--;
 		return;
 	}
+	/* 最后一个引用，放弃预分配窗口中还没用到的块 */
+	discard_prealloc(inode);
 	/* 如果i节点的链接数为0，则说明i节点对应文件被删除 */
 	if (!inode->i_nlinks) {
 		/* 释放该i节点对应的所有逻辑块 */
@@ -312,55 +500,59 @@ repeat:
 		goto repeat;
 	}
 	/* 程序若能执行到此，说明该i节点的引用计数值i_count是1，链接数不为零，并且内容没有被修
-	 改过。因此此时只要把i节点引用计数递减1，返回。此时该i节点的i_count=0，表示已释放 */
+	 改过。因此此时只要把i节点引用计数递减1，返回。此时该i节点的i_count=0，表示已释放，它被放
+	 在LRU表尾，仍留在hash表中供以后iget()命中 */
 	inode->i_count--;
+	lru_add(inode, 1);
 	return;
 }
 
 /**
- * 从i节点表(inode_table)中获取一个空闲i节点项
- * 寻找引用计数count为0的i节点，并将其写盘后清零，返回其指针，引用计数被置1
+ * 清空i节点
+ * 用于释放磁盘i节点(free_inode())等场合：把i节点移出hash表，清空其内容(引用计数也变为0)，并放到
+ * LRU表头以便优先重用。
+ * @param[in]	inode	i节点指针
+ * @retval		void
+ */
+void clear_inode(struct m_inode * inode)
+{
+	unhash_inode(inode);
+	memset(inode, 0, INODE_CLEAR_SIZE);
+	lru_add(inode, 0);
+}
+
+/**
+ * 从i节点缓存中获取一个空闲i节点项
+ * 取LRU表头的i节点(最久未用)，必要时先把它写盘；LRU表为空时再分配一页i节点。取得的i节点内容
+ * 清零，引用计数置1。
  * @rerval	空闲i节点项的指针
  */
 struct m_inode * get_empty_inode(void)
 {
 	struct m_inode * inode;
-	static struct m_inode * last_inode = inode_table;	/* 指向i节点表第1项 */
-	int i;
 
-	do {
-		inode = NULL;
-		for (i = NR_INODE; i; i--) {		/* NR_INODE = 64 */
-			if (++last_inode >= inode_table + NR_INODE) {
-				last_inode = inode_table;
-			}
-			/* last_inode所指向的i节点计数值为0，则说明可能找到空闲i节点项 */
-			if (!last_inode->i_count) {
-				inode = last_inode;
-				/* 该i节点的已修改标志和和锁定标志均为0，则可以使用该i节点，退出循环 */
-				if (!inode->i_dirt && !inode->i_lock) {
-					break;
-				}
-			}
-		}
-		/* 如果没有找到空闲i节点(inode=NULL)，则将i节点表打印出来供调试使用，并停机 */
-		if (!inode) {
-			for (i = 0 ; i < NR_INODE ; i++) {
-				printk("%04x: %6d\t", inode_table[i].i_dev, inode_table[i].i_num);
-			}
+	for (;;) {
+		if (!inode_lru && !grow_inodes()) {
+			printk("%d inodes in use\n\r", nr_inodes);
 			panic("No free inodes in mem");
 		}
-		/* 等待该i节点解锁(如果又被上锁的话)。如果该i节点已修改标志被置位的话，则将该i节点
-		 刷新(同步)。因为刷新时可能会睡眠，因此需要再次循环等待i节点解锁 */
-		wait_on_inode(inode);
-		while (inode->i_dirt) {
-			write_inode(inode);
+		inode = inode_lru;
+		/* 等待该i节点解锁，已修改则先写盘。这期间可能睡眠，i节点可能被别人取走，因此重新从
+		 LRU表头开始 */
+		if (inode->i_lock || inode->i_dirt) {
 			wait_on_inode(inode);
+			while (inode->i_dirt) {
+				write_inode(inode);
+				wait_on_inode(inode);
+			}
+			continue;
 		}
-	/* 如果i节点又被其他占用的话，则重新寻找空闲i节点。否则说明已找到符合要求的空闲i节点项 */
-	} while (inode->i_count);
+		break;
+	}
 	/*则将该i节点项内容清零，并置引用计数为1，返回该i节点指针 */
-	memset(inode, 0, sizeof(*inode));
+	lru_del(inode);
+	unhash_inode(inode);
+	memset(inode, 0, INODE_CLEAR_SIZE);
 	inode->i_count = 1;
 	return inode;
 }
@@ -379,9 +571,9 @@ struct m_inode * get_pipe_inode(void)
 	if (!(inode = get_empty_inode())) {
 		return NULL;
 	}
-	/* 然后为该i节点申请一页内存。如果已没有空闲内存，则释放该i节点，并返回NULL。*/
-	if (!(inode->i_size = get_free_page())) {
-		inode->i_count = 0;
+	/* 然后为该i节点申请管道缓冲区(不必清零)。如果已没有空闲内存，则释放该i节点，并返回NULL。*/
+	if (!(inode->i_size = get_free_pages(PIPE_ORDER))) {
+		iput(inode);
 		return NULL;
 	}
 	/* 设置该i节点的引用计数为2，并复位管道头尾指针。i节点逻辑块号数组i_zone[]的i_zone[0]和
@@ -402,35 +594,28 @@ struct m_inode * get_pipe_inode(void)
  */
 struct m_inode * iget(int dev, int nr)
 {
-	struct m_inode * inode, * empty;
+	struct m_inode * inode, * empty = NULL;
 
 	/* 首先判断参数有效性。若设备号是0，则表明内核代码问题 */
 	if (!dev) {
 		panic("iget with dev==0");
 	}
-	/* 预先从i节点表中取一个空闲i节点备用 */
-	empty = get_empty_inode();
-	/* 扫描i节点表。寻找参数指定节点号nr的i节点，并递增该节点的引用次数。如果当前扫描i节点的设备
-	 号不等于指定的设备号或者节点号不等于指定的节点号，则继续扫描 */
-	inode = inode_table;
-	while (inode < NR_INODE + inode_table) {
-		if (inode->i_dev != dev || inode->i_num != nr) {
-			inode++;
-			continue;
-		}
-		/* 如果找到指定设备号dev和节点号nr的i节点，则等待该节点解锁(如果已上锁的话)。在等待该节
-		 点解锁过程中，i节点可能会发生变化。所以再次进行上述相同判断，如果发生了变化，则重新扫描
-		 整个i节点表 */
+repeat:
+	/* 在hash表中查找指定设备号dev和节点号nr的i节点 */
+	if ((inode = find_inode(dev, nr))) {
+		/* 等待该节点解锁(如果已上锁的话)。在等待过程中i节点可能会发生变化，所以再次判断，如果
+		 发生了变化，则重新查找 */
 		wait_on_inode(inode);
 		if (inode->i_dev != dev || inode->i_num != nr) {
-			inode = inode_table;
-			continue;
+			goto repeat;
 		}
-		/* 到这里表示找到相应的i节点，于是将该i节点引用计数增1。然后再作进一步检查，看它是否是另
+		/* 将该i节点引用计数增1，原来在LRU表中的则从中取下。然后再作进一步检查，看它是否是另
 		 一个文件系统的安装点。若是则寻找被安装文件系统根节点并返回。如果该i节点的确是其他文件系
 		 统的安装点，则在超级块表中搜寻安装在此i节点的超级块。如果没有找到，则显示出错信息，并放
 		 回预获取的空闲节点empty，返回该i节点指针 */
-		inode->i_count++;
+		if (!inode->i_count++) {
+			lru_del(inode);
+		}
 		if (inode->i_mount) {
 			int i;
 			for (i = 0; i < NR_SUPER; i++) {
@@ -447,31 +632,113 @@ struct m_inode * iget(int dev, int nr)
 			}
 			/* 执行到这里表示已经找到安装到inode节点的文件系统超级块。于是将该i节点写盘放回，
 			 并从安装在此i节点上的文件系统超级块中取设备号，并令i节点号为ROOT_INO。然后重新
-			 扫描整个i节点表，以获取该被安装文件系统的根i节点信息 */
+			 查找被安装文件系统的根i节点 */
 			iput(inode);
 			dev = super_block[i].s_dev;
 			nr = ROOT_INO;
-			inode = inode_table;
-			continue;
+			goto repeat;
 		}
-		/* 如果找到了相应的i节点。因此可以放弃本函数开始申请空闲i节点，返回找到的i节点指针 */
+		/* 如果找到了相应的i节点。因此可以放弃预先申请的空闲i节点，返回找到的i节点指针 */
 		if (empty) {
 			iput(empty);
 		}
 		return inode;
-    }
-	/* 如果在i节点表中没有找到指定的i节点，则利用前面申请的空闲i节点empty在i节点表中建立该i节
-	 点。并从相应设备上读取该i节点信息，返回该i节点指针 */
+	}
+	/* 缓存中没有指定的i节点，取一个空闲i节点。取的过程中可能睡眠，别人可能已经读入了该i节点，
+	 所以取到后重新查找一遍 */
 	if (!empty) {
-		return (NULL);
+		if (!(empty = get_empty_inode())) {
+			return (NULL);
+		}
+		goto repeat;
 	}
+	/* 利用空闲i节点empty建立该i节点，加入hash表，并从相应设备上读取该i节点信息 */
 	inode = empty;
 	inode->i_dev = dev;
 	inode->i_num = nr;
+	insert_inode_hash(inode);
 	read_inode(inode);
 	return inode;
 }
 
+/*
+ * 磁盘i节点与内存i节点之间的转换。MINIX 1.0的i节点只有一个时间(即修改时间)，块号为16位；
+ * 2.0的i节点有3个时间，块号为32位，并多一个三重间接块号。
+ */
+
+/* i节点号为ino的i节点所在的逻辑块号 = 
+ (启动块 + 超级块) + i节点位图块数 + 逻辑块位图块数 + (i节点号-1)/每块含有的i节点数 */
+static inline int inode_block(struct super_block * sb, int ino)
+{
+	return 2 + sb->s_imap_blocks + sb->s_zmap_blocks + (ino - 1) /
+		(sb->s_version == 2 ? V2_INODES_PER_BLOCK : INODES_PER_BLOCK);
+}
+
+static void d1_to_inode(struct m_inode * inode, struct d_inode * d)
+{
+	int i;
+
+	inode->i_mode = d->i_mode;
+	inode->i_uid = d->i_uid;
+	inode->i_size = d->i_size;
+	inode->i_mtime = d->i_time;
+	inode->i_gid = d->i_gid;
+	inode->i_nlinks = d->i_nlinks;
+	for (i = 0 ; i < 9 ; i++) {
+		inode->i_zone[i] = d->i_zone[i];
+	}
+	inode->i_zone[9] = 0;
+}
+
+static void inode_to_d1(struct m_inode * inode, struct d_inode * d)
+{
+	int i;
+
+	d->i_mode = inode->i_mode;
+	d->i_uid = inode->i_uid;
+	d->i_size = inode->i_size;
+	d->i_time = inode->i_mtime;
+	d->i_gid = inode->i_gid;
+	d->i_nlinks = inode->i_nlinks;
+	for (i = 0 ; i < 9 ; i++) {
+		d->i_zone[i] = inode->i_zone[i];
+	}
+}
+
+static void d2_to_inode(struct m_inode * inode, struct d2_inode * d)
+{
+	int i;
+
+	inode->i_mode = d->i_mode;
+	inode->i_nlinks = d->i_nlinks;
+	inode->i_uid = d->i_uid;
+	inode->i_gid = d->i_gid;
+	inode->i_size = d->i_size;
+	inode->i_atime = d->i_atime;
+	inode->i_mtime = d->i_mtime;
+	inode->i_ctime = d->i_ctime;
+	for (i = 0 ; i < 10 ; i++) {
+		inode->i_zone[i] = d->i_zone[i];
+	}
+}
+
+static void inode_to_d2(struct m_inode * inode, struct d2_inode * d)
+{
+	int i;
+
+	d->i_mode = inode->i_mode;
+	d->i_nlinks = inode->i_nlinks;
+	d->i_uid = inode->i_uid;
+	d->i_gid = inode->i_gid;
+	d->i_size = inode->i_size;
+	d->i_atime = inode->i_atime;
+	d->i_mtime = inode->i_mtime;
+	d->i_ctime = inode->i_ctime;
+	for (i = 0 ; i < 10 ; i++) {
+		d->i_zone[i] = inode->i_zone[i];
+	}
+}
+
 /**
  * 读取指定i节点信息
  * 从设备上读取含有指定i节点信息的i节点盘块，然后复制到指定的i节点结构中。
@@ -497,14 +764,16 @@ static void read_inode(struct m_inode * inode)
 	
 	/* 该i节点所在设备逻辑块号 = 
 	 (启动块 + 超级块) + i节点位图块数 + 逻辑块位图块数 + (i节点号-1)/每块含有的i节点数 */ 
-	block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks +
-		(inode->i_num - 1) / INODES_PER_BLOCK;
+	block = inode_block(sb, inode->i_num);
 	
 	if (!(bh = bread(inode->i_dev, block))) { /* 将i节点所在逻辑块读取到高速缓冲中 */
 		panic("unable to read i-node block");
 	}
-	*(struct d_inode *)inode = 
-		((struct d_inode *)bh->b_data)[(inode->i_num - 1) % INODES_PER_BLOCK];
+	if (sb->s_version == 2) {
+		d2_to_inode(inode, (struct d2_inode *) bh->b_data + (inode->i_num - 1) % V2_INODES_PER_BLOCK);
+	} else {
+		d1_to_inode(inode, (struct d_inode *) bh->b_data + (inode->i_num - 1) % INODES_PER_BLOCK);
+	}
 	/* 释放缓冲块，并解锁该i节点 */
 	brelse(bh);
 
@@ -545,14 +814,16 @@ static void write_inode(struct m_inode * inode)
 	}
 	/* 该i节点所在的逻辑块号 = 
 	 (启动块 + 超级块) + i节点位图块数 + 逻辑块位图块数 + (i节点号 - 1)/每块含有的i节点数 */
-	block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks 
-		+ (inode->i_num - 1) / INODES_PER_BLOCK;
+	block = inode_block(sb, inode->i_num);
 	if (!(bh = bread(inode->i_dev, block))) {
 		panic("unable to read i-node block");
 	}
 	/* 修改i节点所在逻辑块中的i节点信息 */
-	((struct d_inode *)bh->b_data)[(inode->i_num - 1) % INODES_PER_BLOCK] 
-		= *(struct d_inode *)inode;
+	if (sb->s_version == 2) {
+		inode_to_d2(inode, (struct d2_inode *) bh->b_data + (inode->i_num - 1) % V2_INODES_PER_BLOCK);
+	} else {
+		inode_to_d1(inode, (struct d_inode *) bh->b_data + (inode->i_num - 1) % INODES_PER_BLOCK);
+	}
 	/* 置缓冲区已修改标志，而i节点内容已经与缓冲区中的一致，因此修改标志置零 */
 	bh->b_dirt = 1;
 	inode->i_dirt = 0;
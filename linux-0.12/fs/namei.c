@@ -173,6 +173,7 @@ static int match(int len, const char * name, struct dir_entry * de)
 static struct buffer_head * find_entry(struct m_inode ** dir,
     const char * name, int namelen, struct dir_entry ** res_dir)
 {
+    char buf[NAME_LEN];
     int entries;
     int block, i;
     struct buffer_head * bh;
@@ -210,6 +211,19 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
             }
         }
     }
+    /* 大目录先用hash索引查找，目录没有索引时才顺序扫描 */
+    if (namelen > 0) {
+        for (i = 0; i < namelen; i++) {
+            buf[i] = get_fs_byte(name + i);
+        }
+        if ((bh = dir_index_lookup(*dir, buf, namelen, res_dir))) {
+            return bh;
+        }
+        if (*res_dir) {
+            *res_dir = NULL;
+            return NULL;
+        }
+    }
     if (!(block = (*dir)->i_zone[0])) {
         return NULL;
     }
@@ -240,6 +254,36 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
     return NULL;
 }
 
+/**
+ * 在目录的第slot个目录项中填入名字
+ * 目录项在目录末尾之后时增加目录长度。调用者随即填入i节点号，中间不会睡眠，所以这里就可以使名
+ * 字缓存中的否定项失效。
+ * @param[in]	dir		目录i节点
+ * @param[in]	bh		目录项所在的缓冲块
+ * @param[in]	de		目录项
+ * @param[in]	slot	目录项号
+ * @param[in]	name	文件名(用户空间)
+ * @param[in]	namelen	文件名长度
+ * @retval		void
+ */
+static void fill_entry(struct m_inode * dir, struct buffer_head * bh,
+    struct dir_entry * de, int slot, const char * name, int namelen)
+{
+    int i;
+
+    if (slot * sizeof(struct dir_entry) >= dir->i_size) {
+        dir->i_size = (slot + 1) * sizeof(struct dir_entry);
+        dir->i_dirt = 1;
+        dir->i_ctime = CURRENT_TIME;
+    }
+    dir->i_mtime = CURRENT_TIME;
+    for (i = 0; i < NAME_LEN; i++) {
+        de->name[i] = (i < namelen) ? get_fs_byte(name + i) : 0;
+    }
+    bh->b_dirt = 1;
+    dcache_remove(dir, name, namelen);
+}
+
 /*
  *	add_entry()
  *
@@ -268,7 +312,8 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
 static struct buffer_head * add_entry(struct m_inode * dir,
     const char * name, int namelen, struct dir_entry ** res_dir)
 {
-    int block,i;
+    int block,i,slot;
+    unsigned long seq;
     struct buffer_head * bh;
     struct dir_entry * de;
 
@@ -285,6 +330,31 @@ static struct buffer_head * add_entry(struct m_inode * dir,
     if (!namelen) {
         return NULL;
     }
+    /* 目录有hash索引时直接从索引的空闲表中取目录项 */
+    while ((slot = dir_index_get_slot(dir, &seq)) >= 0) {
+        /* 取出的目录项已不在索引的空闲表中，出错返回前丢掉索引，下次查找时重建 */
+        if (!(block = create_block(dir, slot / DIR_ENTRIES_PER_BLOCK)) ||
+            !(bh = bread(dir->i_dev, block))) {
+            dir_index_purge(dir);
+            return NULL;
+        }
+        /* 读目录块时睡眠过，期间索引被修改则重新取 */
+        if (!dir_index_valid(dir, seq)) {
+            brelse(bh);
+            continue;
+        }
+        de = (struct dir_entry *) bh->b_data + slot % DIR_ENTRIES_PER_BLOCK;
+        if (de->inode) {
+            printk("add_entry: directory index out of date\n\r");
+            dir_index_purge(dir);
+            brelse(bh);
+            break;
+        }
+        fill_entry(dir, bh, de, slot, name, namelen);
+        dir_index_insert(dir, slot, de, 1);
+        *res_dir = de;
+        return bh;
+    }
     if (!(block = dir->i_zone[0])) {
         return NULL;
     }
@@ -308,15 +378,10 @@ static struct buffer_head * add_entry(struct m_inode * dir,
         }
         if (i*sizeof(struct dir_entry) >= dir->i_size) {
             de->inode=0;
-            dir->i_size = (i+1)*sizeof(struct dir_entry);
-            dir->i_dirt = 1;
-            dir->i_ctime = CURRENT_TIME;
         }
         if (!de->inode) {
-            dir->i_mtime = CURRENT_TIME;
-            for (i=0; i < NAME_LEN ; i++)
-                de->name[i]=(i<namelen)?get_fs_byte(name+i):0;
-            bh->b_dirt = 1;
+            fill_entry(dir, bh, de, i, name, namelen);
+            dir_index_insert(dir, i, de, 0);
             *res_dir = de;
             return bh;
         }
@@ -328,6 +393,43 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 }
 
 
+/**
+ * 在指定目录中查找文件名对应的i节点号
+ * 先查目录项名字缓存，未命中时才用find_entry()读目录块，并把结果(包括名字不存在的情况)加入缓存。
+ * 空名字、'.'、'..'以及超长的名字不经过缓存，其中'..'可能需要由find_entry()横越伪根或安装点。
+ * @param[in/out]	dir		目录i节点指针，'..'横越安装点时会被替换
+ * @param[in]		name	文件名
+ * @param[in]		namelen	文件名长度
+ * @retval			成功返回i节点号，名字不存在返回0
+ */
+static int lookup_entry(struct m_inode ** dir, const char * name, int namelen)
+{
+    char buf[NAME_LEN];
+    struct buffer_head * bh;
+    struct dir_entry * de;
+    unsigned long seq;
+    int i, inr, cache = 0;
+
+    if (namelen > 0 && namelen <= NAME_LEN) {
+        for (i = 0; i < namelen; i++) {
+            buf[i] = get_fs_byte(name + i);
+        }
+        cache = !(buf[0] == '.' && (namelen == 1 || (namelen == 2 && buf[1] == '.')));
+    }
+    if (cache && (inr = dcache_lookup(*dir, buf, namelen, &seq)) >= 0) {
+        return inr;
+    }
+    inr = 0;
+    if ((bh = find_entry(dir, name, namelen, &de))) {
+        inr = de->inode;
+    }
+    if (cache) {
+        dcache_add(*dir, buf, namelen, inr, seq);
+    }
+    brelse(bh);
+    return inr;
+}
+
 /**
  * 查找符号链接的i节点
  * @param[in]	dir		目录i节点
@@ -387,9 +489,7 @@ static struct m_inode * get_dir(const char * pathname, struct m_inode * inode)
 {
     char c;
     const char * thisname;
-    struct buffer_head * bh;
     int namelen,inr;
-    struct dir_entry * de;
     struct m_inode * dir;
 
     if (!inode) {
@@ -412,12 +512,10 @@ static struct m_inode * get_dir(const char * pathname, struct m_inode * inode)
             /* nothing */ ;
         if (!c)
             return inode;
-        if (!(bh = find_entry(&inode,thisname,namelen,&de))) {
+        if (!(inr = lookup_entry(&inode,thisname,namelen))) {
             iput(inode);
             return NULL;
         }
-        inr = de->inode;
-        brelse(bh);
         dir = inode;
         if (!(inode = iget(dir->i_dev,inr))) {
             iput(dir);
@@ -482,8 +580,6 @@ struct m_inode * _namei(const char * pathname, struct m_inode * base,
     const char * basename;
     int inr,namelen;
     struct m_inode * inode;
-    struct buffer_head * bh;
-    struct dir_entry * de;
 
     if (!(base = dir_namei(pathname, &namelen, &basename, base))) {
         return NULL;
@@ -491,13 +587,10 @@ struct m_inode * _namei(const char * pathname, struct m_inode * base,
     if (!namelen) {			/* special case: '/usr/' etc */
         return base;
     }
-    bh = find_entry(&base, basename, namelen, &de);
-    if (!bh) {
+    if (!(inr = lookup_entry(&base, basename, namelen))) {
         iput(base);
         return NULL;
     }
-    inr = de->inode;
-    brelse(bh);
     if (!(inode = iget(base->i_dev, inr))) {
         iput(base);
         return NULL;
@@ -588,8 +681,8 @@ int open_namei(const char * pathname, int flag, int mode,
         iput(dir);
         return -EISDIR;
     }
-    bh = find_entry(&dir, basename, namelen, &de);
-    if (!bh) {
+    inr = lookup_entry(&dir, basename, namelen);
+    if (!inr) {
         if (!(flag & O_CREAT)) {
             iput(dir);
             return -ENOENT;
@@ -620,9 +713,7 @@ int open_namei(const char * pathname, int flag, int mode,
         *res_inode = inode;
         return 0;
     }
-    inr = de->inode;
     dev = dir->i_dev;
-    brelse(bh);
     if (flag & O_EXCL) {
         iput(dir);
         return -EEXIST;
@@ -730,7 +821,7 @@ int sys_mkdir(const char * pathname, int mode)
     inode->i_size = 32;
     inode->i_dirt = 1;
     inode->i_mtime = inode->i_atime = CURRENT_TIME;
-    if (!(inode->i_zone[0]=new_block(inode->i_dev))) {
+    if (!create_block(inode, 0)) {
         iput(dir);
         inode->i_nlinks--;
         iput(inode);
@@ -881,6 +972,10 @@ int sys_rmdir(const char * name)
         printk("empty directory has nlink!=2 (%d)",inode->i_nlinks);
     de->inode = 0;
     bh->b_dirt = 1;
+    dir_index_remove(dir, bh, de);
+    dcache_remove(dir, basename, namelen);
+    dcache_purge_dir(inode);
+    dir_index_purge(inode);
     brelse(bh);
     inode->i_nlinks=0;
     inode->i_dirt=1;
@@ -941,6 +1036,8 @@ int sys_unlink(const char * name)
     }
     de->inode = 0;
     bh->b_dirt = 1;
+    dir_index_remove(dir, bh, de);
+    dcache_remove(dir, basename, namelen);
     brelse(bh);
     inode->i_nlinks--;
     inode->i_dirt = 1;
@@ -976,7 +1073,7 @@ int sys_symlink(const char * oldname, const char * newname)
     }
     inode->i_mode = S_IFLNK | (0777 & ~current->umask);
     inode->i_dirt = 1;
-    if (!(inode->i_zone[0]=new_block(inode->i_dev))) {
+    if (!create_block(inode, 0)) {
         iput(dir);
         inode->i_nlinks--;
         iput(inode);
@@ -18,15 +18,30 @@
 #include <asm/segment.h>
 
 /**
- * 取文件系统信息(未实现)
- * 该系统调用用于返回已安装（mounted）文件系统的统计信息。
+ * 取文件系统信息
+ * 该系统调用用于返回已安装（mounted）文件系统的统计信息。空闲块数和空闲i节点数直接取自超级块
+ * 中的空闲统计，不用扫描位图。
  * @param[in]	dev		含有用户已安装文件系统的设备号
  * @param[in]	ubuf	一个ustat结构缓冲区指针，用于存放系统返回的文件系统信息
  * @retval		成功时返回0，并且ubuf指向的ustate结构被添入文件系统总空闲块和空闲i节点数
  */
 int sys_ustat(int dev, struct ustat * ubuf)
 {
-	return -ENOSYS;
+	struct super_block * sb;
+	struct ustat tmp;
+	int i;
+
+	if (!(sb = get_super(dev))) {
+		return -EINVAL;
+	}
+	verify_area(ubuf, sizeof(struct ustat));
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.f_tfree = sb->s_zfree;
+	tmp.f_tinode = sb->s_ifree;
+	for (i = 0; i < sizeof(tmp); i++) {
+		put_fs_byte(((char *) &tmp)[i], i + (char *) ubuf);
+	}
+	return 0;
 }
 
 
@@ -309,6 +324,8 @@ int sys_open(const char * filename, int flag, int mode)
 	f->f_count = 1;
 	f->f_inode = inode;
 	f->f_pos = 0;
+	f->f_ra_next = f->f_ra_end = 0;
+	f->f_ra_size = 0;
 	return (fd);
 }
 
@@ -38,7 +38,7 @@ int read_pipe(struct m_inode * inode, char * buf, int count)
 			interruptible_sleep_on(& PIPE_READ_WAIT(*inode));
 		}
 		/* chars表示当次循环可读取的字节数 */
-		chars = PAGE_SIZE - PIPE_TAIL(*inode);
+		chars = PIPE_BUF_SIZE - PIPE_TAIL(*inode);
 		if (chars > count) {
 			chars = count;
 		}
@@ -49,10 +49,9 @@ int read_pipe(struct m_inode * inode, char * buf, int count)
 		read += chars;
 		size = PIPE_TAIL(*inode);
 		PIPE_TAIL(*inode) += chars;
-		PIPE_TAIL(*inode) &= (PAGE_SIZE-1);
-		while (chars-->0) {
-			put_fs_byte(((char *)inode->i_size)[size++], buf++);
-		}
+		PIPE_TAIL(*inode) &= (PIPE_BUF_SIZE-1);
+		copy_to_user(buf, (char *)inode->i_size + size, chars);
+		buf += chars;
 	}
 	wake_up(& PIPE_WRITE_WAIT(*inode));
 	return read;
@@ -71,7 +70,7 @@ int write_pipe(struct m_inode * inode, char * buf, int count)
 	int chars, size, written = 0;
 
 	while (count > 0) {
-		while (!(size = (PAGE_SIZE-1) - PIPE_SIZE(*inode))) {
+		while (!(size = (PIPE_BUF_SIZE-1) - PIPE_SIZE(*inode))) {
 			wake_up(& PIPE_READ_WAIT(*inode));
 			/* 没有读进程，发出SIGPIPE信号并立即返回 */
 			if (inode->i_count != 2) { /* no readers */
@@ -81,7 +80,7 @@ int write_pipe(struct m_inode * inode, char * buf, int count)
 			sleep_on(& PIPE_WRITE_WAIT(*inode));
 		}
 		/* chars表示当次循环可写入的字节数 */
-		chars = PAGE_SIZE - PIPE_HEAD(*inode);
+		chars = PIPE_BUF_SIZE - PIPE_HEAD(*inode);
 		if (chars > count) {
 			chars = count;
 		}
@@ -92,10 +91,9 @@ int write_pipe(struct m_inode * inode, char * buf, int count)
 		written += chars;
 		size = PIPE_HEAD(*inode);
 		PIPE_HEAD(*inode) += chars;
-		PIPE_HEAD(*inode) &= (PAGE_SIZE-1);
-		while (chars-->0) {
-			((char *)inode->i_size)[size++] = get_fs_byte(buf++);
-		}
+		PIPE_HEAD(*inode) &= (PIPE_BUF_SIZE-1);
+		copy_from_user((char *)inode->i_size + size, buf, chars);
+		buf += chars;
 	}
 	wake_up(& PIPE_READ_WAIT(*inode));
 	return written;
@@ -58,6 +58,17 @@ typedef struct {
 	wait_entry entry[NR_OPEN * 3];
 } select_table;
 
+/* 等待表有近500字节，不放在内核栈上，从专门的slab缓存中分配 */
+static struct kmem_cache * select_cachep = NULL;
+
+/* 建立等待表的slab缓存(在kmem_cache_init()之后调用) */
+void select_init(void)
+{
+	if (!(select_cachep = kmem_cache_create("select_table", sizeof(select_table), NULL))) {
+		panic("Out of memory in select_init()");
+	}
+}
+
 /**
  * 把未准备好描述符的等待队列指针加入等待表wait_table中
  * @param[in]	*wait_address	与描述符相关的等待队列头指针。如tty读缓冲队列secondary的
@@ -100,7 +111,7 @@ static void free_wait(select_table * p)
 	for (i = 0; i < p->nr ; i++) {
 		tpp = p->entry[i].wait_address;
 		while (*tpp && *tpp != current) {
-			(*tpp)->state = 0;
+			wake_up_process(*tpp);
 			current->state = TASK_UNINTERRUPTIBLE;
 			schedule();
 		}
@@ -108,7 +119,7 @@ static void free_wait(select_table * p)
 			printk("free_wait: NULL");
 		}
 		if ((*tpp = p->entry[i].old_task)) {
-			(**tpp).state = 0;
+			wake_up_process(*tpp);
 		}
 	}
 	p->nr = 0;
@@ -241,10 +252,9 @@ static int check_ex(select_table * wait, struct m_inode * inode)
  * 使本进程继续运行。
  */
 int do_select(fd_set in, fd_set out, fd_set ex,
-	fd_set *inp, fd_set *outp, fd_set *exp)
+	fd_set *inp, fd_set *outp, fd_set *exp, select_table * wait_table)
 {
 	int count;
-	select_table wait_table;
 	int i;
 	fd_set mask;
 
@@ -271,35 +281,35 @@ int do_select(fd_set in, fd_set out, fd_set ex,
 		return -EBADF;
 	}
 repeat:
-	wait_table.nr = 0;
+	wait_table->nr = 0;
 	*inp = *outp = *exp = 0;
 	count = 0;
 	mask = 1;
 	for (i = 0 ; i < NR_OPEN ; i++, mask += mask) {
 		if (mask & in)
-			if (check_in(&wait_table,current->filp[i]->f_inode)) {
+			if (check_in(wait_table,current->filp[i]->f_inode)) {
 				*inp |= mask;
 				count++;
 			}
 		if (mask & out)
-			if (check_out(&wait_table,current->filp[i]->f_inode)) {
+			if (check_out(wait_table,current->filp[i]->f_inode)) {
 				*outp |= mask;
 				count++;
 			}
 		if (mask & ex)
-			if (check_ex(&wait_table,current->filp[i]->f_inode)) {
+			if (check_ex(wait_table,current->filp[i]->f_inode)) {
 				*exp |= mask;
 				count++;
 			}
 	}
 	if (!(current->signal & ~current->blocked) &&
-	    (wait_table.nr || current->timeout) && !count) {
+	    (wait_table->nr || current->timeout) && !count) {
 		current->state = TASK_INTERRUPTIBLE;
 		schedule();
-		free_wait(&wait_table);
+		free_wait(wait_table);
 		goto repeat;
 	}
-	free_wait(&wait_table);
+	free_wait(wait_table);
 	return count;
 }
 
@@ -333,6 +343,7 @@ int sys_select( unsigned long *buffer )
 	fd_set mask;
 	struct timeval *tvp;
 	unsigned long timeout;
+	select_table * wait_table;
 
 	mask = ~((~0) << get_fs_long(buffer++));
 	inp = (fd_set *) get_fs_long(buffer++);
@@ -355,16 +366,20 @@ int sys_select( unsigned long *buffer )
 		timeout += get_fs_long((unsigned long *)&tvp->tv_sec) * HZ;
 		timeout += jiffies;
 	}
-	current->timeout = timeout;
+	if (!(wait_table = (select_table *) kmem_cache_alloc(select_cachep))) {
+		return -ENOMEM;
+	}
+	set_timeout(timeout);
 	cli();
-	i = do_select(in, out, ex, &res_in, &res_out, &res_ex);
+	i = do_select(in, out, ex, &res_in, &res_out, &res_ex, wait_table);
 	if (current->timeout > jiffies) {
 		timeout = current->timeout - jiffies;
 	} else {
 		timeout = 0;
 	}
 	sti();
-	current->timeout = 0;
+	set_timeout(0);
+	kmem_cache_free(select_cachep, wait_table);
 	if (i < 0)
 		return i;
 	if (inp) {
@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/fragstat.h>
 
 #include <linux/fs.h>
 #include <linux/sched.h>
@@ -100,6 +101,77 @@ int sys_fstat(unsigned int fd, struct stat * statbuf)
 	return 0;
 }
 
+/* 顺序写入时紧接在文件数据块block之前分配的间接块数，n为每个间接块中的块号数 */
+static int meta_before(int block, int n)
+{
+	block -= 7;
+	if (block < 0) {
+		return 0;
+	}
+	if (block < n) {
+		return !block;							/* 一次间接块 */
+	}
+	block -= n;
+	if (block < n * n) {
+		if (!block) {
+			return 2;							/* 二次间接块及其第一个下级块 */
+		}
+		return !(block % n);					/* 二次间接块的下一个下级块 */
+	}
+	block -= n * n;								/* 三次间接块(MINIX 2.0) */
+	if (!block) {
+		return 3;
+	}
+	return !(block % (n * n)) ? 2 : !(block % n);
+}
+
+/**
+ * 取文件碎片统计 系统调用
+ * 按文件中的块号顺序检查每一块的逻辑块号，不连续处就是一段的开始。
+ * @param[in]		fd		文件句柄
+ * @param[in/out]	stat	用户空间中存放统计信息的结构指针
+ * @retval			成功返回0，出错返回出错码
+ */
+int sys_fragstat(unsigned int fd, struct frag_stat * stat)
+{
+	struct file * f;
+	struct m_inode * inode;
+	struct super_block * sb;
+	struct frag_stat tmp;
+	int block, nblocks, nr, prev = 0;
+	int i, n;
+
+	if (fd >= NR_OPEN || !(f = current->filp[fd]) || !(inode = f->f_inode)) {
+		return -EBADF;
+	}
+	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))) {
+		return -EINVAL;
+	}
+	if (!(sb = get_super(inode->i_dev))) {
+		return -EINVAL;
+	}
+	n = ZONES_PER_BLOCK(sb);
+	verify_area(stat, sizeof (struct frag_stat));
+	tmp.blocks = tmp.extents = tmp.holes = 0;
+	tmp.prealloc = inode->i_prealloc_count;
+	nblocks = (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	for (block = 0 ; block < nblocks ; block++) {
+		if (!(nr = bmap(inode, block))) {
+			tmp.holes++;
+			continue;
+		}
+		tmp.blocks++;
+		if (!prev || (nr != prev + 1 && nr != prev + 1 + meta_before(block, n))) {
+			tmp.extents++;
+		}
+		prev = nr;
+	}
+	for (i = 0; i < sizeof(tmp); i++) {
+		put_fs_byte(((char *) &tmp)[i], i + (char *) stat);
+	}
+	return 0;
+}
+
 /**
  * 符号链接文件 系统调用
  * 该调用读取符号链接文件的内容（即该符号链接所指向文件的路径名字符串），并放到指定长度的用户缓
@@ -39,6 +39,9 @@ void wait_for_keypress(void);	/* 等待击键 */
 			:"a" (0),"r" (bitnr),"m" (*(addr))); 							\
 	__res; })
 
+/* 位图指针数组和空闲统计放在malloc()分配的一块内存中，最多一页 */
+#define MAX_MAP_BLOCKS	(4096 / (sizeof(struct buffer_head *) + sizeof(unsigned short)))
+
 struct super_block super_block[NR_SUPER];	/* 超级块结构表数组 */
 /* this is initialized in init/main.c */ 	/* ROOT_DEV已在init/main.c中被初始化 */
 int ROOT_DEV = 0;	/* 根文件系统设备号 */
@@ -118,6 +121,24 @@ struct super_block * get_super(int dev)
 	return NULL;
 }
 
+/* 放回超级块的i节点位图和逻辑块位图缓冲块，并释放位图指针数组 */
+static void free_maps(struct super_block * sb)
+{
+	int i;
+
+	if (!sb->s_imap) {
+		return;
+	}
+	for (i = 0; i < sb->s_imap_blocks; i++) {
+		brelse(sb->s_imap[i]);
+	}
+	for (i = 0; i < sb->s_zmap_blocks; i++) {
+		brelse(sb->s_zmap[i]);
+	}
+	free(sb->s_imap);
+	sb->s_imap = sb->s_zmap = NULL;
+}
+
 /**
  * 释放指定设备dev的超级块
  * 释放设备所使用的超级块数组项(置s_dev = 0)，并释放该设备i节点位图和逻辑块位图所占用的高速缓
@@ -129,7 +150,6 @@ struct super_block * get_super(int dev)
 void put_super(int dev)
 {
 	struct super_block * sb;
-	int i;
 	/* 根文件系统设备的超级块不能被释放 */
 	if (dev == ROOT_DEV) {
 		printk("root diskette changed: prepare for armageddon\n\r");
@@ -145,13 +165,11 @@ void put_super(int dev)
 	}
 	lock_super(sb);
 	sb->s_dev = 0;	/* 置超级块空闲 */
+	dcache_invalidate(dev);
+	dir_index_invalidate(dev);
+	invalidate_dev_pages(dev);
 	/* 释放该设备上文件系统i节点位图和逻辑位图在缓冲区中所占用的缓冲块 */
-	for(i = 0; i < I_MAP_SLOTS; i++) {
-		brelse(sb->s_imap[i]);
-	}
-	for(i = 0; i < Z_MAP_SLOTS; i++) {
-		brelse(sb->s_zmap[i]);
-	}
+	free_maps(sb);
 	free_super(sb);
 	return;
 }
@@ -167,6 +185,7 @@ static struct super_block * read_super(int dev)
 {
 	struct super_block * s;
 	struct buffer_head * bh;
+	struct d_super_block * d;
 	int i, block;
 
 	if (!dev) {
@@ -193,6 +212,7 @@ static struct super_block * read_super(int dev)
 	s->s_time = 0;
 	s->s_rd_only = 0;
 	s->s_dirt = 0;
+	s->s_imap = s->s_zmap = NULL;
 	/* 从设备上读取超级块信息到bh指向的缓冲块中，再从缓冲块复制到超级块数组中 */
 	lock_super(s);
 	if (!(bh = bread(dev, 1))) {
@@ -200,19 +220,50 @@ static struct super_block * read_super(int dev)
 		free_super(s);
 		return NULL;
 	}
-	*((struct d_super_block *) s) = *((struct d_super_block *) bh->b_data);
+	d = (struct d_super_block *) bh->b_data;
+	s->s_ninodes = d->s_ninodes;
+	s->s_nzones = d->s_nzones;
+	s->s_imap_blocks = d->s_imap_blocks;
+	s->s_zmap_blocks = d->s_zmap_blocks;
+	s->s_firstdatazone = d->s_firstdatazone;
+	s->s_log_zone_size = d->s_log_zone_size;
+	s->s_max_size = d->s_max_size;
+	s->s_magic = d->s_magic;
+	/* 支持MINIX文件系统1.0(魔数0x137f)和2.0(魔数0x2468)，2.0的逻辑块数在s_zones中 */
+	if (s->s_magic == SUPER_MAGIC) {
+		s->s_version = 1;
+	} else if (s->s_magic == SUPER_V2_MAGIC) {
+		s->s_version = 2;
+		s->s_nzones = d->s_zones;
+	} else {
+		s->s_version = 0;
+	}
 	brelse(bh);
 
-	if (s->s_magic != SUPER_MAGIC) { /* linux0.12只支持MINIX文件系统1.0，魔数为0x137f */
+	/* 位图块数必须够表示所有i节点和逻辑块，位图指针数组和空闲统计要能放在一页内存中 */
+	if (!s->s_version || !s->s_imap_blocks || !s->s_zmap_blocks ||
+		s->s_imap_blocks * 8192 < s->s_ninodes + 1 ||
+		s->s_zmap_blocks * 8192 < s->s_nzones - s->s_firstdatazone + 1 ||
+		s->s_imap_blocks + s->s_zmap_blocks > MAX_MAP_BLOCKS) {
+		s->s_dev = 0;
+		free_super(s);
+		return NULL;
+	}
+	/* 一次分配两个位图的缓冲块指针数组和各位图块的空闲位数 */
+	if (!(s->s_imap = (struct buffer_head **) malloc((s->s_imap_blocks + s->s_zmap_blocks) *
+		(sizeof(struct buffer_head *) + sizeof(unsigned short))))) {
 		s->s_dev = 0;
 		free_super(s);
 		return NULL;
 	}
+	s->s_zmap = s->s_imap + s->s_imap_blocks;
+	s->s_imap_free = (unsigned short *) (s->s_zmap + s->s_zmap_blocks);
+	s->s_zmap_free = s->s_imap_free + s->s_imap_blocks;
 	/* 读取设备上i节点位图和逻辑块位图数据 */
-	for (i = 0; i < I_MAP_SLOTS; i++) {		/* 初始化i节点位图和逻辑块位图 */
+	for (i = 0; i < s->s_imap_blocks; i++) {	/* 初始化i节点位图和逻辑块位图 */
 		s->s_imap[i] = NULL;
 	}
-	for (i = 0; i < Z_MAP_SLOTS; i++) {
+	for (i = 0; i < s->s_zmap_blocks; i++) {
 		s->s_zmap[i] = NULL;
 	}
 	block = 2; /* 0为引导块，1为超级块，2～x为i节点位图，(x+1)~y为逻辑块位图 */
@@ -233,12 +284,7 @@ static struct super_block * read_super(int dev)
 	/* 如果读出的位图个数不等于位图应该占有的逻辑块数，说明文件系统位图信息有问题，超级块初始
 	 化失败，则释放所有资源 */
 	if (block != 2 + s->s_imap_blocks + s->s_zmap_blocks) {
-		for(i = 0; i < I_MAP_SLOTS; i++) {
-			brelse(s->s_imap[i]);
-		}
-		for(i = 0; i < Z_MAP_SLOTS; i++) {
-			brelse(s->s_zmap[i]);
-		}
+		free_maps(s);
 		s->s_dev = 0;		/* 释放选定的超级块数组项 */
 		free_super(s);
 		return NULL;
@@ -246,6 +292,7 @@ static struct super_block * read_super(int dev)
 	/* 0号i节点和0号逻辑块不可用 */
 	s->s_imap[0]->b_data[0] |= 1;
 	s->s_zmap[0]->b_data[0] |= 1;
+	count_free_bits(s);
 	free_super(s);
 	return s;
 }
@@ -281,11 +328,9 @@ int sys_umount(char * dev_name)
 	if (!sb->s_imount->i_mount) {
 		printk("Mounted inode has i_mount=0\n");
 	}
-	for (inode = inode_table + 0 ; inode < inode_table + NR_INODE ; inode++) {
-		/* 有进程在使用该设备上的文件，则返回忙出错码 */
-		if (inode->i_dev == dev && inode->i_count) {
-			return -EBUSY;
-		}
+	/* 有进程在使用该设备上的文件，则返回忙出错码 */
+	if (!fs_may_umount(dev)) {
+		return -EBUSY;
 	}
 	/* 开始卸载操作 */
 	sb->s_imount->i_mount = 0; /* 复位被安装到的i节点的安装标志，释放该i节点 */
@@ -367,12 +412,12 @@ int sys_mount(char *dev_name, char *dir_name, int rw_flag)
  */
 void mount_root(void)
 {
-	int i, free;
+	int i;
 	struct super_block * p;
 	struct m_inode * mi;
 
 	/* 若磁盘i节点结构不是32字节，则出错停机 */
-	if (32 != sizeof (struct d_inode)) {
+	if (32 != sizeof (struct d_inode) || 64 != sizeof (struct d2_inode)) {
 		panic("bad i-node size");
 	}
 	/* 初始化系统中的文件表数组 */
@@ -402,23 +447,7 @@ void mount_root(void)
 	p->s_isup = p->s_imount = mi; /* 置被安装文件系统i节点和被安装到i节点字段为该i节点 */
 	current->pwd = mi;	/* 设置当前进程的当前工作目录和根目录i节点 */
 	current->root = mi;
-	/* 对根文件系统上的资源作统计工作 */
-	/* 统计该设备上空闲块数 */
-	free = 0;
-	i = p->s_nzones;
-	while (-- i >= 0) {
-		if (!set_bit(i & 8191, p->s_zmap[i >> 13]->b_data)) {
-			free++;
-		}
-	}
-	printk("%d/%d free blocks\n\r", free, p->s_nzones);
-	/* 统计设备上空闲i节点数 */
-	free = 0;
-	i = p->s_ninodes + 1;
-	while (-- i >= 0) {
-		if (!set_bit(i & 8191, p->s_imap[i >> 13]->b_data)) {
-			free++;
-		}
-	}
-	printk("%d/%d free inodes\n\r", free, p->s_ninodes);
+	/* 显示根文件系统上的空闲资源(空闲块数和空闲i节点数在读超级块时已统计好) */
+	printk("%d/%d free blocks\n\r", p->s_zfree, p->s_nzones);
+	printk("%d/%d free inodes\n\r", p->s_ifree, p->s_ninodes);
 }
@@ -7,16 +7,20 @@
 #include <sys/stat.h>
 
 /** 
- * 释放所有一次间接块
+ * 释放一个间接块及其下面的所有块
+ * 间接块的每一项是下一级间接块(depth > 1)或数据块(depth = 1)的块号。MINIX 1.0每项2字节，每块
+ * 512项；2.0每项4字节，每块256项。
  * @param[in]	dev		文件系统所有设备的设备号
- * @param[in]	block	逻辑块号
+ * @param[in]	block	间接块的逻辑块号
+ * @param[in]	depth	间接级数：1为一次间接块，2为二次间接块，3为三次间接块
+ * @param[in]	v2		是否MINIX 2.0格式
  * @retval  	成功返回1，失败返回0
  */
-static int free_ind(int dev, int block)
+static int free_ind(int dev, int block, int depth, int v2)
 {
 	struct buffer_head * bh;
-	unsigned short * p;
-	int i;
+	unsigned long nr;
+	int i, n;
 	int block_busy;
 
 	/* 如果逻辑块号为0，则返回 */
@@ -24,22 +28,29 @@ static int free_ind(int dev, int block)
 		return 1;
 	}
 	block_busy = 0;
-	/* 读取一次间接块，并释放其上表明使用的所有逻辑块，然后释放该一次间接块的缓冲块 */
+	n = v2 ? BLOCK_SIZE / 4 : BLOCK_SIZE / 2;
+	/* 读取间接块，并释放其上表明使用的所有逻辑块(或下一级间接块)，然后释放该间接块的缓冲块 */
 	if ((bh = bread(dev, block))) {
-		p = (unsigned short *) bh->b_data;	/* 指向缓冲块数据区 */
-		for (i = 0; i < 512; i++, p++) {	/* 每个逻辑块上可有512个块号 */
-			if (*p) {
-				if (free_block(dev, *p)) {	/* 释放指定的设备逻辑块 */
-					*p = 0;                 /* 清零 */
-					bh->b_dirt = 1;			/* 设置已修改标志 */
+		for (i = 0; i < n; i++) {
+			nr = v2 ? ((unsigned long *) bh->b_data)[i] : ((unsigned short *) bh->b_data)[i];
+			if (!nr) {
+				continue;
+			}
+			if (depth > 1 ? free_ind(dev, nr, depth - 1, v2) : free_block(dev, nr)) {
+				/* 清零并设置已修改标志 */
+				if (v2) {
+					((unsigned long *) bh->b_data)[i] = 0;
 				} else {
-					block_busy = 1;			/* 设置逻辑块没有释放标志 */
+					((unsigned short *) bh->b_data)[i] = 0;
 				}
+				bh->b_dirt = 1;
+			} else {
+				block_busy = 1;				/* 设置逻辑块没有释放标志 */
 			}
 		}
 		brelse(bh);							/* 然后释放间接块占用的缓冲块 */
 	}
-	/* 最后释放设备上的一次间接块。但如果其中有逻辑块没有被释放，则返回0(失败) */
+	/* 最后释放设备上的间接块。但如果其中有逻辑块没有被释放，则返回0(失败) */
 	if (block_busy) {
 		return 0;
 	} else {
@@ -47,46 +58,6 @@ static int free_ind(int dev, int block)
 	}
 }
 
-
-/** 
- * 释放所有二次间接块
- * @param[in]	dev		文件系统所有设备的设备号
- * @param[in]	block	逻辑块号
- * @retval		成功返回1，失败返回0
- */
-static int free_dind(int dev, int block)
-{
-	struct buffer_head * bh;
-	unsigned short * p;
-	int i;
-	int block_busy;
-
-	if (!block) {
-		return 1;
-	}
-	block_busy = 0;
-	if ((bh = bread(dev, block))) {
-		p = (unsigned short *) bh->b_data;	/* 指向缓冲块数据区 */
-		for (i = 0; i < 512; i++, p++) {	/* 每个逻辑块上可连接512个二级块 */
-			if (*p) {
-				if (free_ind(dev, *p)) {	/* 释放所有一次间接块 */
-					*p = 0;					/* 清零 */
-					bh->b_dirt = 1;			/* 设置已修改标志 */
-				} else {
-					block_busy = 1;			/* 设置逻辑块没有释放标志 */
-				}
-			}
-		}
-		brelse(bh);							/* 释放二次间接块占用的缓冲块 */
-	}
-	/* 最后释放设备上的二次间接块。但如果其中有逻辑块没有被释放，则返回0(失败) */
-	if (block_busy) {
-		return 0;
-	} else {
-		return free_block(dev, block);		/* 最后释放存放第一间接块的逻辑块 */
-	}
-}
-
 /** 
  * 截断文件数据函数
  * 将节点对应的文件长度减0，并释放占用的设备空间
@@ -95,7 +66,8 @@ static int free_dind(int dev, int block)
  */
 void truncate(struct m_inode * inode)
 {
-	int i;
+	struct super_block * sb;
+	int i, v2;
 	int block_busy;		/* 有逻辑块没有被释放的标志 */
 
 	/* 如果不是常规文件、目录文件或链接项，则返回 */
@@ -103,6 +75,11 @@ void truncate(struct m_inode * inode)
 	     S_ISLNK(inode->i_mode))) {
 		return;
 	}
+	/* 文件的数据块将被释放并可能分配给别的文件，先作废其缓存页面，并放弃预分配的块 */
+	invalidate_inode_pages(inode);
+	discard_prealloc(inode);
+	inode->i_next_block = 0;
+	v2 = (sb = get_super(inode->i_dev)) && sb->s_version == 2;
 	
 repeat:
 	block_busy = 0;
@@ -116,17 +93,13 @@ repeat:
 			}
 		}
 	}
-	/* 释放所有一次间接块 */
-	if (free_ind(inode->i_dev, inode->i_zone[7])) {
-		inode->i_zone[7] = 0;			/* 块指针置0 */
-	} else {
-		block_busy = 1;					/* 若没有释放掉则置标志 */
-	}
-	/* 释放所有二次间接块 */
-	if (free_dind(inode->i_dev, inode->i_zone[8])) {
-		inode->i_zone[8] = 0;			/* 块指针置0 */
-	} else {
-		block_busy = 1;					/* 若没有释放掉则置标志 */
+	/* 释放一次、二次和(MINIX 2.0的)三次间接块 */
+	for (i = 7; i < 10; i++) {
+		if (free_ind(inode->i_dev, inode->i_zone[i], i - 6, v2)) {
+			inode->i_zone[i] = 0;		/* 块指针置0 */
+		} else {
+			block_busy = 1;				/* 若没有释放掉则置标志 */
+		}
 	}
 	/* 设置i节点已修改标志，并且如果还有逻辑块由于“忙”而没有被释放，则把当前进程运行时间
 	 片置0，以让当前进程先被切换去运行其他进程，稍等一会再重新执行释放操作 */
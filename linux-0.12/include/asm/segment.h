@@ -69,6 +69,77 @@ static inline void put_fs_long(unsigned long val,unsigned long * addr)
 	__asm__ ("movl %0,%%fs:%1"::"r" (val),"m" (*addr));
 }
 
+/*
+ * 成块复制用户空间数据。先按长字用rep movsl复制，剩下不足4字节的再逐字节复制，用于读写文件、
+ * 块设备、管道和终端时大段数据的传送，代替逐字节的get_fs_byte()/put_fs_byte()。
+ *
+ * 这里不做写验证：对用户缓冲区的写验证由sys_read()在进入读操作前对整个区域一次做完。
+ */
+
+/**
+ * 把内核空间的数据复制到fs段中
+ * @param[in]	to		目的地址(fs段)
+ * @param[in]	from	源地址(内核空间)
+ * @param[in]	n		复制字节数
+ */
+static inline void copy_to_user(void * to, const void * from, unsigned long n)
+{
+	int d0, d1, d2;
+
+	__asm__ __volatile__ ("cld\n\t"
+		"push %%es\n\t"
+		"push %%fs\n\t"
+		"pop %%es\n\t"
+		"rep movsl\n\t"
+		"movl %%eax,%%ecx\n\t"
+		"rep movsb\n\t"
+		"pop %%es"
+		:"=&c" (d0),"=&D" (d1),"=&S" (d2)
+		:"0" (n >> 2),"1" (to),"2" (from),"a" (n & 3)
+		:"memory");
+}
+
+/**
+ * 把fs段中的数据复制到内核空间
+ * @param[in]	to		目的地址(内核空间)
+ * @param[in]	from	源地址(fs段)
+ * @param[in]	n		复制字节数
+ */
+static inline void copy_from_user(void * to, const void * from, unsigned long n)
+{
+	int d0, d1, d2;
+
+	__asm__ __volatile__ ("cld\n\t"
+		"rep movsl %%fs:(%%esi),%%es:(%%edi)\n\t"
+		"movl %%eax,%%ecx\n\t"
+		"rep movsb %%fs:(%%esi),%%es:(%%edi)"
+		:"=&c" (d0),"=&D" (d1),"=&S" (d2)
+		:"0" (n >> 2),"1" (to),"2" (from),"a" (n & 3)
+		:"memory");
+}
+
+/**
+ * 把fs段中的一段内存清零
+ * @param[in]	to		起始地址(fs段)
+ * @param[in]	n		字节数
+ */
+static inline void clear_user(void * to, unsigned long n)
+{
+	int d0, d1;
+
+	__asm__ __volatile__ ("cld\n\t"
+		"push %%es\n\t"
+		"push %%fs\n\t"
+		"pop %%es\n\t"
+		"rep stosl\n\t"
+		"movl %%edx,%%ecx\n\t"
+		"rep stosb\n\t"
+		"pop %%es"
+		:"=&c" (d0),"=&D" (d1)
+		:"0" (n >> 2),"1" (to),"a" (0),"d" (n & 3)
+		:"memory");
+}
+
 /*
  * Someone who knows GNU asm better than I should double check the followig.
  * It seems to work, but I don't know if I'm doing something subtly wrong.
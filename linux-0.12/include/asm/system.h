@@ -23,6 +23,12 @@ __asm__ (										\
 
 #define iret() __asm__ ("iret"::)		/* 中断返回 */
 
+/* 保存/恢复标志寄存器(主要是中断允许标志IF)，用于可能在关中断状态下被调用的临界区 */
+#define save_flags(x) \
+__asm__ __volatile__("pushfl ; popl %0":"=r" (x): /* no input */ :"memory")
+#define restore_flags(x) \
+__asm__ __volatile__("pushl %0 ; popfl": /* no output */ :"r" (x):"memory")
+
 /**
  * 设置门描述符宏
  * @param[in]	gate_addr	在中断描述符表中的偏移量
@@ -47,6 +47,32 @@
 #define WRITEA 	3		/* "write-ahead" - silly, but somewhat useful */
 						/* 预写 */
 
+/* bdflush()的功能号：启动缓冲块回写守护进程，或读取/设置回写参数 */
+#define BDF_DAEMON		0	/* 当前进程成为回写守护进程，不再返回 */
+#define BDF_AGE			1	/* 脏缓冲块最多保留多久才写盘(滴答数) */
+#define BDF_INTERVAL	2	/* 守护进程的扫描周期(滴答数) */
+#define BDF_RATIO		3	/* 脏缓冲块超过总数的百分之几就开始后台回写 */
+#define BDF_STATS		4	/* 取高速缓冲统计，data指向用户空间的struct buffer_stat */
+
+/* 未被使用的缓冲块所在的LRU表 */
+#define BUF_CLEAN		0	/* 干净的 */
+#define BUF_LOCKED		1	/* 正在读写的 */
+#define BUF_DIRTY		2	/* 脏的 */
+#define NR_LIST			3
+#define BUF_USED		NR_LIST	/* 正在使用，不在任何表上 */
+
+/* 高速缓冲统计，用于调整缓冲区大小 */
+struct buffer_stat {
+	unsigned long nr_buffers;		/* 缓冲块总数 */
+	unsigned long nr_clean;			/* 各LRU表上的空闲缓冲块数 */
+	unsigned long nr_locked;
+	unsigned long nr_dirty;
+	unsigned long hits;				/* getblk()在缓冲中找到 */
+	unsigned long misses;			/* 没找到，重用了一个空闲块 */
+	unsigned long evictions;		/* 重用时丢弃了有效数据的次数 */
+	unsigned long dirty_evictions;	/* 重用前不得不先写盘的次数 */
+};
+
 void buffer_init(long buffer_end);			/* 高速缓冲区初始化 */
 
 #define MAJOR(a) (((unsigned)(a)) >> 8)		/* 取高字节(主设备号) */
@@ -55,12 +81,12 @@ void buffer_init(long buffer_end);			/* 高速缓冲区初始化 */
 #define NAME_LEN 		14					/* 文件名长度值 */
 #define ROOT_INO 		1					/* 根i节点 */
 
-#define I_MAP_SLOTS 	8					/* i节点位图的块数 */
-#define Z_MAP_SLOTS 	8					/* 逻辑块(区段块)位图的块数 */
-#define SUPER_MAGIC 	0x137F				/* 文件系统魔数 */
+#define SUPER_MAGIC 	0x137F				/* MINIX 1.0文件系统魔数 */
+#define SUPER_V2_MAGIC 	0x2468				/* MINIX 2.0文件系统魔数(文件名14字节) */
 
 #define NR_OPEN 		20					/* 进程最多打开文件数 */
-#define NR_INODE 		64					/* 系统同时最多使用i节点个数 */
+#define NR_INODE 		64					/* 内存i节点缓存的最小容量，实际上限在启动时由inode_init()设置 */
+#define NR_IHASH 		131					/* i节点Hash表数组长度 */
 #define NR_FILE 		64					/* 系统最多文件个数(文件数组长度) */
 #define NR_SUPER 		8					/* 系统所含超级块个数(超级块数组长度) */
 #define NR_HASH 		307					/* 缓冲区Hash表数组长度 */
@@ -73,17 +99,24 @@ void buffer_init(long buffer_end);			/* 高速缓冲区初始化 */
 
 /* 每个逻辑块可存放的i节点数 */
 #define INODES_PER_BLOCK ((BLOCK_SIZE) / (sizeof (struct d_inode)))
+#define V2_INODES_PER_BLOCK ((BLOCK_SIZE) / (sizeof (struct d2_inode)))
+/* 间接块中的块号数：MINIX 1.0每项2字节，2.0每项4字节 */
+#define ZONES_PER_BLOCK(sb)	((sb)->s_version == 2 ? BLOCK_SIZE / 4 : BLOCK_SIZE / 2)
 /* 每个逻辑块可存放的目录项数 */           
 #define DIR_ENTRIES_PER_BLOCK ((BLOCK_SIZE) / (sizeof (struct dir_entry)))
 
 #define PIPE_READ_WAIT(inode) 	((inode).i_wait)
 #define PIPE_WRITE_WAIT(inode) 	((inode).i_wait2)
 
+/* 管道缓冲区是2^PIPE_ORDER个物理上连续的页面 */
+#define PIPE_ORDER				1
+#define PIPE_BUF_SIZE			(PAGE_SIZE << PIPE_ORDER)
+
 #define PIPE_HEAD(inode) 		((inode).i_zone[0])		/* 管道头部指针 */
 #define PIPE_TAIL(inode) 		((inode).i_zone[1])		/* 管道尾部指针 */
-#define PIPE_SIZE(inode)		((PIPE_HEAD(inode) - PIPE_TAIL(inode)) & (PAGE_SIZE - 1))	/* 管道大小 */
+#define PIPE_SIZE(inode)		((PIPE_HEAD(inode) - PIPE_TAIL(inode)) & (PIPE_BUF_SIZE - 1))	/* 管道大小 */
 #define PIPE_EMPTY(inode) 		(PIPE_HEAD(inode) == PIPE_TAIL(inode))	/* 管道空 */
-#define PIPE_FULL(inode) 		(PIPE_SIZE(inode) == (PAGE_SIZE - 1))	/* 管道满 */
+#define PIPE_FULL(inode) 		(PIPE_SIZE(inode) == (PIPE_BUF_SIZE - 1))	/* 管道满 */
 
 #define NIL_FILP	((struct file *)0)	/* 空文件结构指针 */
 #define SEL_IN		1
@@ -113,10 +146,19 @@ struct buffer_head {
 	/* 这四个指针用于缓冲区的管理 */
 	struct buffer_head * b_prev;		/* hash队列上的前一块 */
 	struct buffer_head * b_next;		/* hash队列上的后一块 */
-	struct buffer_head * b_prev_free;	/* 空闲表上的前一块 */
-	struct buffer_head * b_next_free;	/* 空闲表上的后一块 */
+	struct buffer_head * b_prev_free;	/* LRU表上的前一块 */
+	struct buffer_head * b_next_free;	/* LRU表上的后一块 */
+	struct buffer_head * b_reqnext;		/* 合并的请求项中的下一块 */
+	unsigned long b_flushtime;			/* 脏块应写盘的时间(jiffies)，0表示还未记录 */
+	unsigned char b_list;				/* 所在的LRU表，BUF_USED表示不在表上 */
 };
 
+/*
+ * 缓冲块写盘或作废时变干净，同时清除写盘时间。这样它每次重新变脏后，brelse()或回写守护进程都
+ * 会重新记下写盘时间，而不会沿用上一次变脏时的期限。
+ */
+#define mark_buffer_clean(bh)	((bh)->b_dirt = 0, (bh)->b_flushtime = 0)
+
 /* 磁盘上的索引节点(i节点)数据结构 */
 struct d_inode {
 	unsigned short i_mode;				/* 文件类型和属性(rwx位) */
@@ -129,15 +171,28 @@ struct d_inode {
 										/* zone是区的意思，可译成区段，或逻辑块 */
 };
 
-/* 内存中的索引节点(i节点)数据结构 */
+/* MINIX 2.0磁盘上的i节点，块号为32位，并增加了三重间接块 */
+struct d2_inode {
+	unsigned short i_mode;
+	unsigned short i_nlinks;
+	unsigned short i_uid;
+	unsigned short i_gid;
+	unsigned long i_size;
+	unsigned long i_atime;
+	unsigned long i_mtime;
+	unsigned long i_ctime;
+	unsigned long i_zone[10];			/* 直接(0-6)，间接(7)，二重间接(8)，三重间接(9) */
+};
+
+/* 内存中的索引节点(i节点)数据结构，与磁盘格式之间的转换见fs/inode.c */
 struct m_inode {
 	unsigned short i_mode;
 	unsigned short i_uid;
 	unsigned long i_size;
 	unsigned long i_mtime;
-	unsigned char i_gid;
-	unsigned char i_nlinks;
-	unsigned short i_zone[9];
+	unsigned short i_gid;
+	unsigned short i_nlinks;
+	unsigned long i_zone[10];			/* 三重间接块(9)只用于MINIX 2.0 */
 	/* these are in memory also */		/* 以下是内存中特有的 */
 	struct task_struct * i_wait;		/* 等待该i节点的进程 */
 	struct task_struct * i_wait2;		/* for pipes */
@@ -152,6 +207,17 @@ struct m_inode {
 	unsigned char i_mount;				/* 安装标志 */
 	unsigned char i_seek;				/* 搜寻标志(lseek时) */
 	unsigned char i_update;				/* 更新标志 */
+	/* block allocation, see fs/bitmap.c */
+	unsigned short i_prealloc_count;	/* 预分配窗口中剩余的块数 */
+	unsigned long i_prealloc_block;		/* 预分配窗口中的下一块 */
+	unsigned long i_next_block;			/* 上次创建/映射的文件块号+1 */
+	unsigned long i_next_goal;			/* 该块的分配目标(上次的逻辑块号+1) */
+	/* inode cache links, see fs/inode.c */
+	struct m_inode * i_hash_next;		/* hash链表中的下一项 */
+	struct m_inode ** i_hash_pprev;		/* 指向前一项的i_hash_next或hash表头，NULL表示不在hash表中 */
+	struct m_inode * i_lru_next;		/* LRU表中的下一项(LRU表中只有引用计数为0的i节点) */
+	struct m_inode * i_lru_prev;		/* LRU表中的上一项 */
+	struct m_inode * i_list;			/* 所有已分配i节点链表中的下一项 */
 };
 
 /* 文件结构(用于在文件句柄与i节点之间建立关系) */
@@ -161,12 +227,15 @@ struct file {
 	unsigned short f_count;				/* 对应文件引用计数值 */
 	struct m_inode *f_inode;			/* 指向对应i节点 */
 	off_t f_pos;						/* 文件位置(读写偏移值) */
+	unsigned long f_ra_next;			/* 顺序读时下次应读的逻辑块号 */
+	unsigned long f_ra_end;				/* 已发出预读请求的逻辑块号上限(不含) */
+	unsigned short f_ra_size;			/* 预读窗口的块数，0表示不预读 */
 };
 
 /* 内存中的超级块结构 */
 struct super_block {
 	unsigned short s_ninodes;			/* 节点数 */
-	unsigned short s_nzones;			/* 逻辑块数 */
+	unsigned long s_nzones;				/* 逻辑块数(MINIX 2.0取自s_zones) */
 	unsigned short s_imap_blocks;		/* i节点位图所占用的数据块数 */
 	unsigned short s_zmap_blocks;		/* 逻辑块位图所占用的数据块数 */
 	unsigned short s_firstdatazone;		/* 第一个数据逻辑块号 */
@@ -174,8 +243,16 @@ struct super_block {
 	unsigned long s_max_size;			/* 文件最大长度 */
 	unsigned short s_magic;				/* 文件系统魔数 */
 	/* These are only in memory */		/* 以下是内存中特有的 */
-	struct buffer_head * s_imap[8];		/* i节点位图缓冲块指针数组(占用8块，可表示64M) */
-	struct buffer_head * s_zmap[8];		/* 逻辑块位图缓冲块指针数组(占用8块) */
+	unsigned char s_version;			/* 文件系统版本：1或2 */
+	struct buffer_head ** s_imap;		/* i节点位图缓冲块指针数组(s_imap_blocks项) */
+	struct buffer_head ** s_zmap;		/* 逻辑块位图缓冲块指针数组(s_zmap_blocks项) */
+	/* free space summary, see fs/bitmap.c */
+	unsigned short * s_imap_free;		/* 各i节点位图块中的空闲位数 */
+	unsigned short * s_zmap_free;		/* 各逻辑块位图块中的空闲位数 */
+	unsigned long s_ifree;				/* 空闲i节点总数 */
+	unsigned long s_zfree;				/* 空闲逻辑块总数 */
+	unsigned long s_ihint;				/* 该位号之前的i节点都已占用 */
+	unsigned long s_zhint;				/* 该位号之前的逻辑块都已占用 */
 	unsigned short s_dev;				/* 超级块所在设备号 */
 	struct m_inode * s_isup;			/* 被安装的文件系统根目录的i节点(isup-superi) */
 	struct m_inode * s_imount;			/* 被安装到的i节点 */
@@ -196,6 +273,9 @@ struct d_super_block {
 	unsigned short s_log_zone_size;		/* log(数据块数/逻辑块) */
 	unsigned long s_max_size;			/* 文件最大长度 */
 	unsigned short s_magic;				/* 文件系统魔数 */
+	/* MINIX 2.0 only */
+	unsigned short s_state;				/* 文件系统状态 */
+	unsigned long s_zones;				/* 逻辑块数(s_nzones不再使用) */
 };
 
 /* 文件目录项结构 */
@@ -204,7 +284,6 @@ struct dir_entry {
 	char name[NAME_LEN];				/* 文件名，长度NAME_LEN=14 */
 };
 
-extern struct m_inode inode_table[NR_INODE];	/* 定义i节点表数组(64项) */
 extern struct file file_table[NR_FILE];			/* 文件表数组(64项) */
 extern struct super_block super_block[NR_SUPER];/* 超级块数组(8项) */
 extern struct buffer_head * start_buffer;		/* 缓冲区起始内存位置 */
@@ -262,6 +341,59 @@ extern struct m_inode * iget(int dev, int nr);
 /* 从i节点表中获取一个空闲i节点项 */
 extern struct m_inode * get_empty_inode(void);
 
+/* 把i节点加入i节点缓存的hash表 */
+extern void insert_inode_hash(struct m_inode * inode);
+
+/* 清空不再使用的i节点(引用计数变为0)并放回空闲i节点 */
+extern void clear_inode(struct m_inode * inode);
+
+/* 设备dev上是否已没有正在使用的i节点 */
+extern int fs_may_umount(int dev);
+
+/* 设置内存i节点缓存的最大i节点数 */
+extern void inode_init(int max);
+
+/* 目录项名字缓存：查找、加入 */
+extern int dcache_lookup(struct m_inode * dir, const char * name, int len,
+						unsigned long * seq);
+extern void dcache_add(struct m_inode * dir, const char * name, int len, int ino,
+						unsigned long seq);
+
+/* 使名字缓存中目录dir的名字name、目录dir的全部、设备dev的全部缓存项失效 */
+extern void dcache_remove(struct m_inode * dir, const char * name, int len);
+extern void dcache_purge_dir(struct m_inode * dir);
+extern void dcache_invalidate(int dev);
+
+/* 大目录的hash索引：查找、取空闲目录项、检查索引没有变、加入和删除目录项 */
+extern struct buffer_head * dir_index_lookup(struct m_inode * dir, const char * name, int len,
+						struct dir_entry ** res_dir);
+extern int dir_index_get_slot(struct m_inode * dir, unsigned long * seq);
+extern int dir_index_valid(struct m_inode * dir, unsigned long seq);
+extern void dir_index_insert(struct m_inode * dir, int slot, struct dir_entry * de, int indexed);
+extern void dir_index_remove(struct m_inode * dir, struct buffer_head * bh, struct dir_entry * de);
+
+/* 丢掉目录dir、设备dev的全部目录索引；回收一个目录索引的页面 */
+extern void dir_index_purge(struct m_inode * dir);
+extern void dir_index_invalidate(int dev);
+extern int shrink_dir_index(void);
+
+/* 页面高速缓冲：取文件中从逻辑块block开始的一页、查询该页是否已缓存 */
+extern unsigned long get_cache_page(struct m_inode * inode, unsigned long block);
+extern int page_cached(struct m_inode * inode, unsigned long block);
+
+/* 把用户数据写入缓存页面；交回共享映射中写过的页面；把脏页面写盘 */
+extern int write_cache_block(struct m_inode * inode, unsigned long block, int offset,
+						const char * buf, int count);
+extern int set_page_dirty(struct m_inode * inode, unsigned long block, unsigned long page);
+extern void sync_cache_pages(int dev, long age);
+
+/* 作废文件inode的全部缓存页面、与文件某些块重叠的不对齐页面、设备dev的全部缓存页面；回收一个
+   空闲的缓存页面 */
+extern void invalidate_inode_pages(struct m_inode * inode);
+extern void invalidate_block_pages(struct m_inode * inode, unsigned long block, int nr);
+extern void invalidate_dev_pages(int dev);
+extern int shrink_page_cache(void);
+
 /* 获取(申请)管道节点 */
 extern struct m_inode * get_pipe_inode(void);
 
@@ -276,6 +408,7 @@ extern void ll_rw_block(int rw, struct buffer_head * bh);
 
 /* 读/写数据页面 */
 extern void ll_rw_page(int rw, int dev, int nr, char * buffer);
+extern void ll_rw_pages(int rw, int dev, int nr, int count, char * buffer);
 
 /* 释放指定缓冲块 */
 extern void brelse(struct buffer_head * buf);
@@ -283,18 +416,37 @@ extern void brelse(struct buffer_head * buf);
 /* 读取指定的数据块 */
 extern struct buffer_head * bread(int dev, int block);
 
-/* 读取设备上一个页面(4个缓冲块)的内容到指定内存地址处 */
+/* 读取设备上一个页面(4个缓冲块)的内容到指定内存地址处；把页面中的各块写到设备上 */
 extern void bread_page(unsigned long addr, int dev, int b[4]);
+extern void bwrite_page(unsigned long addr, int dev, int b[4]);
 
 /* 读取头一个指定的数据块，并标记后续将要读的块 */
 extern struct buffer_head * breada(int dev, int block, ...);
 
-/* 向设备dev申请一个磁盘块 */
-extern int new_block(int dev);
+/* 对指定块发出预读请求，不等待 */
+extern void read_ahead(int dev, int block);
+
+/* 把未被使用的缓冲块按状态放到对应的LRU表上 */
+extern void refile_buffer(struct buffer_head * bh);
+
+/* 唤醒缓冲块回写守护进程 */
+extern void wakeup_bdflush(void);
+
+/* 向设备dev申请一个磁盘块，从goal开始找 */
+extern int new_block(int dev, int goal);
+
+/* 为文件申请一个磁盘块，使用文件的预分配窗口 */
+extern int new_file_block(struct m_inode * inode, int goal, int prealloc);
+
+/* 放弃文件的预分配窗口中剩余的块 */
+extern void discard_prealloc(struct m_inode * inode);
 
 /* 释放设备数据区中的逻辑块 */
 extern int free_block(int dev, int block);
 
+/* 统计超级块中各位图块的空闲位数(安装文件系统时调用) */
+extern void count_free_bits(struct super_block * sb);
+
 /* 为设备dev建立一个新i节点 */
 extern struct m_inode * new_inode(int dev);
 
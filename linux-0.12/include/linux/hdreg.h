@@ -40,6 +40,10 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_MULTREAD		0xC4	/* 多扇区读，每个中断传输一组扇区 */
+#define WIN_MULTWRITE		0xC5	/* 多扇区写 */
+#define WIN_SETMULT		0xC6	/* 设置多扇区读写每组的扇区数 */
+#define WIN_IDENTIFY		0xEC	/* 读取驱动器参数 */
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
@@ -1,13 +1,14 @@
 #ifndef _HEAD_H
 #define _HEAD_H
 
-/* 段描述符的数据结构。该结构仅说明每个描述符是由8个字节构成，每个描述符表共有256项。 */
+/* 段描述符的数据结构。该结构仅说明每个描述符是由8个字节构成，中断描述符表共有256项。 */
 typedef struct desc_struct {
 	unsigned long a,b;
 } desc_table[256];
 
 extern unsigned long pg_dir[1024];	/* 内存页目录数组。每个目录项为4字节，从物理地址0开始 */
-extern desc_table idt, gdt;		/* 中断描述符表，全局描述符表 */
+extern desc_table idt;				/* 中断描述符表 */
+extern struct desc_struct gdt[];	/* 全局描述符表，4项之后是每个任务的TSS和LDT描述符 */
 
 #define GDT_NUL		0		/* 全局描述符表的第0项,不用 */
 #define GDT_CODE	1		/* 第1项，内核代码段描述符项 */
@@ -10,13 +10,9 @@ void console_print(const char * str);   /* 控制台显示函数 */
 int tty_write(unsigned ch,char * buf,int count);/* 往tty上写指定长度的字符串 */
 void * malloc(unsigned int size);       /* 通用内核内存分配函数 */
 void free_s(void * obj, int size);      /* 释放指定对象占用的内存 */
-extern void hd_times_out(void);         /* 硬盘处理超时 */
-extern void sysbeepstop(void);          /* 停止蜂鸣 */
 extern void blank_screen(void);         /* 黑屏处理 */
 extern void unblank_screen(void);       /* 恢复被黑屏的屏幕 */
 
-extern int beepcount;       /* 蜂鸣时间滴答计数 */
-extern int hd_timeout;      /* 硬盘超时滴答值 */
 extern int blankinterval;   /* 设定的屏幕黑屏间隔时间 */
 extern int blankcount;      /* 黑屏时间计数 */
 
@@ -11,12 +11,58 @@ extern int SWAP_DEV;
 #define read_swap_page(nr,buffer) ll_rw_page(READ,SWAP_DEV,(nr),(buffer));
 #define write_swap_page(nr,buffer) ll_rw_page(WRITE,SWAP_DEV,(nr),(buffer));
 
-extern unsigned long get_free_page(void);
+/* 伙伴系统的阶数：最大可以申请2^(NR_MEM_LISTS-1)个连续页面(128KB) */
+#define NR_MEM_LISTS	6
+
+/* __get_free_page()的分配标志 */
+#define GFP_ZERO	0	/* 页面清零 */
+#define GFP_NOZERO	1	/* 调用者会覆盖整个页面，不必清零 */
+
+extern unsigned long __get_free_page(int flags);
+#define get_free_page()	__get_free_page(GFP_ZERO)
+extern unsigned long get_free_pages(int order);
+extern unsigned long __get_free_pages(int order);
+extern void free_pages(unsigned long addr, int order);
+
+/* slab对象缓存(mm/slab.c) */
+struct kmem_cache;
+extern struct kmem_cache * kmem_cache_create(const char * name, int size, void (*ctor)(void *));
+extern void * kmem_cache_alloc(struct kmem_cache * cachep);
+extern void kmem_cache_free(struct kmem_cache * cachep, void * obj);
+extern struct kmem_cache * kmem_obj_cache(const void * obj);
+extern int kmem_cache_reap(void);
+extern void kmem_cache_show(void);
+extern void kmem_cache_init(void);
+extern void malloc_init(void);
 extern unsigned long put_dirty_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
 extern void init_swapping(void);
 void swap_free(int page_nr);
 void swap_in(unsigned long *table_ptr);
+extern void swap_read_page(int swap_nr, unsigned long page);
+extern int shrink_swap_cache(void);
+extern int zero_idle_page(void);
+extern void zero_pages_show(void);
+
+/*
+ * 页表项的特殊值：干净页面已被swap_out()回收，再访问时重新从文件读入(或重新分配)。与交换页面项
+ * 一样P=0，但不对应任何交换页面。用于统计回收后很快又被访问的页面(抖动)。
+ */
+#define PAGE_DROPPED	0xfffffffe
+
+/* 页面回收统计 */
+struct swap_stat {
+	unsigned long scanned;		/* swap_out()检查过的页面数 */
+	unsigned long reclaimed;	/* 回收(取消映射)的页面数 */
+	unsigned long swapped;		/* 其中写到交换设备的脏页面数 */
+	unsigned long refaults;		/* 被回收后又被访问而重新调入的页面数 */
+	unsigned long swap_writes;	/* 写交换设备的请求项数(每项最多一簇) */
+	unsigned long swap_reads;	/* 读交换设备的请求项数 */
+	unsigned long readahead;	/* 预读进交换页面缓存的页面数 */
+	unsigned long cache_hits;	/* 在交换页面缓存中找到的页面数 */
+};
+
+extern struct swap_stat swap_stat;
 
 static inline void oom(void)
 {
@@ -26,18 +72,28 @@ static inline void oom(void)
 
 /* 刷新页变换高速缓冲（TLB）宏函数 */ 	
 /* 为了提高地址转换的效率，CPU将最近使用的页表数据存放在芯片中高速缓冲中。在修改过页表信息之后，就
- 需要刷新该缓冲区。这里使用重新加载页目录基址寄存器CR3的方法来进行刷新。下面eax=0是页目录的基址。*/
-#define invalidate() __asm__("movl %%eax,%%cr3"::"a" (0))
+ 需要刷新该缓冲区。这里使用重新加载页目录基址寄存器CR3的方法来进行刷新。每个任务有自己的页目录，
+ 所以重新装入CR3原来的值。*/
+#define invalidate() __asm__("movl %%cr3,%%eax\n\tmovl %%eax,%%cr3":::"ax")
+
+/* 让当前任务改用页目录dir(同时还要修改TSS中的cr3，以后切换回来时由CPU装入) */
+#define load_cr3(dir) __asm__("movl %%eax,%%cr3"::"a" (dir))
 
 /* these are not to be changed without changing head.s etc */
 #define LOW_MEM 0x100000				/* 物理内存地址低端1MB */
 extern unsigned long HIGH_MEMORY;		/* 物理内存地址高端 */
-#define PAGING_MEMORY (15*1024*1024) /* 可分页的物理内存大小 */
-#define PAGING_PAGES (PAGING_MEMORY>>12)	/* 可分页的物理内存的页面数 */
+extern unsigned long paging_pages;		/* 可分页的物理内存(LOW_MEM ~ HIGH_MEMORY)的页面数 */
+#define PAGING_PAGES paging_pages
 #define MAP_NR(addr) (((addr)-LOW_MEM)>>12)	/* 将物理内存地址映射成物理内存页面号 */
-#define USED 100	/* 物理内存被占用 */
+#define USED 0x8000	/* 物理内存被占用(大于任何可能的引用计数) */
+
+/*
+ * 内核恒等映射的物理内存上限。内核映射位于每个页目录的开头，进程从其后的USER_BASE开始，超出的
+ * 内存不使用。boot/head.s中内核段的限长与此一致。
+ */
+#define MAX_MEMORY	0x40000000
 
-extern unsigned char mem_map [ PAGING_PAGES ];
+extern unsigned short * mem_map;
 
 #define PAGE_DIRTY		0x40		/* 脏位 */
 #define PAGE_ACCESSED	0x20		/* 已访问位 */
@@ -45,4 +101,28 @@ extern unsigned char mem_map [ PAGING_PAGES ];
 #define PAGE_RW			0x02		/* 页面读写位 */
 #define PAGE_PRESENT	0x01		/* 页面存在位 */
 
+/*
+ * 进程的内存映射区(mm/mmap.c)。地址是进程空间中的偏移(即用户程序看到的地址)，都按页面对齐。
+ */
+struct m_inode;
+
+struct vm_area_struct {
+	unsigned long vm_start;				/* 起始地址 */
+	unsigned long vm_end;				/* 结束地址(不含) */
+	unsigned long vm_offset;			/* vm_start对应的文件偏移 */
+	struct m_inode * vm_inode;			/* 映射的文件，NULL表示匿名映射 */
+	unsigned short vm_flags;
+	struct vm_area_struct * vm_next;	/* 下一个映射区(地址更高) */
+};
+
+#define VM_READ		0x0001		/* 可读 */
+#define VM_WRITE	0x0002		/* 可写 */
+#define VM_SHARED	0x0004		/* MAP_SHARED：写入的内容对其他进程可见并写回文件 */
+
+struct task_struct;
+extern struct vm_area_struct * find_vma(struct task_struct * p, unsigned long addr);
+extern int copy_mmap(struct task_struct * p);
+extern void exit_mmap(void);
+extern void zap_page_range(unsigned long from, unsigned long size);
+
 #endif
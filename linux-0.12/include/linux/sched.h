@@ -3,9 +3,12 @@
 
 #define HZ 100		/* 时钟滴答数， 1秒钟100个 */
 
-#define NR_TASKS		64			/* 系统同时容纳的最多任务数 */
-#define TASK_SIZE		0x04000000	/* 进程的长度 */
+#define NR_TASKS		256			/* 系统同时容纳的最多任务数(GDT在boot/head.s中按此预留) */
+#define TASK_SIZE		0x40000000	/* 进程的长度 */
+#define USER_BASE		0x40000000	/* 进程在线性地址空间中的位置(在内核恒等映射之上) */
 #define LIBRARY_SIZE	0x00400000	/* 动态加载库的长度 */
+#define NR_PRIO			32			/* 调度优先级级数，每级一条就绪队列(位图正好一个long) */
+#define MAX_PRIO		(NR_PRIO-1)	/* 最高优先级，priority取值范围为1..MAX_PRIO */
 
 #if (TASK_SIZE & 0x3fffff)
 #error "TASK_SIZE must be multiple of 4M"
@@ -19,12 +22,16 @@
 #error "LIBRARY_SIZE too damn big!"
 #endif
 
-#if (((TASK_SIZE>>16)*NR_TASKS) != 0x10000)
-#error "TASK_SIZE*NR_TASKS must be 4GB"
+#if (USER_BASE & 0x3fffff)
+#error "USER_BASE must be a multiple of 4M"
 #endif
 
 #define LIBRARY_OFFSET (TASK_SIZE - LIBRARY_SIZE)	/* 动态库被加载的位置 */
 
+/* mmap()的映射区：brk不能超过MMAP_BASE，其上到栈之前(为栈预留64MB)是映射区 */
+#define MMAP_BASE		(TASK_SIZE / 4)
+#define MMAP_TOP		(LIBRARY_OFFSET - 0x4000000)
+
 #define CT_TO_SECS(x)	((x) / HZ)					/* 滴答数转换成秒 */
 #define CT_TO_USECS(x)	(((x) % HZ) * 1000000/HZ)	/* 滴答数转换成微秒 */
 
@@ -53,8 +60,12 @@
 #define NULL ((void *) 0)
 #endif
 
-extern int copy_page_tables(unsigned long from, unsigned long to, long size);
-extern int free_page_tables(unsigned long from, unsigned long size);
+extern int copy_page_tables(unsigned long * to_dir, unsigned long from, unsigned long to, long size);
+extern int free_page_tables(unsigned long * dir, unsigned long from, unsigned long size);
+extern unsigned long * new_page_dir(void);
+extern void mm_release(void);
+
+struct prio_array;
 
 extern void sched_init(void);
 extern void schedule(void);
@@ -64,6 +75,21 @@ extern int tty_write(unsigned minor,char * buf,int count);
 
 typedef int (*fn_ptr)();
 
+/*
+ * 内核定时器。到期时刻expires以jiffies计，到期后在时钟中断中调用function(data)。定时器结构由
+ * 使用者提供(静态变量或嵌在其他结构中)，挂在kernel/sched.c的分级时间轮上，因此数目不受限制。
+ */
+struct timer_list {
+	struct timer_list * next;
+	struct timer_list ** pprev;			/* 指向前一项的next域或槽头，NULL表示未挂入 */
+	unsigned long expires;				/* 到期时刻 */
+	unsigned long data;					/* 传给function的参数 */
+	void (*function)(unsigned long);	/* 到期处理函数 */
+};
+
+#define init_timer(t)		((t)->next = NULL, (t)->pprev = NULL)
+#define timer_pending(t)	((t)->pprev != NULL)
+
 struct i387_struct {
 	long	cwd;
 	long	swd;
@@ -167,6 +193,14 @@ struct task_struct {
 	struct desc_struct ldt[3];		/* 局部描述符表, 0 - 空，1 - 代码段cs，2 - 数据和堆栈段ds&ss */
 /* tss for this task */
 	struct tss_struct tss;			/* 进程的任务状态段信息结构 */
+/* run queue links, see kernel/sched.c */
+	struct task_struct * run_next;	/* 同一优先级就绪队列中的下一个任务 */
+	struct task_struct * run_prev;	/* 同一优先级就绪队列中的上一个任务 */
+	struct prio_array * array;		/* 所在的优先级数组(active/expired)，不在队列中时为NULL */
+	unsigned long epoch;			/* 上次重算时间片时的数组交换纪元 */
+	struct timer_list timeout_timer;	/* timeout到期时唤醒任务 */
+	struct timer_list alarm_timer;		/* alarm到期时发送SIGALRM */
+	struct vm_area_struct * mmap;		/* mmap()映射区链表，按地址排序 */
 };
 
 /*
@@ -175,6 +209,7 @@ struct task_struct {
 /* 每个进程的标志 */    				/* 打印对齐警告信息。还未实现，仅用于486 */
 #define PF_ALIGNWARN	0x00000001	/* Print alignment warning msgs */
 					/* Not implemented yet, only for 486*/
+#define PF_VFORK		0x00000002	/* vfork()的子进程，还在借用父进程的页目录 */
 
 /*
  *  INIT_TASK is used to set up the first task table, touch at
@@ -207,8 +242,18 @@ struct task_struct {
 	 _LDT(0),0x80000000, \
 		{} \
 	}, \
+/* runq */	NULL,NULL,NULL,0, \
+/* timers */	{NULL,NULL,0,0,NULL}, {NULL,NULL,0,0,NULL}, \
+/* mmap */	NULL, \
 }
 
+/*
+ * 每个任务有自己的页目录，切换任务时由CPU从TSS中装入CR3。所有页目录的前(USER_BASE>>22)项
+ * 相同，是内核的恒等映射；其余是进程自己的页表，所有进程都位于线性地址USER_BASE处。任务0
+ * 使用boot/head.s中的pg_dir。
+ */
+#define task_pg_dir(p) ((unsigned long *) (p)->tss.cr3)
+
 extern struct task_struct *task[NR_TASKS];	/* 任务指针数组 */
 extern struct task_struct *last_task_used_math;	/* 上一个使用过协处理器的进程 */
 extern struct task_struct *current;			/* 当前运行进程结构指针变量 */
@@ -218,10 +263,15 @@ extern int jiffies_offset;					/* 用于累计需要调整的时间滴答数 */
 
 #define CURRENT_TIME (startup_time+(jiffies+jiffies_offset)/HZ)	/* 当前时间(秒数) */
 
-extern void add_timer(long jiffies, void (*fn)(void));
+extern void add_timer(struct timer_list * timer);
+extern int del_timer(struct timer_list * timer);
+extern void mod_timer(struct timer_list * timer, unsigned long expires);
+extern void set_timeout(unsigned long timeout);
 extern void sleep_on(struct task_struct ** p);
 extern void interruptible_sleep_on(struct task_struct ** p);
 extern void wake_up(struct task_struct ** p);
+extern void wake_up_process(struct task_struct * p);
+extern void signal_wake_up(struct task_struct * p);
 extern int in_group_p(gid_t grp);
 
 /*
@@ -92,6 +92,13 @@ extern int sys_symlink();
 extern int sys_lstat();
 extern int sys_readlink();
 extern int sys_uselib();
+extern int sys_iosched();
+extern int sys_bdflush();
+extern int sys_vfork();
+extern int sys_mmap();
+extern int sys_munmap();
+extern int sys_msync();
+extern int sys_fragstat();
 
 /* 系统调用处理程序的指针数组表 */
 fn_ptr sys_call_table[] = { sys_setup, sys_exit, sys_fork, sys_read,
@@ -109,7 +116,8 @@ sys_getpgrp, sys_setsid, sys_sigaction, sys_sgetmask, sys_ssetmask,
 sys_setreuid,sys_setregid, sys_sigsuspend, sys_sigpending, sys_sethostname,
 sys_setrlimit, sys_getrlimit, sys_getrusage, sys_gettimeofday, 
 sys_settimeofday, sys_getgroups, sys_setgroups, sys_select, sys_symlink,
-sys_lstat, sys_readlink, sys_uselib };
+sys_lstat, sys_readlink, sys_uselib, sys_iosched, sys_bdflush, sys_vfork,
+sys_mmap, sys_munmap, sys_msync, sys_fragstat };
 
 /* So we don't have to do any more manual updating.... */
 int NR_syscalls = sizeof(sys_call_table)/sizeof(fn_ptr);
@@ -0,0 +1,15 @@
+#ifndef _FRAGSTAT_H
+#define _FRAGSTAT_H
+
+/* 文件在磁盘上的存放情况 */
+struct frag_stat {
+	unsigned long blocks;		/* 已分配的数据块数 */
+	unsigned long extents;		/* 连续存放的段数，1表示没有碎片(顺序分配的间接块不算断开) */
+	unsigned long holes;		/* 文件长度内没有分配的块数 */
+	unsigned long prealloc;		/* 预分配窗口中为文件保留的块数 */
+};
+
+/* 取打开文件fd的碎片统计，成功返回0 */
+extern int fragstat(int fd, struct frag_stat * stat);
+
+#endif
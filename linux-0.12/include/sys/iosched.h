@@ -0,0 +1,24 @@
+#ifndef _IOSCHED_H
+#define _IOSCHED_H
+
+/* 块设备I/O调度策略 */
+#define IOSCHED_ELEVATOR	0	/* 单向电梯，读先于写 */
+#define IOSCHED_DEADLINE	1	/* 按扇区排序，但读/写请求各有超时期限，超时的优先处理 */
+#define IOSCHED_NOOP		2	/* 先来先服务，适用于虚拟盘 */
+#define NR_IOSCHED			3
+
+/* 每个主设备的请求项延迟统计，下标0为读、1为写，时间单位为滴答(jiffies) */
+struct iosched_stat {
+	long policy;					/* 当前调度策略 */
+	unsigned long nr_done[2];		/* 已完成的请求项数 */
+	unsigned long wait_total[2];	/* 从进入队列到完成的总时间 */
+	unsigned long wait_max[2];		/* 最长的一次 */
+};
+
+/*
+ * 查询/设置主设备major的I/O调度策略。policy < 0只查询，否则设置(需超级用户)并清零统计；stat
+ * 不为NULL时返回统计信息。成功返回设置前的策略。
+ */
+extern int iosched(int major, int policy, struct iosched_stat * stat);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _SYS_MMAN_H
+#define _SYS_MMAN_H
+
+#include <sys/types.h>
+
+/* 映射区的访问权限 */
+#define PROT_NONE		0x0
+#define PROT_READ		0x1
+#define PROT_WRITE		0x2
+#define PROT_EXEC		0x4		/* 386的页面不区分执行权限，等同于PROT_READ */
+
+/* 映射类型，MAP_SHARED和MAP_PRIVATE必须指定一个 */
+#define MAP_SHARED		0x01	/* 写入的内容对其他进程可见，并写回文件 */
+#define MAP_PRIVATE		0x02	/* 写时复制，不影响文件 */
+#define MAP_FIXED		0x10	/* 必须映射在指定地址处 */
+#define MAP_ANONYMOUS	0x20	/* 不映射文件，内容为0(只能与MAP_PRIVATE一起使用) */
+
+#define MAP_FAILED		((void *) -1)
+
+/* msync()的标志 */
+#define MS_ASYNC		1		/* 只写到高速缓冲中 */
+#define MS_INVALIDATE	2		/* 映射总是与页面高速缓冲一致，忽略 */
+#define MS_SYNC			4		/* 并等待写到设备上 */
+
+/*
+ * 系统调用mmap只有一个参数：指向依次存放addr、len、prot、flags、fd、off这6个long值的数组的指针，
+ * 由库函数mmap()组织。
+ */
+extern void * mmap(void * addr, size_t len, int prot, int flags, int fd, off_t off);
+extern int munmap(void * addr, size_t len);
+extern int msync(void * addr, size_t len, int flags);
+
+#endif
@@ -167,6 +167,13 @@
 #define __NR_lstat			84
 #define __NR_readlink		85
 #define __NR_uselib			86
+#define __NR_iosched		87
+#define __NR_bdflush		88
+#define __NR_vfork			89
+#define __NR_mmap			90
+#define __NR_munmap			91
+#define __NR_msync			92
+#define __NR_fragstat		93
 
 /**** 以下定义系统调用嵌入式汇编宏函数 ****/
 // Tip: 在宏定义中，若在两个标记之间有两个连续的井号'##'，则表示在宏替换时会把这两个标记符号连
@@ -256,6 +263,7 @@ volatile void exit(int status);
 volatile void _exit(int status);
 int fcntl(int fildes, int cmd, ...);
 int fork(void);
+int vfork(void);
 int getpid(void);
 int getuid(void);
 int geteuid(void);
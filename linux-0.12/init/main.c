@@ -45,6 +45,8 @@ _syscall0(int, pause)
 _syscall1(int, setup, void *, BIOS)
 // int sync() 系统调用：更新文件系统
 _syscall0(int, sync)
+// int bdflush(int func, long data) 系统调用：启动缓冲块回写守护进程或设置回写参数
+_syscall2(int, bdflush, int, func, long, data)
 
 #include <linux/tty.h>
 #include <linux/sched.h>
@@ -73,7 +75,12 @@ extern void blk_dev_init(void);					/* 块设备初始化blk_drv/ll_re_blk.c */
 extern void chr_dev_init(void);					/* 字符设备初始化chr_drv/tty_io.c */
 extern void hd_init(void);						/* 硬盘初始化blk_drv/hd.c */
 extern void floppy_init(void);					/* 软驱初始化blk_drv/floppy.c */
-extern void mem_init(long start, long end);		/* 内存管理初始化mm/memory.c */
+extern long paging_init(long start, long end);	/* 映射16MB以上的内存mm/memory.c */
+extern long mem_init(long start, long end);		/* 内存管理初始化mm/memory.c */
+extern void kmem_cache_init(void);				/* slab对象缓存初始化mm/slab.c */
+extern void malloc_init(void);					/* 通用内存分配初始化lib/malloc.c */
+extern void select_init(void);					/* select()等待表缓存初始化fs/select.c */
+extern void mmap_init(void);					/* 映射区结构缓存初始化mm/mmap.c */
 extern long rd_init(long mem_start, int length);/* 虚拟盘初始化blk_drv/ramdisk.c */
 extern long kernel_mktime(struct tm * tm);		/* 计算系统开机启动时间(秒) */
 
@@ -96,6 +103,8 @@ static int sprintf(char * str, const char *fmt, ...)
  * 这些数据由内核引导期间的setup.s程序设置。
  */
 #define EXT_MEM_K (*(unsigned short *)0x90002)			/* 1MB以后的扩展内存大小(KB) */
+#define ALT_MEM_K (*(unsigned short *)0x901E0)			/* E801: 1MB~16MB之间的内存(KB) */
+#define ALT_MEM_64K (*(unsigned short *)0x901E2)		/* E801: 16MB以上的内存(64KB块数) */
 #define CON_ROWS ((*(unsigned short *)0x9000e) & 0xff)	/* 选定的控制台屏幕的行数 */
 #define CON_COLS (((*(unsigned short *)0x9000e) & 0xff00) >> 8)	/* ...列数 */
 #define DRIVE_INFO (*(struct drive_info *)0x90080)		/* 硬盘参数表32字节内容 */
@@ -141,7 +150,7 @@ static void time_init(void)
 	startup_time = kernel_mktime(&time);/* 计算开机时间。*/
 }
 
-static long memory_end = 0;				/* 机器所具有的物理内存容量 */
+static unsigned long memory_end = 0;		/* 机器所具有的物理内存容量 */
 static long buffer_memory_end = 0;		/* 高速缓冲区末端地址 */
 static long main_memory_start = 0;		/* 主内存开始的位置 */
 static char term[32];					/* 终端设置字符串 */
@@ -178,25 +187,64 @@ int main(void)		/* This really is void, no error here. */
 
 	/* 根据机器物理内存容量设置高速缓冲区和主内存区的起始地址 */
 	memory_end = (1 << 20) + (EXT_MEM_K << 10); /* 1M + 扩展内存大小 */
+	/* 0x88功能最多报告64MB，BIOS支持E801时用它的结果。2GB以上的内存用int计算会溢出，所以先把
+	   64KB块数限制在MAX_MEMORY以内，再按无符号数计算 */
+	if (ALT_MEM_64K) {
+		memory_end = ALT_MEM_64K;
+		if (memory_end > (MAX_MEMORY - (16 << 20)) >> 16) {
+			memory_end = (MAX_MEMORY - (16 << 20)) >> 16;
+		}
+		memory_end = (16UL << 20) + (memory_end << 16);
+	} else if (ALT_MEM_K) {
+		memory_end = (1 << 20) + (ALT_MEM_K << 10);
+	}
 	memory_end &= 0xfffff000;					/* 忽略不到4K(1页)的内存 */
-	if (memory_end > 16 * 1024 * 1024) {		/* 最多管理16M内存 */
-		memory_end = 16 * 1024 * 1024;
+	if (memory_end > MAX_MEMORY) {				/* 最多管理MAX_MEMORY内存 */
+		memory_end = MAX_MEMORY;
 	}
 
-	if (memory_end > 12 * 1024 * 1024) {
+	/* 高速缓冲区大小随内存容量增加，32MB以上取1/8，但最多16MB */
+	if (memory_end > 32 * 1024 * 1024) {
+		buffer_memory_end = (memory_end >> 3) & 0xfff00000;
+		if (buffer_memory_end > 16 * 1024 * 1024) {
+			buffer_memory_end = 16 * 1024 * 1024;
+		}
+	} else if (memory_end > 12 * 1024 * 1024) {
 		buffer_memory_end = 4 * 1024 * 1024;
 	} else if (memory_end > 6 * 1024 * 1024) {
 		buffer_memory_end = 2 * 1024 * 1024;
 	} else {
 		buffer_memory_end = 1 * 1024 * 1024;
 	}
+	/* paging_init()的页表放在缓冲区之后，而head.s只映射了前16MB，所以缓冲区还要给页表让出位置。
+	   1GB内存需要252个页表，此时缓冲区为15MB */
+	if (memory_end > 16 * 1024 * 1024) {
+		long tables = ((memory_end - 16 * 1024 * 1024 + 0x3fffff) >> 22) << 12;
+
+		if (buffer_memory_end + tables > 16 * 1024 * 1024) {
+			buffer_memory_end = (16 * 1024 * 1024 - tables) & 0xfff00000;
+		}
+	}
 	main_memory_start = buffer_memory_end;
-#ifdef RAMDISK	/* 如果定义了虚拟盘，则主内存还得相应减少 */
-	main_memory_start += rd_init(main_memory_start, RAMDISK*1024);
+	/* 映射16MB以上的内存(页表放在主内存区开头)，然后分配mem_map[] */
+	main_memory_start = paging_init(main_memory_start, memory_end);
+#ifdef RAMDISK	/* 如果定义了虚拟盘，则放在内存的最高端，主内存还得相应减少 */
+	memory_end -= RAMDISK*1024;
+	memory_end &= 0xfffff000;
+	rd_init(memory_end, RAMDISK*1024);
+#endif
+	main_memory_start = mem_init(main_memory_start, memory_end);
+#ifdef INODES	/* 内存i节点缓存的上限，未指定时按每MB内存64个计算 */
+	inode_init(INODES);
+#else
+	inode_init((memory_end >> 20) * 64);
 #endif
 
 /* 以下是内核进行所有方面的初始化工作 */
-	mem_init(main_memory_start, memory_end);/* 主内存区初始化 */
+	kmem_cache_init();						/* slab对象缓存初始化 */
+	malloc_init();							/* 通用内存分配初始化 */
+	select_init();							/* select()等待表缓存初始化 */
+	mmap_init();							/* 映射区结构缓存初始化 */
 	trap_init();							/* 陷阱门初始化 */
 	blk_dev_init();							/* 块设备初始化 */
 	chr_dev_init();							/* 字符设备初始化 */
@@ -257,6 +305,12 @@ void init(void)
 
 	setup((void *) &drive_info);
 
+	/* fork出缓冲块回写守护进程，它在bdflush()中循环，不会返回 */
+	if (!fork()) {
+		bdflush(BDF_DAEMON, 0);
+		_exit(1);
+	}
+
 	(void) open("/dev/tty1", O_RDWR, 0);	/* stdin */
 	(void) dup(0);							/* stdout */
 	(void) dup(0);							/* stderr */
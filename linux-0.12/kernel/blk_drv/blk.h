@@ -1,6 +1,8 @@
 #ifndef _BLK_H
 #define _BLK_H
 
+#include <sys/iosched.h>
+
 #define NR_BLK_DEV	7
 /*
  * NR_REQUEST is the number of entries in the request-queue.
@@ -20,6 +22,11 @@
  * paging, 'bh' is NULL, and 'waiting' is used to wait for
  * read/write completion.
  */
+/*
+ * 相邻的缓冲块可以合并到同一请求项中：bh指向当前正在传输的缓冲块，其余的通过b_reqnext链接，
+ * bhtail指向最后一块。sector/nr_sectors/buffer是当前位置和剩余扇区数，end_request()每完成一块
+ * 就转到链中的下一块，整个请求项在最后一块完成后才释放。
+ */
 struct request {
 	int dev;		/* -1 if no request */
 	int cmd;		/* READ or WRITE */
@@ -29,7 +36,10 @@ struct request {
 	char * buffer;
 	struct task_struct * waiting;
 	struct buffer_head * bh;
+	struct buffer_head * bhtail;
+	unsigned long start_time;	/* 进入队列的时间(jiffies) */
 	struct request * next;
+	struct request * fifo_next;	/* deadline策略下同方向请求项按到达顺序的链表 */
 };
 
 /*
@@ -42,9 +52,30 @@ struct request {
 ((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
 (s1)->sector < (s2)->sector))))
 
+struct blk_dev_struct;
+
+/*
+ * I/O调度策略。请求队列仍是以current_request为头的单链表，队列头是驱动程序正在处理的请求项。
+ * add()把新请求项插入到队列头之后的某个位置；队列头完成时end_request()调用next()，由它从队列
+ * 中选出下一个要处理的请求项，放到队列头之后并返回。
+ */
+struct io_scheduler {
+	char * name;
+	void (*add)(struct blk_dev_struct * dev, struct request * req);
+	struct request * (*next)(struct blk_dev_struct * dev);
+};
+
+/*
+ * max_sectors为0表示该设备不合并请求，否则是一个合并请求项的最大扇区数。只有能够按请求项的
+ * 缓冲块链逐块传输的驱动程序才应设置它。
+ */
 struct blk_dev_struct {
 	void (*request_fn)(void);
 	struct request * current_request;
+	unsigned long max_sectors;
+	struct io_scheduler * sched;
+	struct iosched_stat stat;
+	struct request * fifo[2];	/* deadline策略的读、写FIFO，表头等待最久 */
 };
 
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV];
@@ -53,6 +84,9 @@ extern struct task_struct * wait_for_request;
 
 extern int * blk_size[NR_BLK_DEV];
 
+/* 队列头的请求项完成：记录延迟并选出下一个请求项 */
+extern struct request * blk_next_request(struct blk_dev_struct * dev);
+
 #ifdef MAJOR_NR
 
 /*
@@ -81,7 +115,8 @@ extern int * blk_size[NR_BLK_DEV];
 /* harddisk */
 #define DEVICE_NAME "harddisk"
 #define DEVICE_INTR do_hd
-#define DEVICE_TIMEOUT hd_timeout
+#define DEVICE_TIMEOUT hd_timer
+#define DEVICE_TIMEOUT_FN hd_times_out
 #define DEVICE_REQUEST do_hd_request
 #define DEVICE_NR(device) (MINOR(device)/5)
 #define DEVICE_ON(device)
@@ -100,8 +135,9 @@ extern int * blk_size[NR_BLK_DEV];
 void (*DEVICE_INTR)(void) = NULL;
 #endif
 #ifdef DEVICE_TIMEOUT
-int DEVICE_TIMEOUT = 0;
-#define SET_INTR(x) (DEVICE_INTR = (x),DEVICE_TIMEOUT = 200)
+static void (DEVICE_TIMEOUT_FN)(unsigned long);
+struct timer_list DEVICE_TIMEOUT = { NULL, NULL, 0, 0, DEVICE_TIMEOUT_FN };
+#define SET_INTR(x) (DEVICE_INTR = (x),mod_timer(&DEVICE_TIMEOUT, jiffies + 200))
 #else
 #define SET_INTR(x) (DEVICE_INTR = (x))
 #endif
@@ -112,29 +148,45 @@ static void unlock_buffer(struct buffer_head * bh)
 	if (!bh->b_lock)
 		printk(DEVICE_NAME ": free buffer being unlocked\n");
 	bh->b_lock=0;
+	refile_buffer(bh);
 	wake_up(&bh->b_wait);
 }
 
 static void end_request(int uptodate)
 {
-	DEVICE_OFF(CURRENT->dev);
-	if (CURRENT->bh) {
-		CURRENT->bh->b_uptodate = uptodate;
-		unlock_buffer(CURRENT->bh);
+	struct buffer_head * bh;
+
+	if ((bh = CURRENT->bh)) {
+		CURRENT->bh = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		bh->b_uptodate = uptodate;
+		unlock_buffer(bh);
 	}
 	if (!uptodate) {
 		printk(DEVICE_NAME " I/O error\n\r");
-		printk("dev %04x, block %d\n\r",CURRENT->dev,
-			CURRENT->bh->b_blocknr);
+		if (bh)
+			printk("dev %04x, block %d\n\r",CURRENT->dev,
+				bh->b_blocknr);
+	}
+	/* 合并的请求项中还有缓冲块：出错时跳过该块剩下的扇区，然后接着传输下一块 */
+	if (CURRENT->bh) {
+		if (!uptodate) {
+			CURRENT->errors = 0;
+			CURRENT->sector = (CURRENT->sector + 2) & ~1;
+			CURRENT->nr_sectors = (CURRENT->nr_sectors - 1) & ~1;
+		}
+		CURRENT->buffer = CURRENT->bh->b_data;
+		return;
 	}
+	DEVICE_OFF(CURRENT->dev);
 	wake_up(&CURRENT->waiting);
 	wake_up(&wait_for_request);
 	CURRENT->dev = -1;
-	CURRENT = CURRENT->next;
+	CURRENT = blk_next_request(blk_dev + MAJOR_NR);
 }
 
 #ifdef DEVICE_TIMEOUT
-#define CLEAR_DEVICE_TIMEOUT DEVICE_TIMEOUT = 0;
+#define CLEAR_DEVICE_TIMEOUT del_timer(&DEVICE_TIMEOUT);
 #else
 #define CLEAR_DEVICE_TIMEOUT
 #endif
@@ -402,6 +402,25 @@ static void reset_floppy(void)
 	sti();
 }
 
+static struct timer_list fd_timer = { NULL, NULL, 0, 0, NULL };
+
+static void fd_timer_callback(unsigned long fn)
+{
+	((void (*)(void)) fn)();
+}
+
+/* 延时ticks个滴答后调用fn，ticks为0时立即调用 */
+static void fd_delay(long ticks, void (*fn)(void))
+{
+	if (ticks <= 0) {
+		fn();
+		return;
+	}
+	fd_timer.data = (unsigned long) fn;
+	fd_timer.function = fd_timer_callback;
+	mod_timer(&fd_timer, jiffies + ticks);
+}
+
 static void floppy_on_interrupt(void)
 {
 /* We cannot do a floppy-select, as that might sleep. We just force it */
@@ -410,7 +429,7 @@ static void floppy_on_interrupt(void)
 		current_DOR &= 0xFC;
 		current_DOR |= current_drive;
 		outb(current_DOR,FD_DOR);
-		add_timer(2,&transfer);
+		fd_delay(2,&transfer);
 	} else
 		transfer();
 }
@@ -452,7 +471,7 @@ void do_fd_request(void)
 		command = FD_WRITE;
 	else
 		panic("do_fd_request: unknown command");
-	add_timer(ticks_to_floppy_on(current_drive),&floppy_on_interrupt);
+	fd_delay(ticks_to_floppy_on(current_drive),&floppy_on_interrupt);
 }
 
 static int floppy_sizes[] ={
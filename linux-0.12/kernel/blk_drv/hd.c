@@ -34,12 +34,22 @@ inb_p(0x71); \
 #define MAX_ERRORS	7
 #define MAX_HD		2
 
+/* 多扇区模式下每个中断最多传输的扇区数；合并请求项的最大扇区数(一条命令最多256个扇区) */
+#define MAX_MULT	16
+#define MAX_SECTORS	128
+
 static void recal_intr(void);
 static void bad_rw_intr(void);
+static void hd_identify(int drive);
 
 static int recalibrate = 0;
 static int reset = 0;
 
+/* 各驱动器多扇区读写每组的扇区数，0表示不用多扇区模式 */
+static int hd_mult[MAX_HD] = {0, };
+/* 已写出但还未被写中断确认的扇区数 */
+static int hd_wcount = 0;
+
 /*
  *  This struct defines the HD's and their types.
  */
@@ -136,6 +146,8 @@ int sys_setup(void * BIOS)
 		hd[i*5].start_sect = 0;
 		hd[i*5].nr_sects = 0;
 	}
+	for (drive=0 ; drive<NR_HD ; drive++)
+		hd_identify(drive);
 	for (drive=0 ; drive<NR_HD ; drive++) {
 		if (!(bh = bread(0x300 + drive*5,0))) {
 			printk("Unable to read partition table of drive %d\n\r",
@@ -184,6 +196,46 @@ static int win_result(void)
 	return (1);
 }
 
+/*
+ * 查询驱动器是否支持多扇区读写(READ/WRITE MULTIPLE)，支持则设置每组的扇区数并记在hd_mult[]中，
+ * 这样一个中断就能传输一组扇区。只在初始化时调用，用查询方式操作，期间屏蔽控制器中断。
+ */
+static void hd_identify(int drive)
+{
+	unsigned short id[256];
+	int i, mult;
+
+	hd_mult[drive] = 0;
+	outb_p(hd_info[drive].ctl | 2, HD_CMD);		/* 置nIEN位，屏蔽中断 */
+	if (!controller_ready())
+		goto out;
+	outb_p(0xA0 | (drive << 4), HD_CURRENT);
+	outb(WIN_IDENTIFY, HD_COMMAND);
+	for (i = 0; i < 1000; i++) nop();
+	if (!controller_ready() ||
+		(inb_p(HD_STATUS) & (ERR_STAT | DRQ_STAT)) != DRQ_STAT)
+		goto out;
+	port_read(HD_DATA, id, 256);
+	/* 第47字的低字节是每组最多的扇区数，取不超过MAX_MULT的2的幂 */
+	if ((mult = id[47] & 0xff) > MAX_MULT)
+		mult = MAX_MULT;
+	while (mult & (mult - 1))
+		mult &= mult - 1;
+	if (mult < 2)
+		goto out;
+	outb_p(mult, HD_NSECTOR);
+	outb_p(0xA0 | (drive << 4), HD_CURRENT);
+	outb(WIN_SETMULT, HD_COMMAND);
+	for (i = 0; i < 1000; i++) nop();
+	if (controller_ready() && !(inb_p(HD_STATUS) & ERR_STAT))
+		hd_mult[drive] = mult;
+out:
+	inb_p(HD_STATUS);							/* 清除可能挂起的中断 */
+	outb_p(hd_info[drive].ctl, HD_CMD);
+	if (hd_mult[drive])
+		printk("hd%d: %d sectors per interrupt\n\r", drive, hd_mult[drive]);
+}
+
 static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
 		unsigned int head,unsigned int cyl,unsigned int cmd,
 		void (*intr_addr)(void))
@@ -236,20 +288,28 @@ static void reset_controller(void)
 
 static void reset_hd(void)
 {
-	static int i;
+	static int i, setmult;
 
 repeat:
 	if (reset) {
 		reset = 0;
 		i = -1;
+		setmult = 0;
 		reset_controller();
 	} else if (win_result()) {
 		bad_rw_intr();
 		if (reset)
 			goto repeat;
 	}
+	/* 复位会清除驱动器的多扇区模式，设置好参数后要重新设置 */
+	if (setmult) {
+		setmult = 0;
+		hd_out(i,hd_mult[i],0,0,0,WIN_SETMULT,&reset_hd);
+		return;
+	}
 	i++;
 	if (i < NR_HD) {
+		setmult = (hd_mult[i] != 0);
 		hd_out(i,hd_info[i].sect,hd_info[i].sect,hd_info[i].head-1,
 			hd_info[i].cyl,WIN_SPECIFY,&reset_hd);
 	} else
@@ -271,41 +331,90 @@ static void bad_rw_intr(void)
 		reset = 1;
 }
 
+/* 一个中断传输的扇区数：多扇区模式下是一组(最后一组可能不满)，否则是1个 */
+static inline int hd_chunk(void)
+{
+	int mult = hd_mult[CURRENT_DEV];
+
+	if (!mult)
+		return 1;
+	return (CURRENT->nr_sectors < mult) ? CURRENT->nr_sectors : mult;
+}
+
+/*
+ * 当前扇区传输完毕，推进请求项的位置。合并的请求项中每传完一个缓冲块(2个扇区)就结束该块，
+ * end_request()会转到下一块。整个请求项完成时返回1。
+ */
+static int hd_sector_done(void)
+{
+	CURRENT->buffer += 512;
+	CURRENT->sector++;
+	if (!--CURRENT->nr_sectors) {
+		end_request(1);
+		return 1;
+	}
+	if (CURRENT->bh && !(CURRENT->nr_sectors & 1))
+		end_request(1);
+	return 0;
+}
+
+/*
+ * 写出下一组扇区的数据，数据可能跨越请求项缓冲块链中的多个块。写出的扇区数记在hd_wcount中，
+ * 等写中断确认后才推进请求项的位置，出错重试时从未确认的扇区开始重写。
+ */
+static void hd_write_chunk(void)
+{
+	char * buf = CURRENT->buffer;
+	struct buffer_head * bh = CURRENT->bh;
+	unsigned long left = CURRENT->nr_sectors;
+	int i;
+
+	hd_wcount = hd_chunk();
+	for (i = 0; i < hd_wcount; i++) {
+		port_write(HD_DATA,buf,256);
+		buf += 512;
+		if (bh && !(--left & 1) && (bh = bh->b_reqnext))
+			buf = bh->b_data;
+	}
+}
+
 static void read_intr(void)
 {
+	int i;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	port_read(HD_DATA,CURRENT->buffer,256);
 	CURRENT->errors = 0;
-	CURRENT->buffer += 512;
-	CURRENT->sector++;
-	if (--CURRENT->nr_sectors) {
-		SET_INTR(&read_intr);
-		return;
+	for (i = hd_chunk(); i > 0; i--) {
+		port_read(HD_DATA,CURRENT->buffer,256);
+		if (hd_sector_done()) {
+			do_hd_request();
+			return;
+		}
 	}
-	end_request(1);
-	do_hd_request();
+	SET_INTR(&read_intr);
 }
 
 static void write_intr(void)
 {
+	int i;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	if (--CURRENT->nr_sectors) {
-		CURRENT->sector++;
-		CURRENT->buffer += 512;
-		SET_INTR(&write_intr);
-		port_write(HD_DATA,CURRENT->buffer,256);
-		return;
+	for (i = hd_wcount; i > 0; i--) {
+		if (hd_sector_done()) {
+			do_hd_request();
+			return;
+		}
 	}
-	end_request(1);
-	do_hd_request();
+	SET_INTR(&write_intr);
+	hd_write_chunk();
 }
 
 static void recal_intr(void)
@@ -315,7 +424,7 @@ static void recal_intr(void)
 	do_hd_request();
 }
 
-void hd_times_out(void)
+static void hd_times_out(unsigned long unused)
 {
 	if (!CURRENT)
 		return;
@@ -337,7 +446,7 @@ void do_hd_request(void)
 	INIT_REQUEST;
 	dev = MINOR(CURRENT->dev);
 	block = CURRENT->sector;
-	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects) {
+	if (dev >= 5*NR_HD || block+CURRENT->nr_sectors > hd[dev].nr_sects) {
 		end_request(0);
 		goto repeat;
 	}
@@ -361,16 +470,18 @@ void do_hd_request(void)
 		return;
 	}	
 	if (CURRENT->cmd == WRITE) {
-		hd_out(dev,nsect,sec,head,cyl,WIN_WRITE,&write_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			hd_mult[dev] ? WIN_MULTWRITE : WIN_WRITE,&write_intr);
 		for(i=0 ; i<10000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
 			/* nothing */ ;
 		if (!r) {
 			bad_rw_intr();
 			goto repeat;
 		}
-		port_write(HD_DATA,CURRENT->buffer,256);
+		hd_write_chunk();
 	} else if (CURRENT->cmd == READ) {
-		hd_out(dev,nsect,sec,head,cyl,WIN_READ,&read_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			hd_mult[dev] ? WIN_MULTREAD : WIN_READ,&read_intr);
 	} else
 		panic("unknown hd-command");
 }
@@ -378,6 +489,7 @@ void do_hd_request(void)
 void hd_init(void)
 {
 	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;
+	blk_dev[MAJOR_NR].max_sectors = MAX_SECTORS;
 	set_intr_gate(0x2E,&hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb,0x21);
 	outb(inb_p(0xA1)&0xbf,0xA1);
@@ -11,6 +11,7 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/system.h>
+#include <asm/segment.h>
 
 #include "blk.h"
 
@@ -32,25 +33,37 @@ struct request request[NR_REQUEST];
  */
 struct task_struct * wait_for_request = NULL;
 
+static struct io_scheduler elevator_sched, deadline_sched, noop_sched;
+
+/* I/O调度策略表，下标即IOSCHED_xxx */
+static struct io_scheduler * io_schedulers[NR_IOSCHED] = {
+	&elevator_sched, &deadline_sched, &noop_sched
+};
+
 /* blk_dev_struct is:
  *	do_request-address
  *	next-request
+ *	max-sectors
+ *	io-scheduler, latency-stats
  */
 /*
  * blk_dev_struct块设备结构是:(参见文件kernel/blk_drv/blk.h)
  * do_request-address	// 对应主设备号的请求处理程序指针
  * current-request		// 该设备的下一个请求
+ * max-sectors			// 合并请求项的最大扇区数(0 - 不合并)
+ * io-scheduler			// I/O调度策略(启动时的默认值如下，运行时可用iosched()修改)
+ * latency-stats		// 请求项延迟统计
  */
 // 块设备数组。该数组使用主设备号作为索引。实际内容将在各块设备驱动程序初始化时填入。
 // 例如，硬盘驱动程序初始化时(hd.c)，第一条语句即用于设备blk_dev[3]的内容。
 struct blk_dev_struct blk_dev[NR_BLK_DEV] = {
-	{ NULL, NULL },		/* no_dev */		/* 0 - 无设备 */
-	{ NULL, NULL },		/* dev mem */		/* 1 - 内存 */
-	{ NULL, NULL },		/* dev fd */		/* 2 - 软驱设备 */
-	{ NULL, NULL },		/* dev hd */		/* 3 - 硬盘设备 */
-	{ NULL, NULL },		/* dev ttyx */		/* 4 - ttyx设备 */
-	{ NULL, NULL },		/* dev tty */		/* 5 - tty设备 */
-	{ NULL, NULL }		/* dev lp */		/* 6 - lp打印机设备 */
+	{ NULL, NULL, 0, &elevator_sched, { IOSCHED_ELEVATOR } },	/* no_dev */	/* 0 - 无设备 */
+	{ NULL, NULL, 0, &noop_sched, { IOSCHED_NOOP } },			/* dev mem */	/* 1 - 内存 */
+	{ NULL, NULL, 0, &elevator_sched, { IOSCHED_ELEVATOR } },	/* dev fd */	/* 2 - 软驱设备 */
+	{ NULL, NULL, 0, &elevator_sched, { IOSCHED_ELEVATOR } },	/* dev hd */	/* 3 - 硬盘设备 */
+	{ NULL, NULL, 0, &elevator_sched, { IOSCHED_ELEVATOR } },	/* dev ttyx */	/* 4 - ttyx设备 */
+	{ NULL, NULL, 0, &elevator_sched, { IOSCHED_ELEVATOR } },	/* dev tty */	/* 5 - tty设备 */
+	{ NULL, NULL, 0, &elevator_sched, { IOSCHED_ELEVATOR } }	/* dev lp */	/* 6 - lp打印机设备 */
 };
 
 /*
@@ -92,6 +105,7 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	if (!bh->b_lock)				// 如果该缓冲区没有被锁定,则打印出错信息.
 		printk("ll_rw_block.c: buffer not locked\n\r");
 	bh->b_lock = 0;					// 清锁定标志.
+	refile_buffer(bh);				// 空闲缓冲块移回对应的LRU表.
 	wake_up(&bh->b_wait);			// 唤醒等待该缓冲区的任务.
 }
 
@@ -121,7 +135,7 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
 	req->next = NULL;
 	cli();								// 关中断
 	if (req->bh)
-		req->bh->b_dirt = 0;			// 清缓冲区"脏"标志.
+		mark_buffer_clean(req->bh);		// 清缓冲区"脏"标志.
 	// 然后查看指定设备是否有当前请求项,即查看设备是否正忙.如果指定设备dev当前请求项(current_equest)字段为空,则表示目前该设备没有请求项,本次是
 	// 第1个请求项,也是唯一的一个.因此可将块设备当前请求指针直接指向该请求项,并立刻执行相应设备的请求函数.
 	if (!(tmp = dev->current_request)) {
@@ -130,10 +144,20 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
 		(dev->request_fn)();			// 执行请求函数,对于硬盘是do_hd_request().
 		return;
 	}
-	// 如果目前该设备已经有当前请求项在处理,则首先利用电梯算法搜索最佳插入位置,然后将当前请求项插入到请求链表中.在搜索过程中,如果判断出欲插入
-	// 请求项的缓冲块头指针空,即没有缓冲块,那么就需要找一个项,其已经有可用的缓冲块.因此若当前插入位置(tmp之后)处的空闲项缓冲块头指针不空,就选择这个位置
-	// 于是退出循环并把请求项插入此处.最后开中断并退出函数.电梯算法的作用是让磁盘磁头的移动距离最小,从而改善(减少)硬盘访问时间.
-	// 下面for循环中if语句用于把req所指请求项与请求队列(链表)中已有的请求项作比较,找出req插入该队列的正确位置顺序.然后中断循环,并把req插入到该队列正确位置处.
+	// 如果目前该设备已经有当前请求项在处理,则由该设备的I/O调度策略把请求项插入到请求链表中.最后开中断并退出函数.
+	(dev->sched->add)(dev, req);
+	sti();
+}
+
+/*
+ * 按order给出的顺序把req插入head之后的队列中.
+ * 插入时如果判断出欲插入请求项的缓冲块头指针空,即没有缓冲块(交换请求),那么就需要找一个项,其已经有可用的缓冲块.因此若当前插入位置(tmp之后)处
+ * 的空闲项缓冲块头指针不空,就选择这个位置.于是退出循环并把请求项插入此处.电梯算法的作用是让磁盘磁头的移动距离最小,从而改善(减少)硬盘访问时间.
+ * 下面for循环中if语句用于把req所指请求项与请求队列(链表)中已有的请求项作比较,找出req插入该队列的正确位置顺序.然后中断循环,并把req插入到该队列正确位置处.
+ */
+static void sort_add(struct request * tmp, struct request * req,
+	int (*order)(struct request *, struct request *))
+{
 	for ( ; tmp->next ; tmp = tmp->next) {
 		if (!req->bh) {
 			if (tmp->next->bh) {
@@ -142,12 +166,163 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
 				continue;
 			}
 		}
-		if ((IN_ORDER(tmp, req)||!IN_ORDER(tmp, tmp->next)) && IN_ORDER(req, tmp->next))
+		if ((order(tmp, req) || !order(tmp, tmp->next)) && order(req, tmp->next))
 			break;
 	}
 	req->next = tmp->next;
 	tmp->next = req;
+}
+
+/* 电梯算法的顺序:读先于写,然后按设备号、扇区号 */
+static int elevator_order(struct request * s1, struct request * s2)
+{
+	return IN_ORDER(s1, s2);
+}
+
+/* deadline的顺序:只按设备号、扇区号,不区分读写(读写各自的期限防止饿死) */
+static int sector_order(struct request * s1, struct request * s2)
+{
+	return s1->dev < s2->dev || (s1->dev == s2->dev && s1->sector < s2->sector);
+}
+
+static void elevator_add(struct blk_dev_struct * dev, struct request * req)
+{
+	sort_add(dev->current_request, req, elevator_order);
+}
+
+/* 电梯和noop都按队列顺序处理 */
+static struct request * fifo_next(struct blk_dev_struct * dev)
+{
+	return dev->current_request->next;
+}
+
+/*
+ * deadline: 队列按扇区排序,另外每个设备的读、写请求项各按到达顺序挂在一个FIFO上.读请求在队列中
+ * 等待超过READ_EXPIRE、写请求超过WRITE_EXPIRE后就到期.同一方向的期限相同,所以FIFO头就是该方向
+ * 最早到期的请求项.队列头完成时先处理到期的FIFO头(两个都到期时取到期早的),没有到期的才按扇区
+ * 顺序继续.请求项成为队列头(开始传输)时从FIFO中取下.
+ */
+#define READ_EXPIRE		(HZ / 2)
+#define WRITE_EXPIRE	(5 * HZ)
+
+#define EXPIRES(req) ((req)->start_time + ((req)->cmd == READ ? READ_EXPIRE : WRITE_EXPIRE))
+#define EXPIRED(req) ((long) (jiffies - EXPIRES(req)) >= 0)
+
+/* 把请求项从所在方向的FIFO中取下(不在FIFO中则什么也不做) */
+static void fifo_unlink(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request ** p;
+
+	for (p = dev->fifo + (req->cmd == WRITE) ; *p ; p = &(*p)->fifo_next)
+		if (*p == req) {
+			*p = req->fifo_next;
+			break;
+		}
+	req->fifo_next = NULL;
+}
+
+static void deadline_add(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request ** p;
+
+	sort_add(dev->current_request, req, sector_order);
+	req->fifo_next = NULL;
+	for (p = dev->fifo + (req->cmd == WRITE) ; *p ; p = &(*p)->fifo_next)
+		;
+	*p = req;
+}
+
+static struct request * deadline_next(struct blk_dev_struct * dev)
+{
+	struct request * head = dev->current_request, * prev, * best = NULL;
+	struct request * r = dev->fifo[READ], * w = dev->fifo[WRITE];
+
+	if (r && EXPIRED(r))
+		best = r;
+	if (w && EXPIRED(w) && (!best || (long) (EXPIRES(w) - EXPIRES(r)) < 0))
+		best = w;
+	if (best && best != head->next) {
+		for (prev = head ; prev->next != best ; prev = prev->next)
+			;
+		prev->next = best->next;
+		best->next = head->next;
+		head->next = best;
+	}
+	if (head->next)
+		fifo_unlink(dev, head->next);
+	return head->next;
+}
+
+/* noop: 先来先服务,插到队尾 */
+static void noop_add(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp = dev->current_request;
+
+	while (tmp->next)
+		tmp = tmp->next;
+	tmp->next = req;
+}
+
+static struct io_scheduler elevator_sched = { "elevator", elevator_add, fifo_next };
+static struct io_scheduler deadline_sched = { "deadline", deadline_add, deadline_next };
+static struct io_scheduler noop_sched = { "noop", noop_add, fifo_next };
+
+/**
+ * 队列头的请求项已完成(由end_request()调用,此时中断已关闭或不会有其他进程修改该队列)
+ * 记录其延迟统计,然后由调度策略选出下一个请求项.
+ * @param[in]	dev		块设备结构指针
+ * @retval		新的队列头(下一个要处理的请求项),队列空时为NULL
+ */
+struct request * blk_next_request(struct blk_dev_struct * dev)
+{
+	struct request * req = dev->current_request;
+	unsigned long wait = jiffies - req->start_time;
+	int rw = (req->cmd == WRITE);
+
+	dev->stat.nr_done[rw]++;
+	dev->stat.wait_total[rw] += wait;
+	if (wait > dev->stat.wait_max[rw])
+		dev->stat.wait_max[rw] = wait;
+	return (dev->sched->next)(dev);
+}
+
+/*
+ * 尝试把缓冲块bh并入队列中已有的请求项:若某个同设备、同命令的请求项正好结束于bh之前(后部合并)
+ * 或开始于bh之后(前部合并),就把bh挂到该请求项的缓冲块链上,这样驱动程序用一条命令即可传输多个
+ * 块.队列头的请求项可能已经在传输,不能再修改,所以从第2项开始找.
+ * 返回1表示已合并,不必再建立新的请求项.
+ */
+static int attempt_merge(struct blk_dev_struct * dev, int rw, struct buffer_head * bh)
+{
+	struct request * req;
+	unsigned long sector = bh->b_blocknr << 1;
+
+	if (!dev->max_sectors)
+		return 0;
+	cli();
+	if ((req = dev->current_request))
+		req = req->next;
+	for ( ; req ; req = req->next) {
+		if (req->dev != bh->b_dev || req->cmd != rw || !req->bh ||
+			req->nr_sectors + 2 > dev->max_sectors)
+			continue;
+		if (req->sector + req->nr_sectors == sector) {
+			req->bhtail->b_reqnext = bh;
+			req->bhtail = bh;
+		} else if (req->sector == sector + 2) {
+			bh->b_reqnext = req->bh;
+			req->bh = bh;
+			req->buffer = bh->b_data;
+			req->sector = sector;
+		} else
+			continue;
+		req->nr_sectors += 2;
+		mark_buffer_clean(bh);
+		sti();
+		return 1;
+	}
 	sti();
+	return 0;
 }
 
 // 创建请求项并插入请求队列中.
@@ -180,6 +355,8 @@ static void make_request(int major, int rw, struct buffer_head * bh)
 		unlock_buffer(bh);
 		return;
 	}
+	if (attempt_merge(blk_dev + major, rw, bh))
+		return;
 repeat:
 	/* we don't allow the write-requests to fill up the queue completely:
 	 * we want some room for reads: they take precedence. The last third
@@ -223,6 +400,8 @@ repeat:
 	req->buffer = bh->b_data;							// 请求项缓冲区指针指向需读写的数据缓冲区.
 	req->waiting = NULL;								// 任务等待操作执行完成的地方.
 	req->bh = bh;										// 缓冲块头指针.
+	req->bhtail = bh;									// 缓冲块链的最后一块.
+	req->start_time = jiffies;							// 进入队列的时间.
 	req->next = NULL;									// 指向下一请求项.
 	add_request(major + blk_dev, req);					// 将请求项加入队列中(blk_dev[major],reg).
 }
@@ -230,6 +409,12 @@ repeat:
 // 低级页面读写函数(Low Level Read Write Pagk).
 // 以页面(4K)为单位访问设备数据,即每次读/写8个扇区.参见下面ll_rw_blk()函数.
 void ll_rw_page(int rw, int dev, int page, char * buffer)
+{
+	ll_rw_pages(rw, dev, page, 1, buffer);
+}
+
+// 读写从页面page开始的连续count个页面,buffer是连续count页的内存.用一个请求项完成,用于交换设备的成批读写.
+void ll_rw_pages(int rw, int dev, int page, int count, char * buffer)
 {
 	struct request * req;
 	unsigned int major = MAJOR(dev);
@@ -264,10 +449,12 @@ repeat:
 	req->cmd = rw;										// 命令(READ/WRITE)start_code
 	req->errors = 0;									// 读写操作错误计数
 	req->sector = page << 3;							// 起始读写扇区
-	req->nr_sectors = 8;								// 读写扇区数
+	req->nr_sectors = count << 3;						// 读写扇区数
 	req->buffer = buffer;								// 数据缓冲区
 	req->waiting = current;								// 当前进程进入该请求等待队列
 	req->bh = NULL;										// 无缓冲块头指针(不用高速缓冲)
+	req->bhtail = NULL;
+	req->start_time = jiffies;
 	req->next = NULL;									// 下一个请求项指针
 	current->state = TASK_UNINTERRUPTIBLE;				// 置为不可中断状态
 	add_request(major + blk_dev, req);					// 将请求项加入队列中.
@@ -303,3 +490,41 @@ void blk_dev_init(void)
 		request[i].next = NULL;
 	}
 }
+
+/**
+ * 查询/设置主设备的I/O调度策略 系统调用
+ * @param[in]	major	主设备号
+ * @param[in]	policy	新的调度策略(IOSCHED_xxx),小于0则只查询
+ * @param[out]	stat	不为NULL时返回该设备的请求项延迟统计
+ * @retval		成功返回原来的调度策略,失败返回出错码
+ */
+int sys_iosched(int major, int policy, struct iosched_stat * stat)
+{
+	struct blk_dev_struct * dev;
+	int i, old;
+
+	if (major < 0 || major >= NR_BLK_DEV || !blk_dev[major].request_fn)
+		return -ENODEV;
+	if (policy >= NR_IOSCHED)
+		return -EINVAL;
+	if (policy >= 0 && !suser())
+		return -EPERM;
+	dev = blk_dev + major;
+	old = dev->stat.policy;
+	if (stat) {
+		verify_area(stat, sizeof(*stat));
+		for (i = 0 ; i < sizeof(*stat) / sizeof(long) ; i++)
+			put_fs_long(((unsigned long *) &dev->stat)[i], i + (unsigned long *) stat);
+	}
+	if (policy >= 0) {
+		cli();
+		dev->sched = io_schedulers[policy];
+		for (i = 0 ; i < sizeof(dev->stat) / sizeof(long) ; i++)
+			((unsigned long *) &dev->stat)[i] = 0;
+		dev->stat.policy = policy;
+		/* 已在队列中的请求项不再按期限跟踪 */
+		dev->fifo[READ] = dev->fifo[WRITE] = NULL;
+		sti();
+	}
+	return old;
+}
@@ -71,7 +71,7 @@ long rd_init(long mem_start, int length)
 void rd_load(void)
 {
 	struct buffer_head *bh;
-	struct super_block	s;
+	struct d_super_block	s;
 	int		block = 256;	/* Start at block 256 */
 	int		i = 1;
 	int		nblocks;
@@ -88,12 +88,15 @@ void rd_load(void)
 		printk("Disk error while looking for ramdisk!\n");
 		return;
 	}
-	*((struct d_super_block *) &s) = *((struct d_super_block *) bh->b_data);
+	s = *((struct d_super_block *) bh->b_data);
 	brelse(bh);
-	if (s.s_magic != SUPER_MAGIC)
+	if (s.s_magic == SUPER_V2_MAGIC)
+		nblocks = s.s_zones << s.s_log_zone_size;
+	else if (s.s_magic == SUPER_MAGIC)
+		nblocks = s.s_nzones << s.s_log_zone_size;
+	else
 		/* No ram disk image present, assume normal floppy boot */
 		return;
-	nblocks = s.s_nzones << s.s_log_zone_size;
 	if (nblocks > (rd_length >> BLOCK_SIZE_BITS)) {
 		printk("Ram disk image too big!  (%d blocks, %d avail)\n", 
 			nblocks, rd_length >> BLOCK_SIZE_BITS);
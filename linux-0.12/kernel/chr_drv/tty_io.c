@@ -266,12 +266,16 @@ int tty_signal(int sig, struct tty_struct *tty)
 					/* (but restart after we continue) */
 }
 
+/* 终端读写时在内核栈上暂存的字符数，攒够一批再与用户缓冲区成块复制 */
+#define TTY_CHUNK	64
+
 int tty_read(unsigned channel, char * buf, int nr)
 {
 	struct tty_struct * tty;
 	struct tty_struct * other_tty = NULL;
 	char c, * b=buf;
-	int minimum,time;
+	char chunk[TTY_CHUNK];
+	int minimum,time,n=0;
 
 	if (channel > 255)
 		return -EIO;
@@ -286,14 +290,14 @@ int tty_read(unsigned channel, char * buf, int nr)
 	minimum = tty->termios.c_cc[VMIN];
 	if (L_CANON(tty)) {
 		minimum = nr;
-		current->timeout = 0xffffffff;
+		set_timeout(0xffffffff);
 		time = 0;
 	} else if (minimum)
-		current->timeout = 0xffffffff;
+		set_timeout(0xffffffff);
 	else {
 		minimum = nr;
 		if (time)
-			current->timeout = time + jiffies;
+			set_timeout(time + jiffies);
 		time = 0;
 	}
 	if (minimum>nr)
@@ -325,20 +329,30 @@ int tty_read(unsigned channel, char * buf, int nr)
 			     c==EOF_CHAR(tty)) && L_CANON(tty))
 				break;
 			else {
-				put_fs_byte(c,b++);
+				chunk[n++] = c;
+				if (n == TTY_CHUNK) {
+					copy_to_user(b,chunk,n);
+					b += n;
+					n = 0;
+				}
 				if (!--nr)
 					break;
 			}
 			if (c==10 && L_CANON(tty))
 				break;
 		} while (nr>0 && !EMPTY(tty->secondary));
+		if (n) {
+			copy_to_user(b,chunk,n);
+			b += n;
+			n = 0;
+		}
 		wake_up(&tty->read_q->proc_list);
 		if (time)
-			current->timeout = time+jiffies;
+			set_timeout(time+jiffies);
 		if (L_CANON(tty) || b-buf >= minimum)
 			break;
 	}
-	current->timeout = 0;
+	set_timeout(0);
 	if ((current->signal & ~current->blocked) && !(b-buf))
 		return -ERESTARTSYS;
 	return (b-buf);
@@ -349,6 +363,8 @@ int tty_write(unsigned channel, char * buf, int nr)
 	static int cr_flag = 0;
 	struct tty_struct * tty;
 	char c, *b = buf;
+	char chunk[TTY_CHUNK];
+	int i = 0, n = 0;
 
 	if (channel > 255)
 		return -EIO;
@@ -363,7 +379,13 @@ int tty_write(unsigned channel, char * buf, int nr)
 		if (current->signal & ~current->blocked)
 			break;
 		while (nr>0 && !FULL(tty->write_q)) {
-			c=get_fs_byte(b);
+			/* 暂存的字符用完了，从用户缓冲区再取一批 */
+			if (i == n) {
+				n = (nr < TTY_CHUNK) ? nr : TTY_CHUNK;
+				copy_from_user(chunk,b,n);
+				i = 0;
+			}
+			c=chunk[i];
 			if (O_POST(tty)) {
 				if (c=='\r' && O_CRNL(tty))
 					c='\n';
@@ -377,7 +399,7 @@ int tty_write(unsigned channel, char * buf, int nr)
 				if (O_LCUC(tty))
 					c=toupper(c);
 			}
-			b++; nr--;
+			b++; nr--; i++;
 			cr_flag = 0;
 			PUTCH(c,tty->write_q);
 		}
@@ -47,6 +47,7 @@ int sys_close(int fd);
 				p->p_ysptr->p_osptr = p->p_osptr;
 			else
 				p->p_pptr->p_cptr = p->p_osptr;
+			free_page(p->tss.cr3);		/* 页目录(页表已在do_exit()中释放)，pg_dir不会被释放 */
 			free_page((long)p);
 			schedule();
 			return;
@@ -157,7 +158,7 @@ static inline int send_sig(long sig,struct task_struct * p,int priv)
 		return -EPERM;
 	if ((sig == SIGKILL) || (sig == SIGCONT)) {
 		if (p->state == TASK_STOPPED)
-			p->state = TASK_RUNNING;
+			wake_up_process(p);
 		p->exit_code = 0;
 		p->signal &= ~( (1<<(SIGSTOP-1)) | (1<<(SIGTSTP-1)) |
 				(1<<(SIGTTIN-1)) | (1<<(SIGTTOU-1)) );
@@ -170,6 +171,7 @@ static inline int send_sig(long sig,struct task_struct * p,int priv)
 		p->signal &= ~(1<<(SIGCONT-1));
 	/* Actually deliver the signal */
 	p->signal |= (1<<(sig-1));
+	signal_wake_up(p);
 	return 0;
 }
 
@@ -279,8 +281,16 @@ volatile void do_exit(long code)
 	struct task_struct *p;
 	int i;
 
-	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	exit_mmap();
+	/* vfork()的子进程用的是父进程的页表，不能释放，改用任务0的页目录(其中没有进程空间) */
+	if (current->flags & PF_VFORK) {
+		current->tss.cr3 = (long) pg_dir;
+		load_cr3(pg_dir);
+		mm_release();
+	} else {
+		free_page_tables(task_pg_dir(current),get_base(current->ldt[1]),get_limit(0x0f));
+		free_page_tables(task_pg_dir(current),get_base(current->ldt[2]),get_limit(0x17));
+	}
 	for (i=0 ; i<NR_OPEN ; i++)
 		if (current->filp[i])
 			sys_close(i);
@@ -292,6 +302,8 @@ volatile void do_exit(long code)
 	current->executable = NULL;
 	iput(current->library);
 	current->library = NULL;
+	del_timer(&current->timeout_timer);
+	del_timer(&current->alarm_timer);
 	current->state = TASK_ZOMBIE;
 	current->exit_code = code;
 	/* 
@@ -312,6 +324,7 @@ volatile void do_exit(long code)
 	}
 	/* Let father know we died */
 	current->p_pptr->signal |= (1<<(SIGCHLD-1));
+	signal_wake_up(current->p_pptr);
 	
 	/*
 	 * This loop does two things:
@@ -324,8 +337,10 @@ volatile void do_exit(long code)
 	if ((p = current->p_cptr)) {
 		while (1) {
 			p->p_pptr = task[1];
-			if (p->state == TASK_ZOMBIE)
+			if (p->state == TASK_ZOMBIE) {
 				task[1]->signal |= (1<<(SIGCHLD-1));
+				signal_wake_up(task[1]);
+			}
 			/*
 			 * process group orphan check
 			 * Case ii: Our child is in a different pgrp 
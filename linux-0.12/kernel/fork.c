@@ -15,6 +15,8 @@
  * fork，就会发现它非常简单的，但内存管理却有些难度。
  */
 
+#define __LIBRARY__
+#include <unistd.h>
 #include <errno.h>
 
 #include <linux/sched.h>
@@ -26,9 +28,12 @@
 extern void write_verify(unsigned long address);
 
 /* 最新进程号，其值会由get_empty_process()生成，会不断增加，无上限；系统同时容纳的最多任务
- 数有上限（NR_TASKS = 64） */
+ 数有上限（NR_TASKS = 256） */
 static long last_pid = 0;	
 
+/* vfork()的父进程在这里等待子进程执行execve()或退出 */
+static struct task_struct * vfork_wait = NULL;
+
 /**
  * 进程空间区域的写前验证
  * 对于80386 CPU，在执行内核代码时用户空间中的R/W标志起不了作用，写时复制机制失效了。所以
@@ -56,7 +61,7 @@ void verify_area(void * addr, int size)
  * 复制内存页表
  * 该函数为新任务在线性地址空间中设置代码段和数据段基址，限长，并复制页表。由于Linux系统采用写时复制
  * (copy on write)技术，因此这里仅为新进程设置自己的页目录表项和页表项，而没有实际为新进程分配物理内
- * 存页面。此时新进程与其父进程共享所有内存页面。
+ * 存页面。此时新进程与其父进程共享所有内存页面。vfork()的子进程则直接使用父进程的页目录。
  * @param[in]		nr		新任务号
  * @param[in]		p		新任务的数据结构指针
  * @retval			成功返回0，失败返回出错号
@@ -76,12 +81,22 @@ static int copy_mem(int nr, struct task_struct * p)
     if (data_limit < code_limit) {
         panic("Bad data_limit");
     }
-    new_data_base = new_code_base = nr * TASK_SIZE;
+    /* 所有进程都位于各自页目录中的USER_BASE处 */
+    new_data_base = new_code_base = USER_BASE;
     p->start_code = new_code_base;
     set_base(p->ldt[1], new_code_base);
     set_base(p->ldt[2], new_data_base);
-    if (copy_page_tables(old_data_base, new_data_base, data_limit)) {
-        free_page_tables(new_data_base, data_limit);
+    if (p->flags & PF_VFORK) {
+        p->tss.cr3 = current->tss.cr3;
+        return 0;
+    }
+    if (!(p->tss.cr3 = (long) new_page_dir())) {
+        return -ENOMEM;
+    }
+    if (copy_page_tables(task_pg_dir(p), old_data_base, new_data_base, data_limit) ||
+        copy_mmap(p)) {
+        free_page_tables(task_pg_dir(p), new_data_base, data_limit);
+        free_page(p->tss.cr3);
         return -ENOMEM;
     }
     return 0;
@@ -97,9 +112,25 @@ static int copy_mem(int nr, struct task_struct * p)
  * 代码段)。
  */
 
+/**
+ * 结束对父进程内存空间的借用
+ * vfork()的子进程执行execve()换上自己的页目录后，或者退出时调用，让等待的父进程继续运行。
+ * @retval      void
+ */
+void mm_release(void)
+{
+    if (current->flags & PF_VFORK) {
+        current->flags &= ~PF_VFORK;
+        wake_up(&vfork_wait);
+    }
+}
+
 /**
  * 复制进程
  * sys_call.s中sys_fork会首先调用find_empty_process会更新last_pid，然后压入一些参数，再调用copy_process。
+ * vfork()也使用这里：子进程不复制页表而是借用父进程的内存空间，父进程睡眠到子进程执行execve()或退出
+ * 为止。用户程序的vfork()不能在子进程返回后还使用自己的栈帧(例如把返回地址留在栈上)，因为父进程
+ * 随后要用同一个栈返回。
  * @param[in]	nr,ebp,edi,esi,gs               find_empty_process分配的任务数组项号nr，调用copy_process之前
  *                                              入栈的gs，esi，edi，ebp
  * @param[in]   none                            sys_fork函数入栈的返回地址
@@ -125,10 +156,19 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
 
     /* 对复制来的进程结构内容进行一些修改。先将新进程的状态置为不可中断等待状态，以防止内核调度其执行 */
     p->state = TASK_UNINTERRUPTIBLE;
+    p->flags &= ~PF_VFORK;
+    if (orig_eax == __NR_vfork) {
+        p->flags |= PF_VFORK;
+    }
     p->pid = last_pid;
     p->counter = p->priority;
+    p->run_next = p->run_prev = NULL;   /* 不在就绪队列中，最后由wake_up_process()放入 */
+    p->array = NULL;
     p->signal = 0;
     p->alarm = 0;
+    p->timeout = 0;
+    init_timer(&p->timeout_timer);
+    init_timer(&p->alarm_timer);
     p->leader = 0;		/* process leadership doesn't inherit */
     p->utime = p->stime = 0;
     p->cutime = p->cstime = 0;
@@ -199,9 +239,13 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
     }
     current->p_cptr = p;
 
-    p->state = TASK_RUNNING;	/* do this last, just in case */
+    wake_up_process(p);	/* do this last, just in case */
 
-    return last_pid;
+    /* vfork()：子进程用的是我们的内存空间，等它执行execve()或退出 */
+    while (p->flags & PF_VFORK) {
+        sleep_on(&vfork_wait);
+    }
+    return p->pid;
 }
 
 /**
@@ -114,6 +114,120 @@ struct {
 	short b;
 	} stack_start = { & user_stack [PAGE_SIZE>>2] , 0x10 };
 
+/*
+ * 就绪队列。每个优先级(task->priority)一条双向循环链表，位图bitmap中第n位置位表示第n级队列非空，
+ * 因此选择下一个任务、入队和出队都是常数时间。时间片用完的任务放入expired数组，active数组为空时
+ * 两者交换，交换次数记在rq_epoch中。原来在所有时间片用完时对每个任务做的 counter = counter/2 +
+ * priority，改为在任务被选中或被唤醒时按它错过的纪元数补做(见refresh_counter())。
+ *
+ * 任务0不进入就绪队列，没有其他可运行任务时才切换到它。
+ */
+struct prio_array {
+	unsigned long bitmap;					/* 非空队列位图 */
+	struct task_struct * queue[NR_PRIO];	/* 各优先级队列的队首任务 */
+};
+
+static struct prio_array prio_arrays[2];
+static struct prio_array * active = &prio_arrays[0];	/* 还有时间片的就绪任务 */
+static struct prio_array * expired = &prio_arrays[1];	/* 时间片已用完的就绪任务 */
+static unsigned long rq_epoch = 0;						/* active/expired交换次数 */
+
+/* 由任务的LDT选择符求出其任务号 */
+#define TASK_NR(p) (((p)->tss.ldt - (FIRST_LDT_ENTRY<<3)) >> 4)
+
+/* 位图中最高置位位的位号，即最高的非空优先级 */
+static inline int highest_prio(unsigned long bitmap)
+{
+	int nr;
+
+	__asm__("bsrl %1,%0":"=r" (nr):"rm" (bitmap));
+	return nr;
+}
+
+/* 把任务p加到数组array中其优先级队列的队尾。调用时须关中断 */
+static inline void enqueue_task(struct task_struct * p, struct prio_array * array)
+{
+	struct task_struct ** head = array->queue + p->priority;
+
+	if (*head) {
+		p->run_next = *head;
+		p->run_prev = (*head)->run_prev;
+		(*head)->run_prev->run_next = p;
+		(*head)->run_prev = p;
+	} else {
+		*head = p->run_next = p->run_prev = p;
+		array->bitmap |= 1 << p->priority;
+	}
+	p->array = array;
+}
+
+/* 把任务p从其所在的队列中取下。调用时须关中断 */
+static inline void dequeue_task(struct task_struct * p)
+{
+	struct prio_array * array = p->array;
+	struct task_struct ** head = array->queue + p->priority;
+
+	if (p->run_next == p) {
+		*head = NULL;
+		array->bitmap &= ~(1 << p->priority);
+	} else {
+		p->run_next->run_prev = p->run_prev;
+		p->run_prev->run_next = p->run_next;
+		if (*head == p) {
+			*head = p->run_next;
+		}
+	}
+	p->run_next = p->run_prev = NULL;
+	p->array = NULL;
+}
+
+/* 补做任务错过的时间片重算。counter最多8次后就已收敛到2*priority，不必再算 */
+static inline void refresh_counter(struct task_struct * p)
+{
+	unsigned long n = rq_epoch - p->epoch;
+
+	if (n > 8) {
+		n = 8;
+	}
+	while (n--) {
+		p->counter = (p->counter >> 1) + p->priority;
+	}
+	p->epoch = rq_epoch;
+}
+
+/**
+ * 把任务p置为就绪状态并放入就绪队列
+ * 还有时间片的任务进入active数组，否则进入expired数组。可以在中断中调用。
+ * @param[in]	p		任务结构指针
+ * @return		void
+ */
+void wake_up_process(struct task_struct * p)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	p->state = TASK_RUNNING;
+	if (!p->array && p != &(init_task.task)) {
+		refresh_counter(p);
+		enqueue_task(p, p->counter ? active : expired);
+	}
+	restore_flags(flags);
+}
+
+/**
+ * 向任务p发送信号后调用：若p处于可中断睡眠状态并且有未被屏蔽的信号，则唤醒它
+ * @param[in]	p		任务结构指针
+ * @return		void
+ */
+void signal_wake_up(struct task_struct * p)
+{
+	if (p->state == TASK_INTERRUPTIBLE &&
+	    (p->signal & ~(_BLOCKABLE & p->blocked))) {
+		wake_up_process(p);
+	}
+}
+
 /*
  *  'math_state_restore()' saves the current math information in the
  * old math state array, and gets the new ones from the current task
@@ -156,70 +270,54 @@ void math_state_restore()
  * 
  *  注意!! 任务0是个闲置('idle')任务，只有当没有其他任务可以运行时才调用它。它不能被杀死，也不睡眠。
  * 任务0中的状态信息'state'是从来不用的。
+ *
+ *  现在下一个任务直接取自就绪队列(见上面的struct prio_array)，不再扫描整个task[]数组。
  * 
  */
 void schedule(void)
 {
-	int i, next, c;
-	struct task_struct ** p;
-
-/* check alarm, wake up any interruptible tasks that have got a signal */
-/* 检测alarm（进程的报警定时值），唤醒任何已得到信号的可中断任务 */
-
-	for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-		if (*p) {
-			/* 如果设置过任务超时定时值timeout，并且已经超时，则复位超时定时值，并且如果任
-			 务处于可中断睡眠状态TASK_INTERRUPTIBLE下，将其置为就绪状态（TASK_RUNNING） */
-			if ((*p)->timeout && (*p)->timeout < jiffies) {
-				(*p)->timeout = 0;
-				if ((*p)->state == TASK_INTERRUPTIBLE) {
-					(*p)->state = TASK_RUNNING;
-				}
-			}
-			/* 如果设置过任务的SIGALRM信号超时定时器值alarm，并且已经过期(alarm<jiffies)，
-			 则在信号位图中置SIGALRM信号，即向任务发送SIGALRM信号。然后清alarm。该信号的默
-			 认操作是终止进程 */
-			if ((*p)->alarm && (*p)->alarm < jiffies) {
-				(*p)->signal |= (1 << (SIGALRM - 1));
-				(*p)->alarm = 0;
-			}
-			/* '~(_BLOCKABLE & (*p)->blocked)'用于忽略被阻塞的信号，除被阻塞的信号外还有其
-			 他信号，并且任务处于可中断状态，则置任务为就绪状态 */
-			if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked)) &&
-			(*p)->state == TASK_INTERRUPTIBLE) {
-				(*p)->state = TASK_RUNNING;
-			}
-		}
+	struct task_struct * next;
+	unsigned long flags;
+
+/* 任务的timeout和alarm由时间轮上的定时器处理，收到信号的可中断任务在发送信号时由signal_wake_up()
+ 唤醒，这里不再扫描所有任务 */
 
 /* this is the scheduler proper: */
 /* 这里是调度程序的主要部分 */
 
-	while (1) {
-		c = -1;
-		next = 0;
-		i = NR_TASKS;
-		p = &task[NR_TASKS];
-		/* 找到就绪状态下时间片最大的任务，用next指向该任务 */
-		while (--i) {
-			if (!*--p) {
-				continue;
-			}
-			if ((*p)->state == TASK_RUNNING && (*p)->counter > c) {
-				c = (*p)->counter, next = i;
-			}
-		}
-		/* c = -1，没有可以运行的任务（此时next=0，会切去任务0）；c > 0，找到了可以切换的任务 */
-		if (c) {
-			break;
+	save_flags(flags);
+	cli();
+	/* 当前任务仍在就绪队列中：若它已不再就绪则出队（在可中断睡眠前已有未屏蔽的信号则不睡）；
+	 若时间片已用完（do_timer()中减到0，或主动置0让出CPU），则移到expired数组 */
+	if (current->array) {
+		if (current->state == TASK_INTERRUPTIBLE &&
+		    (current->signal & ~(_BLOCKABLE & current->blocked))) {
+			current->state = TASK_RUNNING;
 		}
-		/* 除任务0以外，存在处于就绪状态但时间片都为0的任务，则更新counter值，然后重新寻找 */
-		for(p = &LAST_TASK ; p > &FIRST_TASK ; --p) {
-			if (*p) {
-				(*p)->counter = ((*p)->counter >> 1) + (*p)->priority;
-			}
+		if (current->state != TASK_RUNNING) {
+			dequeue_task(current);
+		} else if (!current->counter) {
+			dequeue_task(current);
+			enqueue_task(current, expired);
 		}
 	}
-	switch_to(next);
+	/* active数组中的任务时间片都已用完，交换两个数组，相当于原来对所有任务重算counter */
+	if (!active->bitmap) {
+		struct prio_array * tmp = active;
+
+		active = expired;
+		expired = tmp;
+		rq_epoch++;
+	}
+	/* 取最高非空优先级队列的队首任务。没有可运行的任务时切换到任务0 */
+	if (active->bitmap) {
+		next = active->queue[highest_prio(active->bitmap)];
+		refresh_counter(next);
+	} else {
+		next = task[0];
+	}
+	restore_flags(flags);
+	switch_to(TASK_NR(next));
 }
 
 /**
@@ -230,6 +328,10 @@ void schedule(void)
  */
 int sys_pause(void)
 {
+	/* 任务0只在没有其他任务可运行时执行到这里，顺便清零一个空闲页面补充预清零页面池 */
+	if (current == task[0]) {
+		zero_idle_page();
+	}
 	current->state = TASK_INTERRUPTIBLE;
 	schedule();
 	return 0;
@@ -257,7 +359,7 @@ static inline void __sleep_on(struct task_struct **p, int state)
 	current->state = state;
 repeat:	schedule();
 	if (*p && *p != current) {
-		(**p).state = TASK_RUNNING;
+		wake_up_process(*p);
 		current->state = TASK_UNINTERRUPTIBLE;
 		goto repeat;
 	}
@@ -265,7 +367,7 @@ repeat:	schedule();
 		printk("Warning: *P = NULL\n\r");
 	}
 	if ((*p = tmp)) {
-		tmp->state = 0;
+		wake_up_process(tmp);
 	}
 }
 
@@ -293,29 +395,255 @@ void wake_up(struct task_struct **p)
 		if ((**p).state == TASK_ZOMBIE) {
 			printk("wake_up: TASK_ZOMBIE");
 		}
-		(**p).state = TASK_RUNNING;
+		wake_up_process(*p);
 	}
 }
 
+/*
+ * 内核定时器的分级时间轮。第一级tv1有256个槽，每个槽对应一个滴答；后面四级各64个槽，每个槽分别
+ * 对应2^8、2^14、2^20、2^26个滴答。定时器按到期时刻距timer_jiffies的远近挂到相应级的槽上，每个
+ * 槽是一条单向链表(每项用pprev指回前一项的next域)，所以添加和删除都是常数时间。时钟中断中每个滴答
+ * 只处理tv1的一个槽，tv1转完一圈时把下一级对应槽中的定时器重新分配到较低的级上。
+ */
+#define TVN_BITS	6
+#define TVR_BITS	8
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define NR_TVN		4
+
+static struct timer_list * tv1[TVR_SIZE];
+static struct timer_list * tvn[NR_TVN][TVN_SIZE];
+static unsigned long timer_jiffies = 0;		/* 下一个要处理的滴答 */
+
+/* 第i级(i>=1)时间轮槽号的起始位 */
+#define TVN_SHIFT(i)	(TVR_BITS + (i) * TVN_BITS)
+
+/* 按到期时刻把定时器挂到时间轮上。调用时须关中断 */
+static void internal_add_timer(struct timer_list * timer)
+{
+	unsigned long expires = timer->expires;
+	unsigned long idx = expires - timer_jiffies;
+	struct timer_list ** vec;
+	int i;
+
+	if ((long) idx < 0) {
+		/* 已经过期的定时器在下一个滴答处理 */
+		vec = tv1 + (timer_jiffies & TVR_MASK);
+	} else if (idx < TVR_SIZE) {
+		vec = tv1 + (expires & TVR_MASK);
+	} else {
+		for (i = 0 ; i < NR_TVN - 1 && idx >= (1UL << TVN_SHIFT(i + 1)) ; i++)
+			/* nothing */ ;
+		vec = tvn[i] + ((expires >> TVN_SHIFT(i)) & TVN_MASK);
+	}
+	if ((timer->next = *vec)) {
+		timer->next->pprev = &timer->next;
+	}
+	*vec = timer;
+	timer->pprev = vec;
+}
+
+/* 把定时器从所在链表中取下。调用时须关中断 */
+static inline void detach_timer(struct timer_list * timer)
+{
+	if (timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	*timer->pprev = timer->next;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/**
+ * 添加定时器
+ * 调用前须设置好timer的expires、function和data，并且它没有挂在时间轮上。
+ * @param[in]	timer	定时器
+ * @return		void
+ */
+void add_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+
+	if (!timer->function) {
+		return;
+	}
+	save_flags(flags);
+	cli();
+	if (timer->pprev) {
+		printk("add_timer: timer already pending\n\r");
+	} else {
+		internal_add_timer(timer);
+	}
+	restore_flags(flags);
+}
+
+/**
+ * 删除定时器
+ * @param[in]	timer	定时器
+ * @retval		定时器原来在等待到期返回1，否则返回0
+ */
+int del_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	save_flags(flags);
+	cli();
+	if (timer->pprev) {
+		detach_timer(timer);
+		ret = 1;
+	}
+	restore_flags(flags);
+	return ret;
+}
+
+/**
+ * 修改定时器的到期时刻，定时器不在时间轮上时则添加它
+ * @param[in]	timer	定时器
+ * @param[in]	expires	新的到期时刻
+ * @return		void
+ */
+void mod_timer(struct timer_list * timer, unsigned long expires)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if (timer->pprev) {
+		detach_timer(timer);
+	}
+	timer->expires = expires;
+	internal_add_timer(timer);
+	restore_flags(flags);
+}
+
+/* 把时间轮槽*vec上的定时器按当前的timer_jiffies重新挂到较低的级上 */
+static void cascade_timers(struct timer_list ** vec)
+{
+	struct timer_list * head, * timer;
+
+	if (!(head = *vec)) {
+		return;
+	}
+	*vec = NULL;
+	head->pprev = &head;
+	while ((timer = head)) {
+		detach_timer(timer);
+		internal_add_timer(timer);
+	}
+}
+
+/* 处理到jiffies为止所有到期的定时器，在时钟中断(关中断)中调用 */
+static void run_timer_list(void)
+{
+	struct timer_list * head, * timer;
+	int index, i;
+
+	while ((long) (jiffies - timer_jiffies) >= 0) {
+		index = timer_jiffies & TVR_MASK;
+		/* tv1转完一圈，从需要进位的最高一级开始依次把槽中的定时器分配下来 */
+		if (!index) {
+			for (i = 0 ; i < NR_TVN - 1 &&
+			     !((timer_jiffies >> TVN_SHIFT(i)) & TVN_MASK) ; i++)
+				/* nothing */ ;
+			for ( ; i >= 0 ; i--) {
+				cascade_timers(tvn[i] + ((timer_jiffies >> TVN_SHIFT(i)) & TVN_MASK));
+			}
+		}
+		/* 先把整个槽取到局部链表头上并推进timer_jiffies，这样处理函数重新添加的定时器不会
+		 落回正在处理的槽中，处理函数删除链表中的其他定时器也是安全的 */
+		head = tv1[index];
+		tv1[index] = NULL;
+		if (head) {
+			head->pprev = &head;
+		}
+		timer_jiffies++;
+		while ((timer = head)) {
+			detach_timer(timer);
+			(timer->function)(timer->data);
+		}
+	}
+}
+
+/* 任务的timeout到期：清timeout，任务在可中断睡眠则唤醒它 */
+static void process_timeout(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->timeout = 0;
+	if (p->state == TASK_INTERRUPTIBLE) {
+		wake_up_process(p);
+	}
+}
+
+/**
+ * 设置当前任务的内核超时时刻timeout
+ * 0表示没有超时，0xffffffff表示永远不超时，两者都不需要定时器。
+ * @param[in]	timeout		超时时刻(jiffies)
+ * @return		void
+ */
+void set_timeout(unsigned long timeout)
+{
+	current->timeout = timeout;
+	if (!timeout || timeout == 0xffffffff) {
+		del_timer(&current->timeout_timer);
+		return;
+	}
+	current->timeout_timer.data = (unsigned long) current;
+	current->timeout_timer.function = process_timeout;
+	mod_timer(&current->timeout_timer, timeout);
+}
+
+/* 任务的alarm到期：向任务发送SIGALRM信号 */
+static void alarm_timeout(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->signal |= (1 << (SIGALRM - 1));
+	p->alarm = 0;
+	signal_wake_up(p);
+}
+
 /*
  * OK, here are some floppy things that shouldn't be in the kernel
  * proper. They are here because the floppy needs a timer, and this
  * was the easiest way of doing it.
  */
 static struct task_struct * wait_motor[4] = {NULL, NULL, NULL, NULL};
-static int  mon_timer[4] = {0, 0, 0, 0};
-static int moff_timer[4] = {0, 0, 0, 0};
+static struct timer_list motor_on_timer[4];		/* 马达启动到转速稳定 */
+static struct timer_list motor_off_timer[4];	/* 延时关闭马达 */
 unsigned char current_DOR = 0x0C;
 
+/* 马达已达到正常转速，唤醒等待的进程 */
+static void motor_on_callback(unsigned long nr)
+{
+	wake_up(nr + wait_motor);
+}
+
+/* 关闭软驱马达 */
+static void motor_off_callback(unsigned long nr)
+{
+	current_DOR &= ~(0x10 << nr);
+	outb(current_DOR, FD_DOR);
+}
+
 int ticks_to_floppy_on(unsigned int nr)
 {
 	extern unsigned char selected;
 	unsigned char mask = 0x10 << nr;
+	struct timer_list * on = motor_on_timer + nr;
+	int ticks;
 
 	if (nr>3) {
 		panic("floppy_on: nr>3");
 	}
-	moff_timer[nr] = 10000;		/* 100 s = very big :-) */
+	motor_off_timer[nr].data = nr;
+	motor_off_timer[nr].function = motor_off_callback;
+	mod_timer(motor_off_timer + nr, jiffies + 10000);	/* 100 s = very big :-) */
+	on->data = nr;
+	on->function = motor_on_callback;
 	cli();				/* use floppy_off to turn it off */
 	mask |= current_DOR;
 	if (!selected) {
@@ -325,14 +653,15 @@ int ticks_to_floppy_on(unsigned int nr)
 	if (mask != current_DOR) {
 		outb(mask, FD_DOR);
 		if ((mask ^ current_DOR) & 0xf0) {
-			mon_timer[nr] = HZ / 2;
-		} else if (mon_timer[nr] < 2) {
-			mon_timer[nr] = 2;
+			mod_timer(on, jiffies + HZ / 2);
+		} else if (!timer_pending(on) || (long) (on->expires - jiffies) < 2) {
+			mod_timer(on, jiffies + 2);
 		}
 		current_DOR = mask;
 	}
+	ticks = timer_pending(on) ? (long) (on->expires - jiffies) : 0;
 	sti();
-	return mon_timer[nr];
+	return ticks > 0 ? ticks : 0;
 }
 
 void floppy_on(unsigned int nr)
@@ -346,73 +675,7 @@ void floppy_on(unsigned int nr)
 
 void floppy_off(unsigned int nr)
 {
-	moff_timer[nr] = 3 * HZ;
-}
-
-void do_floppy_timer(void)
-{
-	int i;
-	unsigned char mask = 0x10;
-
-	for (i=0 ; i<4 ; i++,mask <<= 1) {
-		if (!(mask & current_DOR))
-			continue;
-		if (mon_timer[i]) {
-			if (!--mon_timer[i]) {
-				wake_up(i+wait_motor);
-			}
-		} else if (!moff_timer[i]) {
-			current_DOR &= ~mask;
-			outb(current_DOR, FD_DOR);
-		} else {
-			moff_timer[i] --;
-		}
-	}
-}
-
-#define TIME_REQUESTS 64
-
-static struct timer_list {
-	long jiffies;
-	void (*fn)();
-	struct timer_list * next;
-} timer_list[TIME_REQUESTS], * next_timer = NULL;
-
-void add_timer(long jiffies, void (*fn)(void))
-{
-	struct timer_list * p;
-
-	if (!fn) {
-		return;
-	}
-	cli();
-	if (jiffies <= 0) {
-		(fn)();
-	} else {
-		for (p = timer_list ; p < timer_list + TIME_REQUESTS ; p++) {
-			if (!p->fn) {
-				break;
-			}
-		}
-		if (p >= timer_list + TIME_REQUESTS) {
-			panic("No more time requests free");
-		}
-		p->fn = fn;
-		p->jiffies = jiffies;
-		p->next = next_timer;
-		next_timer = p;
-		while (p->next && p->next->jiffies < p->jiffies) {
-			p->jiffies -= p->next->jiffies;
-			fn = p->fn;
-			p->fn = p->next->fn;
-			p->next->fn = fn;
-			jiffies = p->jiffies;
-			p->jiffies = p->next->jiffies;
-			p->next->jiffies = jiffies;
-			p = p->next;
-		}
-	}
-	sti();
+	mod_timer(motor_off_timer + nr, jiffies + 3 * HZ);
 }
 
 /**
@@ -438,35 +701,14 @@ void do_timer(long cpl)
 		blank_screen();
 		blanked = 1;
 	}
-	if (hd_timeout) {
-		if (!--hd_timeout) {
-			hd_times_out();
-		}
-	}
-	if (beepcount) {
-		if (!--beepcount) {
-			sysbeepstop();
-		}
-	}
 	if (cpl) {
 		current->utime++;
 	} else {
 		current->stime++;
 	}
-	if (next_timer) {
-		next_timer->jiffies--;
-		while (next_timer && next_timer->jiffies <= 0) {
-			void (*fn)(void);
-			
-			fn = next_timer->fn;
-			next_timer->fn = NULL;
-			next_timer = next_timer->next;
-			(fn)();
-		}
-	}
-	if (current_DOR & 0xf0) {
-		do_floppy_timer();
-	}
+	/* 软驱马达、硬盘超时、蜂鸣以及任务的timeout和alarm都在时间轮上 */
+	run_timer_list();
+	/* 时间片用完后由schedule()把当前任务移到expired数组 */
 	if ((--current->counter)>0) {
 		return;
 	}
@@ -492,6 +734,13 @@ int sys_alarm(long seconds)
 		old = (old - jiffies) / HZ;
 	}
 	current->alarm = (seconds > 0) ? (jiffies + HZ * seconds) : 0;
+	if (current->alarm) {
+		current->alarm_timer.data = (unsigned long) current;
+		current->alarm_timer.function = alarm_timeout;
+		mod_timer(&current->alarm_timer, current->alarm);
+	} else {
+		del_timer(&current->alarm_timer);
+	}
 	return (old);
 }
 
@@ -538,9 +787,28 @@ int sys_getegid(void)
  */
 int sys_nice(long increment)
 {
-	if (current->priority-increment > 0) {
-		current->priority -= increment;
+	long priority = current->priority - increment;
+	unsigned long flags;
+
+	if (priority <= 0) {
+		return 0;
+	}
+	if (priority > MAX_PRIO) {
+		priority = MAX_PRIO;
+	}
+	/* 优先级即就绪队列的级别，在队列中的任务需要换到新级别的队列中 */
+	save_flags(flags);
+	cli();
+	if (current->array) {
+		struct prio_array * array = current->array;
+
+		dequeue_task(current);
+		current->priority = priority;
+		enqueue_task(current, array);
+	} else {
+		current->priority = priority;
 	}
+	restore_flags(flags);
 	return 0;
 }
 
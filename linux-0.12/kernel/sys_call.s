@@ -93,7 +93,7 @@ ENOSYS = 38
  * Ok, I get parallel printer interrupts while using the floppy for some
  * strange reason. Urgel. Now I just ignore them.
  */
-.globl system_call, sys_fork, timer_interrupt, sys_execve
+.globl system_call, sys_fork, sys_vfork, timer_interrupt, sys_execve
 .globl hd_interrupt, floppy_interrupt, parallel_interrupt
 .globl device_not_available, coprocessor_error
 
@@ -243,7 +243,9 @@ sys_execve:
 	addl $4,%esp
 	ret
 
+# vfork与fork的入口相同，copy_process()根据orig_eax中的调用号区分
 .align 4
+sys_vfork:
 sys_fork:
 	call find_empty_process
 	testl %eax,%eax
@@ -269,12 +271,14 @@ hd_interrupt:
 	mov %ax,%es
 	movl $0x17,%eax
 	mov %ax,%fs
+	pushl $hd_timer		# the interrupt came in time, cancel the timeout
+	call del_timer
+	addl $4,%esp
 	movb $0x20,%al
 	outb %al,$0xA0		# EOI to interrupt controller #1
 	jmp 1f			# give port chance to breathe
 1:	jmp 1f
 1:	xorl %edx,%edx
-	movl %edx,hd_timeout
 	xchgl do_hd,%edx
 	testl %edx,%edx
 	jne 1f
@@ -0,0 +1,526 @@
+/*
+ *  linux/mm/filemap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * 页面高速缓冲。以(设备号, i节点号, 起始逻辑块号)为键缓存常规文件中连续4块的内容，每项占一个物
+ * 理页面。file_read()和缺页处理do_no_page()都从这里取页面：命中时只需增加页面的引用计数，执行程
+ * 序的页面直接只读映射给进程(写时再复制)，不用再从缓冲块复制。
+ *
+ * 页面高速缓冲对其中每个页面持有一次引用(mem_map[]计数)。计数为1说明只有缓冲在用，内存不够时
+ * 可以回收；大于1说明页面还被映射在某些进程中或正被使用。
+ *
+ * 常规文件的数据只缓存在这里：file_write()把数据直接写进缓存页面并标记被写的块为脏，MAP_SHARED
+ * 映射的脏页面也在msync()、munmap()或被回收时交给这里。脏页面按变脏的先后挂在脏页面链表上，由
+ * 回写守护进程(到期的)、sync()和卸载文件系统(全部)用临时缓冲头直接从页面写盘，不经过缓冲块；脏页
+ * 面太多时写文件的进程自己先写出最早的一些。正在读入或写回的页面上锁，作废页面时要等它解锁。
+ *
+ * 缓存项从slab缓存中按需分配，最多为可分页内存页面数的一半，项数到达上限后重用最久未用的干净项。
+ * 文件被截断、软盘被更换或文件系统被卸载时，相应的页面全部作废(截断时脏页面直接丢弃)。
+ */
+
+#include <string.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/segment.h>
+#include <asm/system.h>
+
+#define NR_PHASH		1021	/* hash表项数 */
+
+struct cache_page {
+	struct cache_page * p_hash_next;
+	struct cache_page ** p_hash_pprev;	/* 为NULL表示不在hash表中 */
+	struct cache_page * p_lru_next;		/* LRU循环链表，表头最久未用 */
+	struct cache_page * p_lru_prev;
+	struct cache_page * p_dirty_next;	/* 脏页面链表，按变脏的先后排列 */
+	struct cache_page ** p_dirty_pprev;	/* 为NULL表示不在脏页面链表中 */
+	unsigned long p_page;				/* 物理页面地址，0表示空闲项 */
+	unsigned long p_block;				/* 页面中第一块在文件中的逻辑块号 */
+	unsigned long p_dirtytime;			/* 变脏的时间(jiffies) */
+	unsigned short p_dev;				/* 文件所在设备 */
+	unsigned short p_ino;				/* 文件i节点号 */
+	unsigned char p_lock;				/* 正在从设备读入或正在写回 */
+	unsigned char p_dirt;				/* 被写过的块，位i对应页面中的第i块 */
+	struct task_struct * p_wait;		/* 等待读入或写回完成的进程 */
+};
+
+static struct kmem_cache * page_cachep = NULL;
+static struct cache_page * page_hash[NR_PHASH];
+static struct cache_page * page_lru = NULL;
+static struct cache_page * dirty_pages = NULL;
+static struct cache_page ** dirty_tail = &dirty_pages;
+static int nr_cache_entries = 0;
+static int page_cache_max = 0;			/* 缓存项数上限 */
+static int nr_dirty_pages = 0;
+
+#define page_hashfn(dev, ino, block)	(((dev) ^ ((ino) << 5) ^ (block)) % NR_PHASH)
+#define page_count(p)					(mem_map[MAP_NR((p)->p_page)])
+#define DIRTY_LIMIT						(page_cache_max / 4)
+
+/* 建立缓存项的slab缓存，并按可分页内存的大小确定缓存项数上限 */
+static int page_cache_setup(void)
+{
+	if (!(page_cachep = kmem_cache_create("page_cache", sizeof(struct cache_page), NULL))) {
+		return 0;
+	}
+	page_cache_max = PAGING_PAGES / 2;
+	return 1;
+}
+
+/* 把缓存项移到LRU表尾(最近使用) */
+static inline void page_touch(struct cache_page * p)
+{
+	if (p == page_lru) {
+		page_lru = p->p_lru_next;
+		return;
+	}
+	p->p_lru_prev->p_lru_next = p->p_lru_next;
+	p->p_lru_next->p_lru_prev = p->p_lru_prev;
+	p->p_lru_next = page_lru;
+	p->p_lru_prev = page_lru->p_lru_prev;
+	page_lru->p_lru_prev->p_lru_next = p;
+	page_lru->p_lru_prev = p;
+}
+
+/* 新建一个空闲缓存项，放在LRU表头以便马上使用。分配时可能睡眠 */
+static void page_grow(void)
+{
+	struct cache_page * p;
+
+	if (!(p = (struct cache_page *) kmem_cache_alloc(page_cachep))) {
+		return;
+	}
+	memset(p, 0, sizeof(struct cache_page));
+	if (!page_lru) {
+		p->p_lru_next = p->p_lru_prev = p;
+	} else {
+		p->p_lru_next = page_lru;
+		p->p_lru_prev = page_lru->p_lru_prev;
+		page_lru->p_lru_prev->p_lru_next = p;
+		page_lru->p_lru_prev = p;
+	}
+	page_lru = p;
+	nr_cache_entries++;
+}
+
+/* 把页面中mask指定的块标记为脏，页面新变脏时挂到脏页面链表尾 */
+static void page_dirty(struct cache_page * p, int mask)
+{
+	if (!p->p_dirt) {
+		p->p_dirtytime = jiffies;
+		p->p_dirty_next = NULL;
+		p->p_dirty_pprev = dirty_tail;
+		*dirty_tail = p;
+		dirty_tail = &p->p_dirty_next;
+		nr_dirty_pages++;
+	}
+	p->p_dirt |= mask;
+}
+
+/* 清除页面的脏标志，并从脏页面链表中取下 */
+static void page_clean(struct cache_page * p)
+{
+	if (!p->p_dirty_pprev) {
+		return;
+	}
+	if ((*p->p_dirty_pprev = p->p_dirty_next)) {
+		p->p_dirty_next->p_dirty_pprev = p->p_dirty_pprev;
+	} else {
+		dirty_tail = p->p_dirty_pprev;
+	}
+	p->p_dirty_pprev = NULL;
+	p->p_dirt = 0;
+	nr_dirty_pages--;
+}
+
+/*
+ * 作废缓存项：从hash表中取下，丢弃脏数据，并放到LRU表头以便优先重用。正在读入的页面由读入者在
+ * 完成后释放，否则这里就放弃缓冲对页面的引用(页面若还映射在进程中则继续有效)。
+ */
+static void page_drop(struct cache_page * p)
+{
+	if (p->p_hash_pprev) {
+		if (p->p_hash_next) {
+			p->p_hash_next->p_hash_pprev = p->p_hash_pprev;
+		}
+		*p->p_hash_pprev = p->p_hash_next;
+		p->p_hash_next = NULL;
+		p->p_hash_pprev = NULL;
+	}
+	page_clean(p);
+	if (!p->p_lock && p->p_page) {
+		free_page(p->p_page);
+		p->p_page = 0;
+	}
+	page_touch(p);
+	page_lru = p;
+}
+
+static struct cache_page * page_find(int dev, int ino, unsigned long block)
+{
+	struct cache_page * p;
+
+	for (p = page_hash[page_hashfn(dev, ino, block)] ; p ; p = p->p_hash_next) {
+		if (p->p_dev == dev && p->p_ino == ino && p->p_block == block) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/* 从LRU表头开始找一个可以重用的缓存项：空闲的，或者页面干净并且只被缓冲引用的 */
+static struct cache_page * page_victim(void)
+{
+	struct cache_page * p = page_lru;
+
+	if (!p) {
+		return NULL;
+	}
+	do {
+		if (!p->p_page || (!p->p_lock && !p->p_dirt && page_count(p) == 1)) {
+			return p;
+		}
+	} while ((p = p->p_lru_next) != page_lru);
+	return NULL;
+}
+
+static void write_cache_page(struct cache_page * p);
+
+/*
+ * 执行程序和库文件的页面以不对齐的块号为键缓存(前面有1块文件头)，与file_read()/file_write()使用的
+ * 对齐页面重叠。文件数据只写进对齐页面，所以读入不对齐的页面之前先把重叠的对齐脏页面写盘，写文件
+ * 之后再作废重叠的不对齐页面。
+ */
+
+/* 读入不对齐的页面前写出与它重叠的对齐脏页面，写过(或等待过)返回1，调用者要重新查找 */
+static int sync_aligned_pages(struct m_inode * inode, unsigned long block)
+{
+	struct cache_page * p;
+	unsigned long k = block & ~3;
+	int i;
+
+	for (i = 0 ; i < 2 ; i++, k += 4) {
+		if (!(p = page_find(inode->i_dev, inode->i_num, k))) {
+			continue;
+		}
+		if (p->p_lock) {
+			sleep_on(&p->p_wait);
+			return 1;
+		}
+		if (p->p_dirt) {
+			write_cache_page(p);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * 取文件中从逻辑块block开始的一页，返回其缓存项，*page为页面地址(调用者持有一次引用)。页面不在
+ * 缓冲中则申请一页读入并加入缓冲；缓存项都被占用时读入的页面不进入缓冲，返回NULL而*page不为0；
+ * 内存不够时*page为0。
+ */
+static struct cache_page * page_get(struct m_inode * inode, unsigned long block,
+	unsigned long * page)
+{
+	struct cache_page * p;
+	int nr[4], i;
+
+	*page = 0;
+repeat:
+	if ((p = page_find(inode->i_dev, inode->i_num, block))) {
+		if (p->p_lock) {
+			sleep_on(&p->p_wait);
+			goto repeat;
+		}
+		page_touch(p);
+		page_count(p)++;
+		*page = p->p_page;
+		return p;
+	}
+	if ((block & 3) && sync_aligned_pages(inode, block)) {
+		goto repeat;
+	}
+	/* 缓存项还没到上限并且没有空闲项时新建一项，分配时可能睡眠，所以重新查找 */
+	if (nr_cache_entries < page_cache_max && (!page_lru || page_lru->p_page)) {
+		i = nr_cache_entries;
+		page_grow();
+		if (nr_cache_entries != i) {
+			goto repeat;
+		}
+	}
+	/* 页面内容全部由bread_page()填写，不必清零 */
+	if (!(*page = __get_free_page(GFP_NOZERO))) {
+		return NULL;
+	}
+	/* 申请页面时可能因换出页面而睡眠，期间别的进程可能已经读入了这一页 */
+	if (page_find(inode->i_dev, inode->i_num, block)) {
+		free_page(*page);
+		goto repeat;
+	}
+	if ((p = page_victim())) {
+		page_drop(p);
+		p->p_page = *page;
+		p->p_block = block;
+		p->p_dev = inode->i_dev;
+		p->p_ino = inode->i_num;
+		p->p_lock = 1;
+		i = page_hashfn(p->p_dev, p->p_ino, block);
+		if ((p->p_hash_next = page_hash[i])) {
+			p->p_hash_next->p_hash_pprev = &p->p_hash_next;
+		}
+		page_hash[i] = p;
+		p->p_hash_pprev = page_hash + i;
+		page_touch(p);
+		mem_map[MAP_NR(*page)]++;	/* 缓冲的引用 */
+	}
+	for (i = 0 ; i < 4 ; i++) {
+		nr[i] = bmap(inode, block + i);
+	}
+	bread_page(*page, inode->i_dev, nr);
+	if (p) {
+		p->p_lock = 0;
+		wake_up(&p->p_wait);
+	}
+	return p;
+}
+
+/*
+ * 把脏页面写盘。先从脏页面链表中取下并上锁，再按i节点把各脏块映射成设备块号(超出文件长度的不写)，
+ * 然后直接从页面写出。写回期间页面又被写过的话会重新变脏。
+ */
+static void write_cache_page(struct cache_page * p)
+{
+	struct m_inode * inode;
+	int nr[4], i, dirt = p->p_dirt;
+
+	page_clean(p);
+	p->p_lock = 1;
+	if ((inode = iget(p->p_dev, p->p_ino))) {
+		for (i = 0 ; i < 4 ; i++) {
+			nr[i] = 0;
+			if ((dirt & (1 << i)) && (p->p_block + i) * BLOCK_SIZE < inode->i_size) {
+				nr[i] = create_block(inode, p->p_block + i);
+			}
+		}
+		bwrite_page(p->p_page, p->p_dev, nr);
+	}
+	p->p_lock = 0;
+	wake_up(&p->p_wait);
+	/* iput()可能截断文件而作废本页面，所以在解锁之后 */
+	iput(inode);
+}
+
+/* 脏页面太多时，写文件的进程先写出最早变脏的页面 */
+static void balance_dirty_pages(void)
+{
+	while (nr_dirty_pages > DIRTY_LIMIT && dirty_pages) {
+		write_cache_page(dirty_pages);
+	}
+}
+
+/**
+ * 取文件中从逻辑块block开始的一页内容
+ * 页面在缓冲中则直接返回，否则申请一页物理内存读入并加入缓冲(缓冲项都被占用时读入的页面不进入
+ * 缓冲)。文件中不存在的块对应的部分为0。
+ * @param[in]	inode	文件i节点
+ * @param[in]	block	页面中第一块在文件中的逻辑块号
+ * @retval		页面的物理地址，调用者持有一次引用，用完后调用free_page()释放；内存不够返回0
+ */
+unsigned long get_cache_page(struct m_inode * inode, unsigned long block)
+{
+	unsigned long page;
+
+	if (!page_cachep && !page_cache_setup()) {
+		return 0;
+	}
+	page_get(inode, block, &page);
+	return page;
+}
+
+/**
+ * 判断文件中从逻辑块block开始的一页是否在页面高速缓冲中(不等待正在读入的页面)
+ * @param[in]	inode	文件i节点
+ * @param[in]	block	页面中第一块在文件中的逻辑块号
+ * @retval		在缓冲中返回1，否则返回0
+ */
+int page_cached(struct m_inode * inode, unsigned long block)
+{
+	return page_find(inode->i_dev, inode->i_num, block) != NULL;
+}
+
+/**
+ * 把用户数据写入文件第block块所在的缓存页面，并把该块标记为脏
+ * 调用者已为该块分配了设备块，并已把文件长度扩展到包括写入的数据。
+ * @param[in]	inode	文件i节点
+ * @param[in]	block	逻辑块号
+ * @param[in]	offset	块内偏移
+ * @param[in]	buf		用户数据(fs段)
+ * @param[in]	count	字节数，不超过块的末尾
+ * @retval		写入了返回1；页面不能进入缓冲(缓冲项都被占用)或内存不够返回0，由调用者直接写缓冲块
+ */
+int write_cache_block(struct m_inode * inode, unsigned long block, int offset,
+	const char * buf, int count)
+{
+	struct cache_page * p;
+	unsigned long page;
+
+	if (!page_cachep && !page_cache_setup()) {
+		return 0;
+	}
+	balance_dirty_pages();
+	if (!(p = page_get(inode, block & ~3, &page))) {
+		if (page) {
+			free_page(page);
+		}
+		return 0;
+	}
+	copy_from_user((char *) page + (block & 3) * BLOCK_SIZE + offset, buf, count);
+	/* 复制时可能因缺页而睡眠，期间页面可能已被作废(文件被截断)，作废的数据不再写盘 */
+	if (p->p_page == page && p->p_hash_pprev) {
+		page_dirty(p, 1 << (block & 3));
+	}
+	free_page(page);
+	invalidate_block_pages(inode, block, 1);
+	return 1;
+}
+
+/**
+ * 作废与文件第block ~ block+nr-1块重叠的不对齐缓存页面(执行程序和库文件的页面)
+ * 文件的这些块被写过之后调用，以后执行时重新读入。已映射在进程中的页面继续有效。
+ * @param[in]	inode	文件i节点
+ * @param[in]	block	第一块的逻辑块号
+ * @param[in]	nr		块数
+ * @retval		void
+ */
+void invalidate_block_pages(struct m_inode * inode, unsigned long block, int nr)
+{
+	struct cache_page * p;
+	unsigned long k;
+
+	for (k = (block > 3) ? block - 3 : 0 ; k < block + nr ; k++) {
+		if (!(k & 3)) {
+			continue;
+		}
+repeat:
+		if ((p = page_find(inode->i_dev, inode->i_num, k))) {
+			if (p->p_lock) {
+				sleep_on(&p->p_wait);
+				goto repeat;
+			}
+			page_drop(p);
+		}
+	}
+}
+
+/**
+ * 进程写过的MAP_SHARED映射页面交回页面高速缓冲：若它就是文件中从逻辑块block开始的缓存页面，就把
+ * 其中各块标记为脏，由回写写入文件
+ * @param[in]	inode	文件i节点
+ * @param[in]	block	页面中第一块在文件中的逻辑块号
+ * @param[in]	page	页面的物理地址
+ * @retval		是缓存页面返回1，否则(文件已被截断或页面没有进入缓冲)返回0
+ */
+int set_page_dirty(struct m_inode * inode, unsigned long block, unsigned long page)
+{
+	struct cache_page * p;
+
+	if (!(p = page_find(inode->i_dev, inode->i_num, block)) || p->p_page != page) {
+		return 0;
+	}
+	page_dirty(p, 0x0f);
+	invalidate_block_pages(inode, block, 4);
+	return 1;
+}
+
+/**
+ * 把页面高速缓冲中的脏页面写盘
+ * @param[in]	dev		只写该设备上的页面，0表示所有设备
+ * @param[in]	age		只写变脏已超过age个滴答的页面，0表示全部
+ * @retval		void
+ */
+void sync_cache_pages(int dev, long age)
+{
+	struct cache_page * p;
+	int n = nr_dirty_pages;		/* 写回期间又变脏的页面不在这次写 */
+
+repeat:
+	for (p = dirty_pages ; p && n > 0 ; p = p->p_dirty_next) {
+		if (age && (long) (jiffies - p->p_dirtytime) < age) {
+			break;
+		}
+		if (dev && p->p_dev != dev) {
+			continue;
+		}
+		n--;
+		write_cache_page(p);
+		goto repeat;
+	}
+}
+
+/*
+ * 作废hash表中满足条件的缓存项。正在读入或写回的页面要等它解锁，睡眠后重新扫描。
+ */
+static void invalidate_pages(int dev, int ino)
+{
+	struct cache_page * p, * next;
+	int i;
+
+repeat:
+	for (i = 0 ; i < NR_PHASH ; i++) {
+		for (p = page_hash[i] ; p ; p = next) {
+			next = p->p_hash_next;
+			if (p->p_dev != dev || (ino && p->p_ino != ino)) {
+				continue;
+			}
+			if (p->p_lock) {
+				sleep_on(&p->p_wait);
+				goto repeat;
+			}
+			page_drop(p);
+		}
+	}
+}
+
+/**
+ * 作废文件的所有缓存页面(文件被截断时调用，其数据块随后可能分配给别的文件，脏数据也不再写盘)
+ * @param[in]	inode	文件i节点
+ * @retval		void
+ */
+void invalidate_inode_pages(struct m_inode * inode)
+{
+	invalidate_pages(inode->i_dev, inode->i_num);
+}
+
+/**
+ * 作废设备dev上所有文件的缓存页面(卸载文件系统或更换软盘时调用)
+ * @param[in]	dev		设备号
+ * @retval		void
+ */
+void invalidate_dev_pages(int dev)
+{
+	invalidate_pages(dev, 0);
+}
+
+/**
+ * 回收一个干净并且只被页面高速缓冲引用的页面(在get_free_page()没有空闲页面时调用)
+ * @retval		回收了页面返回1，否则返回0
+ */
+int shrink_page_cache(void)
+{
+	struct cache_page * p = page_lru;
+
+	if (!p) {
+		return 0;
+	}
+	do {
+		if (p->p_hash_pprev && !p->p_lock && !p->p_dirt && page_count(p) == 1) {
+			page_drop(p);
+			return 1;
+		}
+	} while ((p = p->p_lru_next) != page_lru);
+	return 0;
+}
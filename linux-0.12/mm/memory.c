@@ -61,12 +61,126 @@
 
 /* 存放实际物理内存最高端地址 */
 unsigned long HIGH_MEMORY = 0;	
+unsigned long paging_pages = 0;
 
 /* 从from处复制一页内存到to处(4KB) */
 #define copy_page(from, to) 	__asm__("cld ; rep ; movsl"::"S" (from),"D" (to),"c" (1024))
 
-/* 内存映射字节图(1字节代表1页物理内存的使用情况) */
-unsigned char mem_map [ PAGING_PAGES ] = {0, };
+/*
+ * 共享的零页面。进程读还没有访问过的动态内存(bss、堆和栈)时只读映射这一页，第一次写时才由
+ * un_wp_page()分配私有页面。它在内核映像中(LOW_MEM以下)，不计入mem_map[]，free_page()、
+ * copy_page_tables()和swap_out()都跳过这样的页面，所以映射多少次都不用维护引用计数。
+ */
+static unsigned long empty_zero_page[1024] __attribute__((aligned(4096)));
+static unsigned long zero_page_maps = 0;		/* 缺页时映射零页面的次数 */
+
+#define ZERO_PAGE	((unsigned long) empty_zero_page)
+
+/*
+ * 内存映射图(每页物理内存一个16位的引用计数)，大小随物理内存容量，在mem_init()中分配。NR_TASKS
+ * 个进程加上页面高速缓冲同时映射一个页面时，字节计数就会溢出。
+ */
+unsigned short * mem_map = NULL;
+
+/*
+ * 伙伴系统。空闲物理页面按2^order个页面大小、按大小对齐的块挂在free_area[order]链表上，链表
+ * 指针就存放在空闲块的头一个页面中(1MB以上的物理内存与内核线性地址一一对应)。free_order[]记录
+ * 每个空闲块头一个页面所在的阶，用来判断伙伴块是否空闲。申请时从满足要求的最小的块中分裂，释放时
+ * 与空闲的伙伴块逐级合并，都只需O(NR_MEM_LISTS)步。
+ *
+ * mem_map[]仍是每个页面的引用计数，为0表示空闲。
+ */
+struct free_list {
+	struct free_list * next;
+	struct free_list * prev;
+};
+
+#define NOT_FREE	0xff		/* 该页面不是空闲块的头一个页面 */
+
+static struct free_list free_area[NR_MEM_LISTS];
+static unsigned char * free_order;
+static unsigned long nr_free[NR_MEM_LISTS];		/* 各阶空闲块数 */
+
+#define page_block(nr)	((struct free_list *) (LOW_MEM + ((nr) << 12)))
+
+/* 把从页面号nr开始的2^order个页面作为空闲块挂到链表上(须已关中断) */
+static inline void add_free(unsigned long nr, int order)
+{
+	struct free_list * b = page_block(nr);
+
+	b->next = free_area[order].next;
+	b->prev = free_area + order;
+	b->next->prev = b;
+	free_area[order].next = b;
+	free_order[nr] = order;
+	nr_free[order]++;
+}
+
+/* 从链表上取下空闲块(须已关中断) */
+static inline void del_free(unsigned long nr, int order)
+{
+	struct free_list * b = page_block(nr);
+
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+	free_order[nr] = NOT_FREE;
+	nr_free[order]--;
+}
+
+/* 释放一个空闲块，并与空闲的伙伴块逐级合并(须已关中断) */
+static void buddy_free(unsigned long nr, int order)
+{
+	unsigned long buddy;
+
+	for ( ; order < NR_MEM_LISTS - 1 ; order++) {
+		buddy = nr ^ (1 << order);
+		if (buddy >= PAGING_PAGES || free_order[buddy] != order) {
+			break;
+		}
+		del_free(buddy, order);
+		nr &= ~(1 << order);
+	}
+	add_free(nr, order);
+}
+
+/**
+ * 申请2^order个物理上连续的页面
+ * 不会睡眠，也不清零页面；没有足够大的空闲块时直接返回0，回收页面由get_free_pages()负责。
+ * @param[in]	order	阶(0 ~ NR_MEM_LISTS-1)
+ * @retval		起始物理地址(按块大小对齐)，失败返回0
+ */
+unsigned long __get_free_pages(int order)
+{
+	unsigned long flags, nr;
+	int i;
+
+	if (order < 0 || order >= NR_MEM_LISTS) {
+		return 0;
+	}
+	save_flags(flags);
+	cli();
+	for (i = order ; i < NR_MEM_LISTS ; i++) {
+		if (free_area[i].next != free_area + i) {
+			break;
+		}
+	}
+	if (i >= NR_MEM_LISTS) {
+		restore_flags(flags);
+		return 0;
+	}
+	nr = MAP_NR((unsigned long) free_area[i].next);
+	del_free(nr, i);
+	/* 把多出来的后一半逐级放回较低阶的链表 */
+	while (i > order) {
+		i--;
+		add_free(nr + (1 << i), i);
+	}
+	for (i = 0 ; i < (1 << order) ; i++) {
+		mem_map[nr + i] = 1;
+	}
+	restore_flags(flags);
+	return LOW_MEM + (nr << 12);
+}
 
 /*
  * Free a page of memory at physical address 'addr'. Used by
@@ -74,12 +188,18 @@ unsigned char mem_map [ PAGING_PAGES ] = {0, };
  */
 
 /**
- * 释放物理地址addr开始的1页内存
+ * 释放物理地址addr开始的2^order个页面
+ * 块中每个页面的引用计数减1，减为0的页面才真正释放。都没有被共享时整块一次放回，否则逐页放回(
+ * 伙伴系统会把它们重新合并)。各页面也可以分别用free_page()释放。
  * @param[in]	addr	需要释放的起始物理地址
+ * @param[in]	order	申请时的阶
  * @return		void
  */
-void free_page(unsigned long addr)
+void free_pages(unsigned long addr, int order)
 {
+	unsigned long flags;
+	int i, shared = 0;
+
 	if (addr < LOW_MEM) {
 		return;
 	}
@@ -89,12 +209,41 @@ void free_page(unsigned long addr)
 	/* 页面号 = (addr-LOW_MEM)/4096 */
 	addr -= LOW_MEM;
 	addr >>= 12;
-	if (mem_map[addr]--) {
-		return;
+	save_flags(flags);
+	cli();
+	for (i = 0 ; i < (1 << order) ; i++) {
+		/* 释放原本已经空闲的页面，内核存在问题 */
+		if (!mem_map[addr + i]) {
+			restore_flags(flags);
+			panic("trying to free free page");
+		}
+		if (mem_map[addr + i] > 1) {
+			shared = 1;
+		}
 	}
-	/* 执行到此处表示要释放原本已经空闲的页面，内核存在问题 */
-	mem_map[addr] = 0;
-	panic("trying to free free page");
+	if (!shared) {
+		for (i = 0 ; i < (1 << order) ; i++) {
+			mem_map[addr + i] = 0;
+		}
+		buddy_free(addr, order);
+	} else {
+		for (i = 0 ; i < (1 << order) ; i++) {
+			if (!--mem_map[addr + i]) {
+				buddy_free(addr + i, 0);
+			}
+		}
+	}
+	restore_flags(flags);
+}
+
+/**
+ * 释放物理地址addr开始的1页内存
+ * @param[in]	addr	需要释放的起始物理地址
+ * @return		void
+ */
+void free_page(unsigned long addr)
+{
+	free_pages(addr, 0);
 }
 
 /*
@@ -106,16 +255,60 @@ void free_page(unsigned long addr)
  * 4MB长度的内存块。
  */
 
+/**
+ * 新建一个任务的页目录
+ * 复制任务0页目录中内核恒等映射的部分(内核页表为所有任务共用)，进程空间部分为空。
+ * @return		页目录的物理地址，内存不够返回NULL
+ */
+unsigned long * new_page_dir(void)
+{
+	unsigned long * dir;
+	int i;
+
+	if (!(dir = (unsigned long *) get_free_page())) {
+		return NULL;
+	}
+	for (i = 0 ; i < (USER_BASE >> 22) ; i++) {
+		dir[i] = pg_dir[i];
+	}
+	return dir;
+}
+
+/* 释放页表项映射的页面或交换页面，并清除页表项 */
+static inline void free_pte(unsigned long * pte)
+{
+	if (!*pte) {
+		return;
+	}
+	if (1 & *pte) {	/* 在物理内存中  */
+		free_page(0xfffff000 & *pte);
+	} else if (*pte != PAGE_DROPPED) {	/* 在交换设备中 */
+		swap_free(*pte >> 1);
+	}
+	*pte = 0;
+}
+
+/* 释放页表中映射的所有页面和交换页面，页表本身不释放 */
+static void free_one_table(unsigned long * pg_table)
+{
+	unsigned long nr;
+
+	for (nr = 0 ; nr < 1024 ; nr++, pg_table++) {
+		free_pte(pg_table);
+	}
+}
+
 /**
  * 根据指定的线性地址和限长(页表个数)，释放指定页面
+ * 与其他进程共享的页表只减少它的引用计数。
+ * @param[in]	dir			页目录
  * @param[in]	from		起始线性基地址
  * @param[in] 	size		释放的字节长度
  * @return		0
  */
-int free_page_tables(unsigned long from, unsigned long size)
+int free_page_tables(unsigned long * dir, unsigned long from, unsigned long size)
 {
-	unsigned long *pg_table;
-	unsigned long * dir, nr;
+	unsigned long pg_table;
 
 	if (from & 0x3fffff) {	/* 参数from给出的线性基地址是否在4MB的边界处 */
 		panic("free_page_tables called with wrong alignment");
@@ -126,31 +319,140 @@ int free_page_tables(unsigned long from, unsigned long size)
 	/* 计算size指定长度所占的页目录数（4MB的进位整数倍，向上取整），例如size=4.01MB则size=2 */
 	size = (size + 0x3fffff) >> 22;
 	/* 页目录项指针 */
-	dir = (unsigned long *) ((from >> 20) & 0xffc); 			/* _pg_dir = 0 */
+	dir += from >> 22;
 	/* 遍历需要释放的页目录项，释放对应页表中的页表项 */
 	for ( ; size-- > 0 ; dir++) {
 		if (!(1 & *dir)) {
 			continue;
 		}
-		pg_table = (unsigned long *) (0xfffff000 & *dir);
-		for (nr = 0 ; nr < 1024 ; nr++) {
-			if (*pg_table) {
-				if (1 & *pg_table) {	/* 在物理内存中  */
-					free_page(0xfffff000 & *pg_table);
-				} else {				/* 在交换设备中 */
-					swap_free(*pg_table >> 1);
-				}
-				*pg_table = 0;
-			}
-			pg_table++;
+		pg_table = 0xfffff000 & *dir;
+		if (mem_map[MAP_NR(pg_table)] == 1) {
+			free_one_table((unsigned long *) pg_table);
 		}
-		free_page(0xfffff000 & *dir);
+		free_page(pg_table);
 		*dir = 0;
 	}
 	invalidate();
 	return 0;
 }
 
+/*
+ * 页表写时复制。fork()时进程空间的页表并不复制，父子进程的目录项指向同一个页表，页表页面的
+ * mem_map[]计数就是共享它的目录项数，这些目录项都设为只读(R/W位为0，整个页表映射的页面对用户
+ * 程序都只读)。任何一方要修改其中的页表项，或者写其中的页面之前，先调用unshare_page_table()得到
+ * 自己的页表。多数子进程马上执行execve()，这样就完全不用复制页表。
+ *
+ * 共享的页表中的页面只被页表引用一次，swap_out()换出或回收这样的页面对所有共享者都有效。
+ */
+#define MAX_TABLE_SHARE	250		/* 页表的共享数上限，超过时直接复制 */
+
+/*
+ * 复制页表中的前nr个页表项，页面在两个页表中都改为只读，增加其引用计数；交换设备中的页面读入一
+ * 份给源页表，交换页面留给目标页表。目标页表须已清零。
+ */
+static int copy_one_table(unsigned long * from_page_table, unsigned long * to_page_table,
+	unsigned long nr)
+{
+	unsigned long this_page;
+	unsigned long new_page;
+
+	for ( ; nr-- > 0 ; from_page_table++, to_page_table++) {
+		this_page = *from_page_table;
+		if (!this_page) {
+			continue;
+		}
+		/* 已被回收的干净页面，子进程访问时同样重新调入 */
+		if (this_page == PAGE_DROPPED) {
+			*to_page_table = this_page;
+			continue;
+		}
+		/* 该页面在交换设备中，申请一页新的内存，然后将交换设备中的数据读取到该页面中 */
+		if (!(1 & this_page)) {
+			if (!(new_page = __get_free_page(GFP_NOZERO))) {
+				return -1;
+			}
+			swap_read_page(this_page >> 1, new_page);
+			*to_page_table = this_page;
+			*from_page_table = new_page | (PAGE_DIRTY | 7);
+			continue;
+		}
+		this_page &= ~2;	/* 让页表项对应的内存页面只读 */
+		*to_page_table = this_page;
+		/* 物理页面的地址在1MB以上，则需在mem_map[]中增加对应页面的引用次数 */
+		if (this_page > LOW_MEM) {
+			*from_page_table = this_page;	/* 令源页表项也只读 */
+			this_page -= LOW_MEM;
+			this_page >>= 12;
+			mem_map[this_page]++;
+		}
+	}
+	return 0;
+}
+
+/**
+ * 取消页表共享
+ * 页表只有当前任务在用时把目录项改为可写即可，否则复制一份页表换上(页表中的页面仍写时复制)。
+ * @param[in]	dir_entry	当前任务页目录中只读的目录项
+ * @retval		成功返回1，内存不够返回0
+ */
+static int unshare_page_table(unsigned long * dir_entry)
+{
+	unsigned long old_table, new_table;
+
+	old_table = 0xfffff000 & *dir_entry;
+	if (mem_map[MAP_NR(old_table)] == 1) {
+		*dir_entry |= 2;
+		invalidate();
+		return 1;
+	}
+	if (!(new_table = get_free_page())) {
+		return 0;
+	}
+	if (copy_one_table((unsigned long *) old_table, (unsigned long *) new_table, 1024)) {
+		free_one_table((unsigned long *) new_table);
+		free_page(new_table);
+		return 0;
+	}
+	free_page(old_table);
+	*dir_entry = new_table | 7;
+	invalidate();
+	return 1;
+}
+
+/* 当前任务中address所在的页表若是共享的，先取消共享 */
+static inline void own_page_table(unsigned long address)
+{
+	unsigned long * dir_entry = task_pg_dir(current) + (address >> 22);
+
+	if ((3 & *dir_entry) == 1 && !unshare_page_table(dir_entry)) {
+		oom();
+	}
+}
+
+/**
+ * 释放当前任务中一段线性地址映射的页面(munmap()使用)
+ * 与free_page_tables()不同，地址和长度只要按页面对齐，页表本身保留。
+ * @param[in]	from	起始线性地址
+ * @param[in]	size	长度(字节)
+ * @return		void
+ */
+void zap_page_range(unsigned long from, unsigned long size)
+{
+	unsigned long * dir, end = from + size;
+
+	while (from < end) {
+		dir = task_pg_dir(current) + (from >> 22);
+		if (!(1 & *dir)) {		/* 页表不存在，跳到下一个页表 */
+			from = (from + 0x400000) & 0xffc00000;
+			continue;
+		}
+		own_page_table(from);
+		free_pte((unsigned long *) (0xfffff000 & *dir) + ((from >> 12) & 0x3ff));
+		from += PAGE_SIZE;
+	}
+	invalidate();
+}
+
 /*
  *  Well, here is one of the most complicated functions in mm. It
  * copies a range of linerar addresses by copying only the pages.
@@ -182,30 +484,29 @@ int free_page_tables(unsigned long from, unsigned long size)
  */
 /**
  * 复制目录表项和页表项（用于写时复制机制）
- * 复制指定线性地址和长度内存对应的页目录项和页表项，从而被复制的页目录和页表对应的原物理内存页面区
- * 被两套页表映射而共享使用。复制时，需申请新页面来存放新页表，原物理内存区将被共享。此后两个进程(父
- * 进程和其子进程)将共享内存区，直到有一个进程执行写操作时，内核才会为写操作进程分配新的内存页。
+ * 复制指定线性地址和长度内存对应的页目录项，从而被复制的页表和页表对应的原物理内存页面区被两个进程
+ * 共享使用。进程空间的页表本身也写时复制，只增加页表的引用计数并把两边的目录项都设为只读；只有第一次
+ * fork()复制任务0的内核空间时才申请新页面存放新页表。此后两个进程(父进程和其子进程)将共享内存区，直
+ * 到有一个进程执行写操作时，内核才会为写操作进程复制页表、分配新的内存页。
+ * @param[in]	to_dir	目标页目录(源地址在当前任务的页目录中)
  * @param[in]	from	源线性地址
  * @param[in]	to		目标线性地址
  * @param[in]	size	需要复制的长度(单位是字节)
  * @return		0
  */
-int copy_page_tables(unsigned long from, unsigned long to, long size)
+int copy_page_tables(unsigned long * to_dir, unsigned long from, unsigned long to, long size)
 {
-	unsigned long * from_page_table;
 	unsigned long * to_page_table;
-	unsigned long this_page;
-	unsigned long * from_dir, * to_dir;
-	unsigned long new_page;
-	unsigned long nr;
+	unsigned long * from_dir;
+	unsigned long pg_table;
 
 	/* 源地址和目的地址都需要在4MB内存边界地址 */
 	if ((from & 0x3fffff) || (to & 0x3fffff)) {
 		panic("copy_page_tables called with wrong alignment");
 	}
 	/* 源地址的目录项指针，目标地址的目录项指针， 需要复制的目录项数 */
-	from_dir = (unsigned long *) ((from >> 20) & 0xffc); 	/* _pg_dir = 0 */
-	to_dir = (unsigned long *) ((to >> 20) & 0xffc);
+	from_dir = task_pg_dir(current) + (from >> 22);
+	to_dir += to >> 22;
 	size = ((unsigned) (size + 0x3fffff)) >> 22;
 	/* 开始页表项复制操作 */
 	for( ; size-- > 0 ; from_dir++, to_dir++) {
@@ -215,40 +516,23 @@ int copy_page_tables(unsigned long from, unsigned long to, long size)
 		if (!(1 & *from_dir)) {
 			continue;
 		}
-		from_page_table = (unsigned long *) (0xfffff000 & *from_dir);
+		pg_table = 0xfffff000 & *from_dir;
+		/* 进程空间的页表与子进程共享，两边的目录项都只读 */
+		if (from && mem_map[MAP_NR(pg_table)] < MAX_TABLE_SHARE) {
+			*from_dir &= ~2;
+			*to_dir = *from_dir;
+			mem_map[MAP_NR(pg_table)]++;
+			continue;
+		}
 		if (!(to_page_table = (unsigned long *) get_free_page())) {
 			return -1;		/* Out of memory, see freeing */
 		}
 		*to_dir = ((unsigned long) to_page_table) | 7;
 		/* 源地址在内核空间，则仅需复制前160页对应的页表项(nr = 160)，对应640KB内存 */
-		nr = (from == 0) ? 0xA0 : 1024;
-		/* 循环复制当前页表的nr个内存页面表项 */
-		for ( ; nr-- > 0 ; from_page_table++, to_page_table++) {
-			this_page = *from_page_table;
-			if (!this_page) {
-				continue;
-			}
-			/* 该页面在交换设备中，申请一页新的内存，然后将交换设备中的数据读取到该页面中 */
-			if (!(1 & this_page)) {
-				if (!(new_page = get_free_page())) {
-					return -1;
-				}
-				read_swap_page(this_page >> 1, (char *) new_page);
-				*to_page_table = this_page;
-				*from_page_table = new_page | (PAGE_DIRTY | 7);
-				continue;
-			}
-			this_page &= ~2;	/* 让页表项对应的内存页面只读 */
-			*to_page_table = this_page;
-			/* 物理页面的地址在1MB以上，则需在mem_map[]中增加对应页面的引用次数 */
-			if (this_page > LOW_MEM) {
-				*from_page_table = this_page;	/* 令源页表项也只读 */
-				this_page -= LOW_MEM;
-				this_page >>= 12;
-				mem_map[this_page]++;
-			}
-        }
-    }
+		if (copy_one_table((unsigned long *) pg_table, to_page_table, (from == 0) ? 0xA0 : 1024)) {
+			return -1;
+		}
+	}
 	invalidate();
 	return 0;
 }
@@ -270,17 +554,14 @@ static unsigned long put_page(unsigned long page, unsigned long address)
 {
 	unsigned long tmp, *page_table;
 
-	/* NOTE !!! This uses the fact that _pg_dir=0 */
-	/* 注意!!! 这里使用了页目录表基地址pg_dir=0的条件 */
-
 	if (page < LOW_MEM || page >= HIGH_MEMORY)
 		printk("Trying to put page %p at %p\n", page, address);
 	/* page指向的页面未标记为已使用，故不能做映射 */
 	if (mem_map[(page - LOW_MEM) >> 12] != 1)
 		printk("mem_map disagrees with %p at %p\n", page, address);
 
-	/* 根据address从页目录表取出页表地址 */
-	page_table = (unsigned long *) ((address >> 20) & 0xffc);
+	/* 根据address从当前任务的页目录表取出页表地址 */
+	page_table = task_pg_dir(current) + (address >> 22);
 	if ((*page_table) & 1)	/* 页表存在 */
 		page_table = (unsigned long *) (0xfffff000 & *page_table);
 	else {
@@ -320,13 +601,11 @@ unsigned long put_dirty_page(unsigned long page, unsigned long address)
 {
 	unsigned long tmp, *page_table;
 
-	/* NOTE !!! This uses the fact that _pg_dir=0 */
-
 	if (page < LOW_MEM || page >= HIGH_MEMORY)
 		printk("Trying to put page %p at %p\n", page, address);
 	if (mem_map[(page-LOW_MEM)>>12] != 1)
 		printk("mem_map disagrees with %p at %p\n", page, address);
-	page_table = (unsigned long *) ((address >> 20) & 0xffc);
+	page_table = task_pg_dir(current) + (address >> 22);
 	if ((*page_table) & 1)
 		page_table = (unsigned long *) (0xfffff000 & *page_table);
 	else {
@@ -341,6 +620,61 @@ unsigned long put_dirty_page(unsigned long page, unsigned long address)
 	return page;
 }
 
+/**
+ * 把页面高速缓冲中的页面page映射到指定线性地址address处
+ * @note		与上面的put_page函数一样，但页面与页面高速缓冲共享，所以一般不设置R/W位，进程写该
+ *				页面时由do_wp_page()复制一份。只有可写的MAP_SHARED映射直接写缓冲中的页面。
+ * @param[in]	page	物理内存页面的地址
+ * @param[in]	address	指定线性地址
+ * @param[in]	rw		是否可写
+ * @retval		成功返回页面的物理地址，失败返回0
+ */
+static unsigned long put_cache_page(unsigned long page, unsigned long address, int rw)
+{
+	unsigned long tmp, *page_table;
+
+	if (page < LOW_MEM || page >= HIGH_MEMORY)
+		printk("Trying to put page %p at %p\n", page, address);
+	page_table = task_pg_dir(current) + (address >> 22);
+	if ((*page_table) & 1)
+		page_table = (unsigned long *) (0xfffff000 & *page_table);
+	else {
+		if (!(tmp = get_free_page()))
+			return 0;
+		*page_table = tmp | 7;
+		page_table = (unsigned long *) tmp;
+	}
+	page_table[(address >> 12) & 0x3ff] = page | (rw ? 7 : 5);	/* U/S，(R/W)，P */
+
+	/* no need for invalidate */
+	return page;
+}
+
+/**
+ * 把共享的零页面只读映射到指定线性地址address处
+ * @param[in]	address	指定线性地址
+ * @retval		成功返回1，申请不到页表返回0
+ */
+static int put_zero_page(unsigned long address)
+{
+	unsigned long tmp, *page_table;
+
+	page_table = task_pg_dir(current) + (address >> 22);
+	if ((*page_table) & 1)
+		page_table = (unsigned long *) (0xfffff000 & *page_table);
+	else {
+		if (!(tmp = get_free_page()))
+			return 0;
+		*page_table = tmp | 7;
+		page_table = (unsigned long *) tmp;
+	}
+	page_table[(address >> 12) & 0x3ff] = ZERO_PAGE | 5;	/* U/S，P */
+	zero_page_maps++;
+
+	/* no need for invalidate */
+	return 1;
+}
+
 /**
  * 取消写保护页面函数	[un_wp_page -- Un-Write Protect Page]
  * 用于页异常中断过程中写保护异常的处理(写时复制)。在内核fork创建进程时，copy_mem将父子进程的
@@ -363,10 +697,19 @@ unsigned long put_dirty_page(unsigned long page, unsigned long address)
 		invalidate();
 		return;
 	}
+
+	/* 第一次写零页面：换上一页(预先清零的)私有页面，不用复制 */
+	if (old_page == ZERO_PAGE) {
+		if (!(new_page = get_free_page()))
+			oom();
+		*table_entry = new_page | 7;
+		invalidate();
+		return;
+	}
 	
 	/* 申请一页空闲页面给执行写操作的进程单独使用，取消页面共享。复制原页面的内容至新页面，
 	将指定页表项值更新为新页面地址 */
-	if (!(new_page = get_free_page()))
+	if (!(new_page = __get_free_page(GFP_NOZERO)))
 		oom();							/* 内存不够处理 */
 	if (old_page >= LOW_MEM)
 		mem_map[MAP_NR(old_page)]--;
@@ -375,6 +718,26 @@ unsigned long put_dirty_page(unsigned long page, unsigned long address)
 	invalidate();
 }
 
+/*
+ * 写只读页面：mmap()映射区按其权限处理，可写的MAP_SHARED页面直接改为可写(各进程写同一页面)，
+ * 其余写时复制
+ */
+static void write_page(unsigned long address, unsigned long * table_entry)
+{
+	struct vm_area_struct * vma;
+
+	if ((vma = find_vma(current, address - current->start_code))) {
+		if (!(vma->vm_flags & VM_WRITE))
+			do_exit(SIGSEGV);
+		if (vma->vm_flags & VM_SHARED) {
+			*table_entry |= 2;
+			invalidate();
+			return;
+		}
+	}
+	un_wp_page(table_entry);
+}
+
 /*
  * This routine handles present pages, when users try to write
  * to a shared page. It is done by copying the page to a new address
@@ -397,7 +760,7 @@ unsigned long put_dirty_page(unsigned long page, unsigned long address)
  */
 void do_wp_page(unsigned long error_code, unsigned long address)
 {
-	if (address < TASK_SIZE)
+	if (address < USER_BASE)
 		printk("\n\rBAD! KERNEL MEMORY WP-ERR!\n\r");
 	if (address - current->start_code > TASK_SIZE) {
 		printk("Bad things happen: page error in do_wp_page\n\r");
@@ -412,10 +775,11 @@ void do_wp_page(unsigned long error_code, unsigned long address)
 	if (CODE_SPACE(address))
 		do_exit(SIGSEGV);
 #endif
-	/* 根据线性地址计算物理页面地址 */
-	un_wp_page((unsigned long *)
+	/* 先取得自己的页表，再根据线性地址计算物理页面地址 */
+	own_page_table(address);
+	write_page(address, (unsigned long *)
 		(((address >> 10) & 0xffc) + (0xfffff000 &
-		*((unsigned long *) ((address >> 20) & 0xffc)))));
+		task_pg_dir(current)[address >> 22])));
 
 }
 
@@ -429,8 +793,10 @@ void write_verify(unsigned long address)
 {
 	unsigned long page;
 
+	/* 页表被共享时内核写页面前同样要先取消共享 */
+	own_page_table(address);
 	/* 指定线性地址对应的页目录项是否存在 */
-	if (!( (page = *((unsigned long *) ((address >> 20) & 0xffc)) ) & 1)) {
+	if (!( (page = task_pg_dir(current)[address >> 22]) & 1)) {
 		return;
 	}
 	page &= 0xfffff000;
@@ -438,7 +804,7 @@ void write_verify(unsigned long address)
 	page += ((address >> 10) & 0xffc);
 	/* 然后判断该页表项中位1(R/W)，位0(P)标志 */
 	if ((3 & *(unsigned long *) page) == 1) {  /* non-writeable, present */
-		un_wp_page((unsigned long *) page);
+		write_page(address, (unsigned long *) page);
 	}
 	return;
 }
@@ -460,154 +826,73 @@ void get_empty_page(unsigned long address)
 }
 
 /*
- * try_to_share() checks the page at address "address" in the task "p",
- * to see if it exists, and if it is clean. If so, share it with the current
- * task.
- *
- * NOTE! This assumes we have checked that p != current, and that they
- * share the same executable or library.
- */
-/*
- * tty_to_share()任务“p”中检查位于地址“address”处的页面，看页面是否存在，是否干净。如果
- * 干净的话，就与当前任务共享。
- *
- * 注意！这里我们已假定p!=当前任务，并且它们共享同一个执行程序或库程序。
- */
-/**
- * 尝试对当前进程指定地址处的页面进行共享处理
- * 当前进程与进程p是同一执行代码，也可以认为当前进程是由p进程执行fork操作产生的进程，因此它们
- * 的代码内容一样。如果未对数据段内容作过修改那么数据段内容也应一样。
- * @param[in]	address		进程空间的逻辑地址
- * @param[in]	p			将被共享页面的进程
- * @return	页面共享处理成功返回1，失败返回0
- */
-static int try_to_share(unsigned long address, struct task_struct * p)
-{
-	unsigned long from;
-	unsigned long to;
-	unsigned long from_page;
-	unsigned long to_page;
-	unsigned long phys_addr;
-
-	from_page = to_page = ((address >> 20) & 0xffc);				/* 逻辑地址的目录项偏移 */
-	from_page += ((p->start_code >> 20) & 0xffc);             		/* p进程目录项 */
-	to_page += ((current->start_code >> 20) & 0xffc);         		/* 当前进程目录项 */
-	/* is there a page-directory at from? */ /* 在from处是否存在页目录项？ */
-	from = *(unsigned long *) from_page;
-	if (!(from & 1))
-		return 0;
-	from &= 0xfffff000;
-	from_page = from + ((address >> 10) & 0xffc);		/* 页表项指针 */
-	phys_addr = *(unsigned long *) from_page;			/* 页表项内容 */
-
-	/* is the page clean and present? */
-	if ((phys_addr & 0x41) != 0x01)		/* 物理页面干净并且存在吗？ */
-		return 0;
-	phys_addr &= 0xfffff000;			/* 物理页面地址 */
-	if (phys_addr >= HIGH_MEMORY || phys_addr < LOW_MEM)
-		return 0;
-
-	to = *(unsigned long *) to_page;	/* 当前进程目录项内容 */
-	if (!(to & 1)) {
-		if ((to = get_free_page())) {
-			*(unsigned long *) to_page = to | 7;
-		} else {
-			oom();
-		}
-	}
-
-	to &= 0xfffff000;
-	to_page = to + ((address >> 10) & 0xffc);		/* 当前进程的页表项地址 */
-	if (1 & *(unsigned long *) to_page)
-		panic("try_to_share: to_page already exists");
-	/* share them: write-protect */ /* 对它们进行共享处理：写保护 */
-	*(unsigned long *) from_page &= ~2;
-	*(unsigned long *) to_page = *(unsigned long *) from_page;
-	
-	invalidate();
-	/* 将对应物理页面的引用递增1 */
-	phys_addr -= LOW_MEM;
-	phys_addr >>= 12;
-	mem_map[phys_addr]++;
-	return 1;
-}
-
-/*
- * share_page() tries to find a process that could share a page with
- * the current one. Address is the address of the wanted page relative
- * to the current data space.
- *
- * We first check if it is at all feasible by checking executable->i_count.
- * It should be >1 if there are other tasks sharing this inode.
+ * mmap()映射区中的缺页。匿名映射与动态申请的内存一样处理；文件映射从页面高速缓冲中取页面，
+ * MAP_PRIVATE只读映射(写时复制)，可写的MAP_SHARED可写映射，各进程写的都是缓冲中的同一个页面，
+ * 由msync()或munmap()写回文件。
  */
-/*
- * share_page()试图找到一个进程，它可以与当前进程共享页面。参数address是当前进程数据空间中
- * 期望共享的某页面地址。
- *
- * 首先我们通过检测executable->i_count来查证是否可行。如果有其他任务已共享该inode，则它应
- * 该大于1。
- */
-
-static int share_page(struct m_inode * inode, unsigned long address)
+static void do_mmap_page(struct vm_area_struct * vma, unsigned long error_code,
+	unsigned long address, unsigned long offset)
 {
-	struct task_struct ** p;
+	unsigned long page;
 
-	/*如果该内存i节点的引用计数值等于1或者i节点指针空，表示当前系统中只有1个进程在运行该执行文件
-	 或者提供的i节点无效，因此无共享可言 */
-	if (inode->i_count < 2 || !inode)
-		return 0;
-	/* 搜索任务数组中所有任务。寻找与当前进程可共享页面的进程，即运行相同执行文件的另一个进程 */
-	for (p = &LAST_TASK ; p > &FIRST_TASK ; --p) {
-		if (!*p)				/* 该任务项空闲 */
-			continue;
-		if (current == *p)		/* 如果是当前任务 */
-			continue;
-		if (address < LIBRARY_OFFSET) {
-			if (inode != (*p)->executable)
-				continue;
-		} else {
-			if (inode != (*p)->library)
-				continue;
-		}
-		if (try_to_share(address, *p))			/* 尝试共享页面 */
-			return 1;
+	if (!(vma->vm_flags & (VM_READ | VM_WRITE)) ||
+		((error_code & 2) && !(vma->vm_flags & VM_WRITE)))
+		do_exit(SIGSEGV);
+	if (!vma->vm_inode) {
+		if (!(error_code & 2) && put_zero_page(address))
+			return;
+		get_empty_page(address);
+		return;
 	}
-	return 0;
+	offset += vma->vm_offset - vma->vm_start;
+	if (!(page = get_cache_page(vma->vm_inode, offset / BLOCK_SIZE)))
+		oom();
+	if (put_cache_page(page, address, (vma->vm_flags & (VM_SHARED | VM_WRITE)) ==
+		(VM_SHARED | VM_WRITE)))
+		return;
+	free_page(page);
+	oom();
 }
 
 /**
  * 执行缺页处理（在page.s中被调用）
  * 函数参数error_code和address是进程在访问页面时由CPU因缺页产生异常而自动生成。
  * 1. 首先查看所缺页是否在交换设备中，若是则交换进来。
- * 2. 否则尝试与已加载的相同文件进行页面共享，或者只是由于进程动态申请内存页面而只需
- *    映射一页物理内存页即可。
- * 3. 若共享操作不成功，那么只能从相应文件中读入所缺的数据页面到指定线性地址处。
- * @param[in]	error_code	出错类型（没用到）
+ * 2. 若是由于进程动态申请内存页面，读操作只读映射共享的零页面，写操作才映射一页物理内存页。
+ * 3. 否则从页面高速缓冲中取得执行文件或库文件中相应的页面(不在缓冲中才从文件读入)，映射
+ *    到指定线性地址处。
+ * @param[in]	error_code	出错类型(位1为1表示写操作)
  * @param[in]	address		产生异常的页面线性地址(CR2寄存器的值)
  * @return		void
  */
 void do_no_page(unsigned long error_code, unsigned long address)
 {
-	int nr[4];
 	unsigned long tmp;
 	unsigned long page;
 	int block, i;
 	struct m_inode * inode;
+	struct vm_area_struct * vma;
 
-	if (address < TASK_SIZE)
+	if (address < USER_BASE)
 		printk("\n\rBAD!! KERNEL PAGE MISSING\n\r");
 
 	if (address - current->start_code > TASK_SIZE) {
 		printk("Bad things happen: nonexistent page error in do_no_page\n\r");
 		do_exit(SIGSEGV);
 	}
+	/* 下面要修改页表项，页表被共享时先复制一份 */
+	own_page_table(address);
 	/* 1.所缺页在交换设备中，从交换设备读页面 */
-	page = *(unsigned long *) ((address >> 20) & 0xffc);	/* 取目录项内容 */
+	page = task_pg_dir(current)[address >> 22];			/* 取目录项内容 */
 	if (page & 1) { /* 存在位P */
 		page &= 0xfffff000;
 		page += (address >> 10) & 0xffc;
 		tmp = *(unsigned long *) page;						/* 取页表项内容 */
-		if (tmp && !(1 & tmp)) {
+		/* 被回收的干净页面：计入重新调入的次数，然后像从未调入过一样处理 */
+		if (tmp == PAGE_DROPPED) {
+			swap_stat.refaults++;
+			*(unsigned long *) page = 0;
+		} else if (tmp && !(1 & tmp)) {
 			swap_in((unsigned long *) page);
 			return;
 		}
@@ -616,6 +901,10 @@ void do_no_page(unsigned long error_code, unsigned long address)
 	 间位置，获取i节点和块号，用于之后从文件中加载页面 */
 	address &= 0xfffff000;
 	tmp = address - current->start_code;
+	if ((vma = find_vma(current, tmp))) {	/* 缺页在mmap()映射区中 */
+		do_mmap_page(vma, error_code, address, tmp);
+		return;
+	}
 	if (tmp >= LIBRARY_OFFSET ) { 		/* 缺页在库映像文件中 */
 		inode = current->library;
 		block = 1 + (tmp - LIBRARY_OFFSET) / BLOCK_SIZE;
@@ -627,37 +916,42 @@ void do_no_page(unsigned long error_code, unsigned long address)
 		block = 0;
 	}
 
-	/* 2. 缺页为动态申请的内存页面，则直接申请一页物理内存页面并映射到线性地址address即可 */
+	/* 2. 缺页为动态申请的内存页面。读缺页映射零页面，否则直接申请一页物理内存页面并映射到线性地址
+	 address即可 */
 	if (!inode) {
+		if (!(error_code & 2) && put_zero_page(address))
+			return;
 		get_empty_page(address);
 		return;
 	}
 	
-	/* 3. 缺页在进程执行文件或库文件范围内，尝试共享页面操作 */
-	if (share_page(inode, tmp))
-		return;
-	
-	/* 4. 共享不成功就只能申请一页物理内存页面page，然后读取执行文件中的相应页面并映射到逻辑地址tmp处 */
-	if (!(page = get_free_page()))
+	/* 3. 缺页在进程执行文件或库文件范围内，从页面高速缓冲中取得该页(不在缓冲中则读入)。记住，
+	 程序头占用1个数据块（用于解释上面 block = 1+ ...） */
+	if (!(page = get_cache_page(inode, block)))
 		oom();
-	/* remember that 1 block is used for header */
-	/* 记住，程序头占用1个数据块（用于解释上面 block = 1+ ...） */
-	for (i = 0 ; i < 4 ; block++, i++)
-		nr[i] = bmap(inode, block); /* 获取设备逻辑块号 */
-	bread_page(page, inode->i_dev, nr);
 
 	/* 读取执行程序最后一页（实际不满一页），把超出end_data后的部分进行清零处理，若该页面离执行程序末端
-	 超过1页，说明是从库文件中读取的，因此不用执行清零操作 */
+	 超过1页，说明是从库文件中读取的，因此不用执行清零操作。要清零的页面不能与缓冲共享，复制一份 */
 	i = tmp + 4096 - current->end_data;
 	if (i > 4095)
 		i = 0;
-	tmp = page + 4096;
-	while (i-- > 0) {
-		tmp--;
-		*(char *)tmp = 0;
-	}
-	/* 把引起缺页异常的一页物理页面映射到指定线性地址address处 */
-	if (put_page(page, address))
+	if (i > 0) {
+		if (!(tmp = get_free_page())) {
+			free_page(page);
+			oom();
+		}
+		copy_page(page, tmp);
+		free_page(page);
+		page = tmp;
+		tmp = page + 4096;
+		while (i-- > 0) {
+			tmp--;
+			*(char *)tmp = 0;
+		}
+		if (put_page(page, address))
+			return;
+	/* 其余页面与缓冲共享，只读映射到线性地址address处，写时由do_wp_page()复制 */
+	} else if (put_cache_page(page, address, 0))
 		return;
 	/* 否则释放物理页面，显示内存不够 */
 	free_page(page);
@@ -665,20 +959,60 @@ void do_no_page(unsigned long error_code, unsigned long address)
 }
 
 
+/**
+ * 恒等映射16MB以上的物理内存
+ * boot/head.s只映射了前16MB，这里从start_mem处取页面作为页表，把16MB ~ end_mem映射到内核线性
+ * 空间的同样位置(页目录项4 ~ (end_mem>>22))。以后新建的页目录都复制这些目录项。
+ * @param[in]	start_mem	主内存区的开始地址(在前16MB中)
+ * @param[in]	end_mem		物理内存的结束地址(不超过MAX_MEMORY)
+ * @return		页表之后的主内存区开始地址
+ */
+long paging_init(long start_mem, long end_mem)
+{
+	unsigned long * pg_table;
+	unsigned long addr;
+	int i;
+
+	start_mem = (start_mem + 4095) & ~4095;
+	for (addr = 16 * 1024 * 1024 ; addr < end_mem ; addr += 4 * 1024 * 1024) {
+		/* 页表本身必须位于head.s已映射的前16MB内，否则写页表时就会缺页 */
+		if (start_mem + 4096 > 16 * 1024 * 1024)
+			panic("paging_init: page tables above 16MB");
+		pg_table = (unsigned long *) start_mem;
+		start_mem += 4096;
+		for (i = 0 ; i < 1024 ; i++) {
+			pg_table[i] = (addr + (i << 12) < end_mem) ? (addr + (i << 12)) | 7 : 0;
+		}
+		pg_dir[addr >> 22] = (unsigned long) pg_table | 7;
+	}
+	invalidate();
+	return start_mem;
+}
+
 /**
  * 物理内存管理初始化
  * 该函数对1MB以上内存区域以页面为单位进行管理前的初始化设置工作，一个页面长度为4KB，并使用一个页
- * 面映射字节数组mem_map[]来管理所有这些页面。
+ * 面映射数组mem_map[]来管理所有这些页面。mem_map[]和伙伴系统的free_order[]按内存容量从主
+ * 内存区开头分配。
  * @param[in]	start_mem	主内存区的开始地址
  * @param[in]	end_mem		主内存区的结束地址
- * @return		void
+ * @return		分配了管理数组之后的主内存区开始地址
  */
-void mem_init(long start_mem, long end_mem)
+long mem_init(long start_mem, long end_mem)
 {
-	int i;
+	int i, j;
 
-	/* 首先，将1MB到16MB范围内的内存页面对应的数组项置为USED(100)，即已占用状态 */
+	if (ZERO_PAGE >= LOW_MEM)
+		panic("empty_zero_page above LOW_MEM");
+	for (i = 0 ; i < 1024 ; i++)
+		empty_zero_page[i] = 0;
 	HIGH_MEMORY = end_mem;			/* 设置内存最高端 */
+	paging_pages = (end_mem - LOW_MEM) >> 12;
+	mem_map = (unsigned short *) start_mem;
+	free_order = (unsigned char *) (mem_map + paging_pages);
+	start_mem = (start_mem + 3 * paging_pages + 4095) & ~4095;
+
+	/* 首先，将1MB到内存高端范围内的内存页面对应的数组项置为USED，即已占用状态 */
 	for (i = 0; i < PAGING_PAGES; i++) {
 		mem_map[i] = USED;
 	}
@@ -690,10 +1024,18 @@ void mem_init(long start_mem, long end_mem)
 	end_mem -= start_mem;
 	end_mem >>= 12;
 
-	/* 将主内存区对应的页面的使用数置0，即未使用 */
+	/* 将主内存区对应的页面的使用数置0，即未使用，并放入伙伴系统的空闲链表 */
+	for (j = 0 ; j < PAGING_PAGES ; j++) {
+		free_order[j] = NOT_FREE;
+	}
+	for (j = 0 ; j < NR_MEM_LISTS ; j++) {
+		free_area[j].next = free_area[j].prev = free_area + j;
+	}
 	while (end_mem-- > 0) {
-		mem_map[i++] = 0;
+		mem_map[i] = 0;
+		buddy_free(i++, 0);
 	}
+	return start_mem;
 }
 
 
@@ -701,7 +1043,7 @@ void mem_init(long start_mem, long end_mem)
 /* 显示系统内存信息（在chr_drv/keyboard.S中被调用） */
 void show_mem(void)
 {
-	int i, j, k, free = 0, total = 0;
+	int i, j, k, n, free = 0, total = 0;
 	int shared = 0;
 	unsigned long * pg_tbl;
 
@@ -716,41 +1058,54 @@ void show_mem(void)
 			free ++;
 		}
 		else {
-			shared += mem_map[i] - 1;/* 共享的页面数(字节值>1) */
+			shared += mem_map[i] - 1;/* 共享的页面数(计数值>1) */
 		}
 	}
 	printk("%d free pages of %d\n\r", free, total);
 	printk("%d pages shared\n\r", shared);
-	/* 统计分页管理的逻辑页面数 */
-	k = 0;		/* 一个进程占用页面统计值 */
-	for (i = 4; i < 1024; ) { 	/*页目录表前4项供内核代码使用，不列为统计范围 */
-		if (1 & pg_dir[i]) {
-			if (pg_dir[i] > HIGH_MEMORY) {	/* 目录项内容不正常 */
-				printk("page directory[%d]: %08X\n\r", i, pg_dir[i]);
+	/* 伙伴系统各阶的空闲块数，用来观察碎片情况 */
+	printk("Free blocks:");
+	for (i = 0 ; i < NR_MEM_LISTS ; i++) {
+		printk(" %d*%dkB", nr_free[i], 4 << i);
+	}
+	printk("\n\r");
+	printk("Reclaim: %d scanned, %d reclaimed, %d swapped, %d refaults\n\r",
+		swap_stat.scanned, swap_stat.reclaimed, swap_stat.swapped, swap_stat.refaults);
+	printk("Swap I/O: %d writes, %d reads, %d read ahead, %d cache hits\n\r",
+		swap_stat.swap_writes, swap_stat.swap_reads, swap_stat.readahead, swap_stat.cache_hits);
+	printk("Zero page: %d read faults mapped\n\r", zero_page_maps);
+	zero_pages_show();
+	kmem_cache_show();
+	/* 统计各进程占用的页面数 */
+	for (n = 1 ; n < NR_TASKS ; n++) {
+		if (!task[n]) {
+			continue;
+		}
+		k = 1;		/* 页目录 */
+		for (i = USER_BASE >> 22 ; i < 1024 ; i++) {
+			if (!(1 & task_pg_dir(task[n])[i])) {
 				continue;
 			}
-			if (pg_dir[i] > LOW_MEM) {
-				free ++, k ++;		/* 统计页表占用页面 */
+			if (task_pg_dir(task[n])[i] > HIGH_MEMORY) {	/* 目录项内容不正常 */
+				printk("page directory[%d]: %08X\n\r", i, task_pg_dir(task[n])[i]);
+				continue;
 			}
-			pg_tbl = (unsigned long *) (0xfffff000 & pg_dir[i]);
+			k ++;		/* 统计页表占用页面 */
+			pg_tbl = (unsigned long *) (0xfffff000 & task_pg_dir(task[n])[i]);
 			for (j = 0 ; j < 1024 ; j++) {
 				if ((pg_tbl[j]&1) && pg_tbl[j] > LOW_MEM){
 					if (pg_tbl[j] > HIGH_MEMORY){ /* 页表项内容不正常 */
 						printk("page_dir[%d][%d]: %08X\n\r", i, j, pg_tbl[j]);
 					}
 					else{
-						k ++, free ++;	/* 统计页表项对应页面 */
+						k ++;	/* 统计页表项对应页面 */
 					}
 				}
 			}
 		}
-		i++;
-		/* 每个任务线性空间长度是64MB，每统计了16个目录项就统计了一个任务占用的页表 */
-		if (!(i & 15) && k) {	/* k=0说明对应的任务没有创建或者已经终止 */
-			k ++, free ++;		/* one page/process for task_struct */
-			printk("Process %d: %d pages\n\r", (i >> 4) - 1, k);
-			k = 0;
-		}
+		k ++;		/* one page/process for task_struct */
+		free += k;
+		printk("Process %d: %d pages\n\r", n, k);
 	}
 	printk("Memory found: %d (%d)\n\r\n\r", free - shared, total);
 }
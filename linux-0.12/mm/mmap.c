@@ -0,0 +1,394 @@
+/*
+ *  linux/mm/mmap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * 内存映射。进程的映射区(vm_area_struct)按地址排序挂在task_struct的mmap链表上，都位于进程空间
+ * 的[MMAP_BASE, MMAP_TOP)之间。映射区中的页面由do_no_page()按需调入：匿名映射与动态申请的内存
+ * 一样处理，文件映射经页面高速缓冲(bmap()/bread_page())读入。
+ *
+ * MAP_SHARED映射的就是页面高速缓冲中的页面，映射同一文件同一位置的进程以及read()/write()共享它
+ * 们。被写过的页面(页表项中的脏位)在msync()、munmap()和进程退出或执行新程序时交回页面高速缓冲，
+ * 由回写写入文件。文件中超出文件长度的部分读出
+ * 为0，写入的内容不会写回，也不会改变文件长度。
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/segment.h>
+
+static struct kmem_cache * vma_cache = NULL;
+
+/* 建立映射区结构的slab缓存(在kmem_cache_init()之后调用) */
+void mmap_init(void)
+{
+	if (!(vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area_struct), NULL))) {
+		panic("Out of memory in mmap_init()");
+	}
+}
+
+static struct vm_area_struct * alloc_vma(void)
+{
+	return (struct vm_area_struct *) kmem_cache_alloc(vma_cache);
+}
+
+static void free_vma(struct vm_area_struct * vma)
+{
+	iput(vma->vm_inode);
+	kmem_cache_free(vma_cache, vma);
+}
+
+/**
+ * 查找进程中包含地址addr的映射区
+ * @param[in]	p		任务结构指针
+ * @param[in]	addr	进程空间中的地址
+ * @retval		映射区指针，不在映射区中返回NULL
+ */
+struct vm_area_struct * find_vma(struct task_struct * p, unsigned long addr)
+{
+	struct vm_area_struct * vma;
+
+	if (addr < MMAP_BASE || addr >= MMAP_TOP) {
+		return NULL;
+	}
+	for (vma = p->mmap ; vma && vma->vm_start <= addr ; vma = vma->vm_next) {
+		if (addr < vma->vm_end) {
+			return vma;
+		}
+	}
+	return NULL;
+}
+
+/* 把映射区按地址顺序插入当前进程的链表 */
+static void insert_vma(struct vm_area_struct * vma)
+{
+	struct vm_area_struct ** p;
+
+	for (p = &current->mmap ; *p && (*p)->vm_start < vma->vm_start ; p = &(*p)->vm_next)
+		/* nothing */ ;
+	vma->vm_next = *p;
+	*p = vma;
+}
+
+/* 在映射区中找一段长len的空闲地址(首次适配)，没有返回0 */
+static unsigned long get_unmapped_area(unsigned long len)
+{
+	struct vm_area_struct * vma;
+	unsigned long addr = MMAP_BASE;
+
+	for (vma = current->mmap ; vma ; vma = vma->vm_next) {
+		if (addr + len <= vma->vm_start) {
+			break;
+		}
+		if (vma->vm_end > addr) {
+			addr = vma->vm_end;
+		}
+	}
+	return (addr + len <= MMAP_TOP) ? addr : 0;
+}
+
+/* 把不在页面高速缓冲中的页面的内容写回文件中从offset开始的各块(不超过文件长度) */
+static void write_file_page(struct m_inode * inode, unsigned long offset, unsigned long page)
+{
+	struct buffer_head * bh;
+	unsigned long block = offset / BLOCK_SIZE;
+	int i, nr;
+
+	for (i = 0 ; i < PAGE_SIZE / BLOCK_SIZE ; i++, offset += BLOCK_SIZE) {
+		if (offset >= inode->i_size) {
+			break;
+		}
+		if (!(nr = create_block(inode, offset / BLOCK_SIZE)) ||
+			!(bh = bread(inode->i_dev, nr))) {
+			break;
+		}
+		memcpy(bh->b_data, (char *) page + i * BLOCK_SIZE, BLOCK_SIZE);
+		bh->b_dirt = 1;
+		brelse(bh);
+	}
+	invalidate_block_pages(inode, block, PAGE_SIZE / BLOCK_SIZE);
+	inode->i_mtime = CURRENT_TIME;
+	inode->i_dirt = 1;
+}
+
+/*
+ * 把MAP_SHARED映射区中[start, end)内被写过的页面交回页面高速缓冲，标记为脏后由回写写入文件；页
+ * 面不在缓冲中时才直接写回文件。页表可能与子进程共享，但共享者映射的是同样的页面，所以直接清除
+ * 脏位即可。写回时可能睡眠，期间保持对页面的引用。
+ */
+static void sync_range(struct vm_area_struct * vma, unsigned long start, unsigned long end)
+{
+	unsigned long * dir, * pte, page, offset;
+
+	while (start < end) {
+		dir = task_pg_dir(current) + ((current->start_code + start) >> 22);
+		if (!(1 & *dir)) {		/* 页表不存在，跳到下一个页表 */
+			start = (start + 0x400000) & 0xffc00000;
+			continue;
+		}
+		pte = (unsigned long *) (0xfffff000 & *dir) + ((start >> 12) & 0x3ff);
+		if ((*pte & (PAGE_DIRTY | PAGE_PRESENT)) == (PAGE_DIRTY | PAGE_PRESENT)) {
+			*pte &= ~PAGE_DIRTY;
+			invalidate();
+			page = *pte & 0xfffff000;
+			offset = vma->vm_offset + start - vma->vm_start;
+			if (set_page_dirty(vma->vm_inode, offset / BLOCK_SIZE, page)) {
+				start += PAGE_SIZE;
+				continue;
+			}
+			mem_map[MAP_NR(page)]++;
+			write_file_page(vma->vm_inode, offset, page);
+			free_page(page);
+		}
+		start += PAGE_SIZE;
+	}
+}
+
+/* 取消当前进程[addr, addr+len)内的映射，共享映射先写回文件 */
+static int do_munmap(unsigned long addr, unsigned long len)
+{
+	struct vm_area_struct * vma, * tail, ** p;
+	unsigned long end = addr + len, start, stop;
+
+	for (p = &current->mmap ; (vma = *p) && vma->vm_start < end ; ) {
+		if (vma->vm_end <= addr) {
+			p = &vma->vm_next;
+			continue;
+		}
+		start = (vma->vm_start > addr) ? vma->vm_start : addr;
+		stop = (vma->vm_end < end) ? vma->vm_end : end;
+		/* 从中间挖掉一段，后面剩下的部分成为新的映射区 */
+		if (start > vma->vm_start && stop < vma->vm_end) {
+			if (!(tail = alloc_vma())) {
+				return -ENOMEM;
+			}
+			*tail = *vma;
+			tail->vm_start = stop;
+			tail->vm_offset += stop - vma->vm_start;
+			if (tail->vm_inode) {
+				tail->vm_inode->i_count++;
+			}
+			vma->vm_next = tail;
+		}
+		if (vma->vm_flags & VM_SHARED) {
+			sync_range(vma, start, stop);
+		}
+		zap_page_range(current->start_code + start, stop - start);
+		if (start == vma->vm_start && stop == vma->vm_end) {
+			*p = vma->vm_next;
+			free_vma(vma);
+			continue;
+		}
+		if (start == vma->vm_start) {
+			vma->vm_offset += stop - start;
+			vma->vm_start = stop;
+		} else {
+			vma->vm_end = start;
+		}
+		p = &vma->vm_next;
+	}
+	return 0;
+}
+
+/**
+ * 建立内存映射
+ * @param[in]	buffer	用户空间中依次存放addr、len、prot、flags、fd、off的数组
+ * @retval		映射区的起始地址，失败返回出错号
+ */
+int sys_mmap(unsigned long * buffer)
+{
+	unsigned long addr, len, off;
+	int prot, flags, fd, error;
+	struct file * file;
+	struct m_inode * inode = NULL;
+	struct vm_area_struct * vma;
+
+	addr = get_fs_long(buffer);
+	len = get_fs_long(buffer + 1);
+	prot = get_fs_long(buffer + 2);
+	flags = get_fs_long(buffer + 3);
+	fd = get_fs_long(buffer + 4);
+	off = get_fs_long(buffer + 5);
+	/* vfork()的子进程借用的是父进程的映射 */
+	if (current->flags & PF_VFORK) {
+		return -EINVAL;
+	}
+	if (!len || (addr & 0xfff) || (off & 0xfff)) {
+		return -EINVAL;
+	}
+	len = (len + 0xfff) & ~0xfff;
+	if (len > MMAP_TOP - MMAP_BASE) {
+		return -ENOMEM;
+	}
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+		case MAP_SHARED:
+		case MAP_PRIVATE:
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (flags & MAP_ANONYMOUS) {
+		/* 共享的匿名页面在fork()后无法保持共享，不支持 */
+		if (flags & MAP_SHARED) {
+			return -EINVAL;
+		}
+	} else {
+		if (fd < 0 || fd >= NR_OPEN || !(file = current->filp[fd]) ||
+			!(inode = file->f_inode)) {
+			return -EBADF;
+		}
+		if (!S_ISREG(inode->i_mode)) {
+			return -ENODEV;
+		}
+		if ((file->f_flags & O_ACCMODE) == O_WRONLY) {
+			return -EACCES;
+		}
+		if ((flags & MAP_SHARED) && (prot & PROT_WRITE) &&
+			(file->f_flags & O_ACCMODE) == O_RDONLY) {
+			return -EACCES;
+		}
+	}
+	if (flags & MAP_FIXED) {
+		if (addr < MMAP_BASE || addr > MMAP_TOP - len) {
+			return -EINVAL;
+		}
+	} else if (!(addr = get_unmapped_area(len))) {
+		return -ENOMEM;
+	}
+	if (!(vma = alloc_vma())) {
+		return -ENOMEM;
+	}
+	if ((flags & MAP_FIXED) && (error = do_munmap(addr, len))) {
+		kmem_cache_free(vma_cache, vma);
+		return error;
+	}
+	vma->vm_start = addr;
+	vma->vm_end = addr + len;
+	vma->vm_offset = off;
+	vma->vm_inode = inode;
+	if (inode) {
+		inode->i_count++;
+	}
+	vma->vm_flags = 0;
+	if (prot & (PROT_READ | PROT_EXEC)) {
+		vma->vm_flags |= VM_READ;
+	}
+	if (prot & PROT_WRITE) {
+		vma->vm_flags |= VM_WRITE;
+	}
+	if (flags & MAP_SHARED) {
+		vma->vm_flags |= VM_SHARED;
+	}
+	insert_vma(vma);
+	return addr;
+}
+
+/**
+ * 取消内存映射
+ * @param[in]	addr	起始地址(页面对齐)
+ * @param[in]	len		长度
+ * @retval		成功返回0，失败返回出错号
+ */
+int sys_munmap(unsigned long addr, size_t len)
+{
+	if (current->flags & PF_VFORK) {
+		return -EINVAL;
+	}
+	if (!len || (addr & 0xfff)) {
+		return -EINVAL;
+	}
+	len = (len + 0xfff) & ~0xfff;
+	if (addr < MMAP_BASE || len > MMAP_TOP - MMAP_BASE || addr > MMAP_TOP - len) {
+		return -EINVAL;
+	}
+	return do_munmap(addr, len);
+}
+
+/**
+ * 把共享映射中被写过的页面写回文件
+ * @param[in]	addr	起始地址(页面对齐)
+ * @param[in]	len		长度
+ * @param[in]	flags	MS_ASYNC、MS_SYNC，以及MS_INVALIDATE
+ * @retval		成功返回0，失败返回出错号
+ */
+int sys_msync(unsigned long addr, size_t len, int flags)
+{
+	struct vm_area_struct * vma;
+	unsigned long end;
+
+	if ((addr & 0xfff) || (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)) ||
+		((flags & MS_ASYNC) && (flags & MS_SYNC))) {
+		return -EINVAL;
+	}
+	end = addr + ((len + 0xfff) & ~0xfff);
+	for (vma = current->mmap ; vma && vma->vm_start < end ; vma = vma->vm_next) {
+		if (vma->vm_end <= addr || !(vma->vm_flags & VM_SHARED)) {
+			continue;
+		}
+		sync_range(vma, (vma->vm_start > addr) ? vma->vm_start : addr,
+			(vma->vm_end < end) ? vma->vm_end : end);
+		if (flags & MS_SYNC) {
+			sync_dev(vma->vm_inode->i_dev);
+		}
+	}
+	return 0;
+}
+
+/**
+ * 为fork()出的子进程复制映射区链表(页面由copy_page_tables()处理)
+ * @param[in]	p		子进程任务结构指针，其mmap仍是从父进程复制来的值
+ * @retval		成功返回0，内存不够返回-ENOMEM
+ */
+int copy_mmap(struct task_struct * p)
+{
+	struct vm_area_struct * vma, * new, ** tail = &p->mmap;
+
+	p->mmap = NULL;
+	for (vma = current->mmap ; vma ; vma = vma->vm_next) {
+		if (!(new = alloc_vma())) {
+			while ((new = p->mmap)) {
+				p->mmap = new->vm_next;
+				free_vma(new);
+			}
+			return -ENOMEM;
+		}
+		*new = *vma;
+		new->vm_next = NULL;
+		if (new->vm_inode) {
+			new->vm_inode->i_count++;
+		}
+		*tail = new;
+		tail = &new->vm_next;
+	}
+	return 0;
+}
+
+/**
+ * 释放当前进程的所有映射区(进程退出或执行新程序时，在释放页表之前调用)
+ * 共享映射中被写过的页面写回文件。
+ * @retval		void
+ */
+void exit_mmap(void)
+{
+	struct vm_area_struct * vma;
+
+	if (current->flags & PF_VFORK) {
+		current->mmap = NULL;
+		return;
+	}
+	while ((vma = current->mmap)) {
+		if (vma->vm_flags & VM_SHARED) {
+			sync_range(vma, vma->vm_start, vma->vm_end);
+		}
+		current->mmap = vma->vm_next;
+		free_vma(vma);
+	}
+}
@@ -0,0 +1,304 @@
+/*
+ *  linux/mm/slab.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * slab对象缓存。每种内核对象(如select的等待表)建立一个有名字的缓存，缓存由若干slab组成，每个
+ * slab占一个物理页面：页面开头是slab头和空闲对象下标数组，后面是大小相同的对象。
+ *
+ * 每个缓存的slab按使用情况分别挂在部分使用、全满、全空三个链表上，分配时从部分使用(其次是全空)
+ * 的slab中取，释放时根据对象地址直接找到所在页面的slab头，都是O(1)。对象的空闲链表放在slab头
+ * 之后的下标数组里而不是对象本身中，所以构造函数设置好的对象内容在释放后仍然保留，调用者释放对象
+ * 前应使其恢复到构造后的状态。
+ *
+ * 全空的slab保留在缓存中以便再次分配，内存不够时由get_free_pages()调用kmem_cache_reap()把它们
+ * 的页面还给系统。
+ *
+ * 分配和释放只在修改链表时短暂关中断。缓存需要增加slab时要申请页面，可能睡眠，所以不能在中断处
+ * 理过程中从空的缓存中分配对象。
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+#define SLAB_PARTIAL	0		/* 部分对象在使用 */
+#define SLAB_FULL		1		/* 全部对象在使用 */
+#define SLAB_EMPTY		2		/* 没有对象在使用 */
+#define NR_SLAB_LISTS	3
+
+#define BUFCTL_END		0xffff	/* 空闲对象链表结束 */
+
+/* slab头，位于slab页面的开头，其后是c_num个空闲对象下标，再后面是对象 */
+struct slab {
+	struct slab * s_next;				/* 所在链表中的下一个slab */
+	struct slab * s_prev;
+	struct kmem_cache * s_cache;		/* 所属缓存 */
+	char * s_mem;						/* 第一个对象的地址 */
+	unsigned short s_inuse;				/* 正在使用的对象数 */
+	unsigned short s_free;				/* 第一个空闲对象的下标 */
+	unsigned char s_list;				/* 所在链表 */
+};
+
+#define slab_bufctl(s)	((unsigned short *) ((s) + 1))
+
+struct kmem_cache {
+	const char * c_name;				/* 缓存名字 */
+	unsigned short c_size;				/* 对象大小(按4字节对齐) */
+	unsigned short c_num;				/* 每个slab中的对象数 */
+	unsigned short c_offset;			/* 第一个对象在slab页面中的偏移 */
+	void (*c_ctor)(void *);				/* 对象构造函数，新建slab时对每个对象调用一次 */
+	struct slab * c_lists[NR_SLAB_LISTS];
+	unsigned long c_active;				/* 正在使用的对象数 */
+	unsigned long c_slabs;				/* slab(页面)数 */
+	unsigned long c_allocs;				/* 累计分配次数 */
+	unsigned long c_grown;				/* 累计新建的slab数 */
+	unsigned long c_reaped;				/* 累计回收的slab数 */
+	struct kmem_cache * c_next;			/* 所有缓存的链表 */
+};
+
+/* 缓存描述符本身也从一个缓存中分配 */
+static struct kmem_cache cache_cache;
+static struct kmem_cache * cache_chain = &cache_cache;
+
+/* 把slab挂到缓存的list链表头(须已关中断) */
+static inline void slab_link(struct kmem_cache * cachep, struct slab * s, int list)
+{
+	s->s_prev = NULL;
+	if ((s->s_next = cachep->c_lists[list])) {
+		s->s_next->s_prev = s;
+	}
+	cachep->c_lists[list] = s;
+	s->s_list = list;
+}
+
+/* 把slab从所在链表中取下(须已关中断) */
+static inline void slab_unlink(struct kmem_cache * cachep, struct slab * s)
+{
+	if (s->s_next) {
+		s->s_next->s_prev = s->s_prev;
+	}
+	if (s->s_prev) {
+		s->s_prev->s_next = s->s_next;
+	} else {
+		cachep->c_lists[s->s_list] = s->s_next;
+	}
+}
+
+/* 设置缓存描述符：计算每个slab能放多少个对象 */
+static void cache_setup(struct kmem_cache * cachep, const char * name, int size,
+	void (*ctor)(void *))
+{
+	int num, offset;
+
+	size = (size + 3) & ~3;
+	num = (PAGE_SIZE - sizeof(struct slab)) / (size + sizeof(unsigned short));
+	for (;;) {
+		offset = (sizeof(struct slab) + num * sizeof(unsigned short) + 7) & ~7;
+		if (offset + num * size <= PAGE_SIZE) {
+			break;
+		}
+		num--;
+	}
+	cachep->c_name = name;
+	cachep->c_size = size;
+	cachep->c_num = num;
+	cachep->c_offset = offset;
+	cachep->c_ctor = ctor;
+	for (num = 0 ; num < NR_SLAB_LISTS ; num++) {
+		cachep->c_lists[num] = NULL;
+	}
+	cachep->c_active = cachep->c_slabs = 0;
+	cachep->c_allocs = cachep->c_grown = cachep->c_reaped = 0;
+	cachep->c_next = NULL;
+}
+
+/* 为缓存新建一个slab，成功返回1 */
+static int cache_grow(struct kmem_cache * cachep)
+{
+	struct slab * s;
+	unsigned short * bufctl;
+	unsigned long flags;
+	int i;
+
+	if (!(s = (struct slab *) get_free_page())) {
+		return 0;
+	}
+	s->s_cache = cachep;
+	s->s_mem = (char *) s + cachep->c_offset;
+	s->s_inuse = 0;
+	s->s_free = 0;
+	bufctl = slab_bufctl(s);
+	for (i = 0 ; i < cachep->c_num ; i++) {
+		bufctl[i] = i + 1;
+		if (cachep->c_ctor) {
+			cachep->c_ctor(s->s_mem + i * cachep->c_size);
+		}
+	}
+	bufctl[cachep->c_num - 1] = BUFCTL_END;
+	save_flags(flags);
+	cli();
+	slab_link(cachep, s, SLAB_EMPTY);
+	cachep->c_slabs++;
+	cachep->c_grown++;
+	restore_flags(flags);
+	return 1;
+}
+
+/**
+ * 建立一个对象缓存
+ * @param[in]	name	缓存名字(统计信息中显示，须是常量字符串)
+ * @param[in]	size	对象大小，不能超过一页减去slab头的大小
+ * @param[in]	ctor	对象构造函数，可以为NULL
+ * @retval		缓存指针，失败返回NULL
+ */
+struct kmem_cache * kmem_cache_create(const char * name, int size, void (*ctor)(void *))
+{
+	struct kmem_cache * cachep;
+	unsigned long flags;
+
+	if (size <= 0 || size > PAGE_SIZE - sizeof(struct slab) - sizeof(unsigned short)) {
+		printk("kmem_cache_create: bad size %d for %s\n\r", size, name);
+		return NULL;
+	}
+	if (!(cachep = (struct kmem_cache *) kmem_cache_alloc(&cache_cache))) {
+		return NULL;
+	}
+	cache_setup(cachep, name, size, ctor);
+	save_flags(flags);
+	cli();
+	cachep->c_next = cache_chain;
+	cache_chain = cachep;
+	restore_flags(flags);
+	return cachep;
+}
+
+/**
+ * 从缓存中分配一个对象
+ * @param[in]	cachep	缓存指针
+ * @retval		对象指针(已构造)，内存不够返回NULL
+ */
+void * kmem_cache_alloc(struct kmem_cache * cachep)
+{
+	struct slab * s;
+	unsigned long flags;
+	void * obj;
+
+	for (;;) {
+		save_flags(flags);
+		cli();
+		if ((s = cachep->c_lists[SLAB_PARTIAL]) || (s = cachep->c_lists[SLAB_EMPTY])) {
+			break;
+		}
+		restore_flags(flags);
+		if (!cache_grow(cachep)) {
+			return NULL;
+		}
+	}
+	obj = s->s_mem + s->s_free * cachep->c_size;
+	s->s_free = slab_bufctl(s)[s->s_free];
+	if (++s->s_inuse == cachep->c_num) {
+		slab_unlink(cachep, s);
+		slab_link(cachep, s, SLAB_FULL);
+	} else if (s->s_list == SLAB_EMPTY) {
+		slab_unlink(cachep, s);
+		slab_link(cachep, s, SLAB_PARTIAL);
+	}
+	cachep->c_active++;
+	cachep->c_allocs++;
+	restore_flags(flags);
+	return obj;
+}
+
+/**
+ * 把对象释放回缓存
+ * @param[in]	cachep	缓存指针
+ * @param[in]	obj		对象指针
+ * @retval		void
+ */
+void kmem_cache_free(struct kmem_cache * cachep, void * obj)
+{
+	struct slab * s;
+	unsigned long flags;
+	int i;
+
+	s = (struct slab *) ((unsigned long) obj & 0xfffff000);
+	if (s->s_cache != cachep) {
+		panic("kmem_cache_free: object not in cache");
+	}
+	i = ((char *) obj - s->s_mem) / cachep->c_size;
+	save_flags(flags);
+	cli();
+	slab_bufctl(s)[i] = s->s_free;
+	s->s_free = i;
+	if (!--s->s_inuse) {
+		slab_unlink(cachep, s);
+		slab_link(cachep, s, SLAB_EMPTY);
+	} else if (s->s_list == SLAB_FULL) {
+		slab_unlink(cachep, s);
+		slab_link(cachep, s, SLAB_PARTIAL);
+	}
+	cachep->c_active--;
+	restore_flags(flags);
+}
+
+/**
+ * 取对象所属的缓存
+ * @param[in]	obj		由kmem_cache_alloc()分配的对象指针
+ * @retval		缓存指针
+ */
+struct kmem_cache * kmem_obj_cache(const void * obj)
+{
+	return ((struct slab *) ((unsigned long) obj & 0xfffff000))->s_cache;
+}
+
+/**
+ * 回收所有缓存中全空的slab，把页面还给系统(内存不够时调用)
+ * @retval		回收的页面数
+ */
+int kmem_cache_reap(void)
+{
+	struct kmem_cache * cachep;
+	struct slab * s;
+	unsigned long flags;
+	int nr = 0;
+
+	for (cachep = cache_chain ; cachep ; cachep = cachep->c_next) {
+		for (;;) {
+			save_flags(flags);
+			cli();
+			if (!(s = cachep->c_lists[SLAB_EMPTY])) {
+				restore_flags(flags);
+				break;
+			}
+			slab_unlink(cachep, s);
+			cachep->c_slabs--;
+			cachep->c_reaped++;
+			restore_flags(flags);
+			free_page((unsigned long) s);
+			nr++;
+		}
+	}
+	return nr;
+}
+
+/* 显示各缓存的使用统计(在show_mem()中调用) */
+void kmem_cache_show(void)
+{
+	struct kmem_cache * cachep;
+
+	printk("cache          size active/total  slabs   allocs grown reaped\n\r");
+	for (cachep = cache_chain ; cachep ; cachep = cachep->c_next) {
+		printk("%-14s %4d %6d/%-6d %5d %8d %5d %6d\n\r", cachep->c_name,
+			cachep->c_size, cachep->c_active, cachep->c_slabs * cachep->c_num,
+			cachep->c_slabs, cachep->c_allocs, cachep->c_grown, cachep->c_reaped);
+	}
+}
+
+/* 初始化缓存描述符的缓存(在mem_init()之后调用) */
+void kmem_cache_init(void)
+{
+	cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), NULL);
+}
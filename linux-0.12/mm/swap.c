@@ -17,6 +17,7 @@
 #include <linux/sched.h>
 #include <linux/head.h>
 #include <linux/kernel.h>
+#include <asm/system.h>
 
 /* 1页(4096B)共有32768个位。最多可管理32768个页面，对应128MB内存容量 */
 #define SWAP_BITS (4096 << 3)
@@ -50,37 +51,148 @@ bitop(clrbit, "r")			/* clrbit(char * addr, unsigned int nr) */
 static char * swap_bitmap = NULL;
 int SWAP_DEV = 0;		/* 内核初始化时设置的交换设备号 */
 
+/*
+ * 交换设备按簇读写：换出时把一批脏页面复制到连续的交换页面中，用一个请求项写出；换入时把同一进程
+ * 用到的相邻交换页面一起读入，多读的页面放在交换页面缓存中，等缺页时直接取用。读写都经过一块连续
+ * 的簇缓冲区，同一时刻只有一个进程使用它，这也保证了读某个交换页面时它的写出已经完成。
+ */
+#define SWAP_CLUSTER_ORDER	3
+#define SWAP_CLUSTER	(1 << SWAP_CLUSTER_ORDER)	/* 一次读写的最大页面数(簇缓冲区大小) */
+#define NR_SWAP_CACHE	32		/* 交换页面缓存项数 */
+
+static int swap_pages = 0;					/* 交换设备的页面数 */
+static int swap_next = 1;					/* 下次分配交换页面开始查找的位置 */
+static int swap_cluster = 1;				/* 簇缓冲区的页面数 */
+static char * swap_buffer = NULL;			/* 簇缓冲区 */
+static int swap_lock = 0;					/* 簇缓冲区(交换设备I/O)正在使用 */
+static struct task_struct * swap_wait = NULL;
+
+/* 预读的交换页面缓存，swap_nr为0表示空闲项。页面的交换页面仍被占用，直到被换入或释放 */
+static struct swap_cache_entry {
+    int swap_nr;
+    unsigned long page;
+} swap_cache[NR_SWAP_CACHE];
+static int swap_cache_hand = 0;				/* 缓存满时轮流替换 */
+
 /*
  * We never page the pages in task[0] - kernel memory.
  * We page all other pages.
  */
 /*
- * 我们从不交换任务0(task[0])的页面，即不交换内核页面，我们只对其他页面进行交换操作。
+ * 我们从不交换任务0(task[0])的页面，即不交换内核页面，我们只对其他页面进行交换操作。每个任务有
+ * 自己的页目录，进程空间是其中USER_BASE ~ USER_BASE+TASK_SIZE对应的目录项。
  */
-/* = 64MB/4KB 第1个虚拟内存页面，即从任务0末端(64MB)处开始的虚拟内存页面 */
-#define FIRST_VM_PAGE (TASK_SIZE >> 12)
+#define FIRST_VM_DIR (USER_BASE >> 22)
+#define LAST_VM_DIR (FIRST_VM_DIR + (TASK_SIZE >> 22))
 
-/* = 4GB/4KB 4G内存空间对应的页数 */
-#define LAST_VM_PAGE (1024 * 1024)
+/* 所有任务进程空间的页数 */
+#define VM_PAGES (NR_TASKS * (TASK_SIZE >> 12))
 
-#define VM_PAGES (LAST_VM_PAGE - FIRST_VM_PAGE)
+/* 锁定簇缓冲区，已被别的进程使用时睡眠等待 */
+static inline void lock_swap(void)
+{
+    cli();
+    while (swap_lock) {
+        sleep_on(&swap_wait);
+    }
+    swap_lock = 1;
+    sti();
+}
+
+static inline void unlock_swap(void)
+{
+    swap_lock = 0;
+    wake_up(&swap_wait);
+}
 
 /**
- * 申请1页交换页面
- * 扫描整个交换映射位图(除对应位图本身的位0以外)，返回值为1的第一个比特位号
- * @param[in]   void
- * @retval      成功返回交换页面号，失败返回0
+ * 申请连续的交换页面
+ * 从上次分配结束的位置开始(next-fit)循环查找，优先找长度为*nr的连续空闲页面，找不到时返回遇
+ * 到的最长的一段。
+ * @param[in/out]	nr		需要的页面数，返回实际分配的页面数
+ * @retval			成功返回第一个交换页面号，失败返回0
  */
-static int get_swap_page(void)
+static int get_swap_pages(int * nr)
 {
-    int nr;
+    int i, n, start, len, best = 0, best_len = 0;
 
     if (!swap_bitmap) {
         return 0;
     }
-    for (nr = 1; nr < SWAP_BITS; nr++) {
-        if (clrbit(swap_bitmap, nr)) {
-            return nr;
+    start = 0;
+    len = 0;
+    for (i = swap_next, n = swap_pages - 1 ; n-- > 0 ; i++) {
+        if (i >= swap_pages) {
+            i = 1;
+            len = 0;        /* 不跨越设备末尾 */
+        }
+        if (!bit(swap_bitmap, i)) {
+            len = 0;
+            continue;
+        }
+        if (!len++) {
+            start = i;
+        }
+        if (len > best_len) {
+            best = start;
+            best_len = len;
+            if (len == *nr) {
+                break;
+            }
+        }
+    }
+    if (!best_len) {
+        return 0;
+    }
+    *nr = best_len;
+    for (i = 0 ; i < best_len ; i++) {
+        clrbit(swap_bitmap, best + i);
+    }
+    swap_next = best + best_len;
+    return best;
+}
+
+/* 在交换页面缓存中查找交换页面swap_nr，找不到返回NULL */
+static struct swap_cache_entry * swap_cache_find(int swap_nr)
+{
+    int i;
+
+    for (i = 0 ; i < NR_SWAP_CACHE ; i++) {
+        if (swap_cache[i].swap_nr == swap_nr) {
+            return swap_cache + i;
+        }
+    }
+    return NULL;
+}
+
+/* 把预读的页面加入交换页面缓存，缓存满时替换掉一项 */
+static void swap_cache_add(int swap_nr, unsigned long page)
+{
+    struct swap_cache_entry * p;
+
+    if (!(p = swap_cache_find(0))) {
+        p = swap_cache + swap_cache_hand;
+        swap_cache_hand = (swap_cache_hand + 1) % NR_SWAP_CACHE;
+        free_page(p->page);
+    }
+    p->swap_nr = swap_nr;
+    p->page = page;
+}
+
+/**
+ * 回收一个交换页面缓存中的页面(在get_free_pages()没有空闲页面时调用)
+ * 交换设备上的数据仍然有效，以后缺页时再读入。
+ * @retval		回收了页面返回1，否则返回0
+ */
+int shrink_swap_cache(void)
+{
+    int i;
+
+    for (i = 0 ; i < NR_SWAP_CACHE ; i++) {
+        if (swap_cache[i].swap_nr) {
+            swap_cache[i].swap_nr = 0;
+            free_page(swap_cache[i].page);
+            return 1;
         }
     }
     return 0;
@@ -95,9 +207,15 @@ static int get_swap_page(void)
  */
 void swap_free(int swap_nr)
 {
+    struct swap_cache_entry * p;
+
     if (!swap_nr) {
         return;
     }
+    if ((p = swap_cache_find(swap_nr))) {
+        p->swap_nr = 0;
+        free_page(p->page);
+    }
     if (swap_bitmap && swap_nr < SWAP_BITS) {
         if (!setbit(swap_bitmap, swap_nr)) {
             return;
@@ -107,17 +225,80 @@ void swap_free(int swap_nr)
     return;
 }
 
+/**
+ * 读交换页面的内容(fork复制页表时调用)，交换页面仍然保留
+ * @param[in]	swap_nr	交换页面号
+ * @param[in]	page	物理页面地址
+ * @retval		void
+ */
+void swap_read_page(int swap_nr, unsigned long page)
+{
+    struct swap_cache_entry * p;
+
+    if ((p = swap_cache_find(swap_nr))) {
+        swap_stat.cache_hits++;
+        memcpy((void *) page, (void *) p->page, PAGE_SIZE);
+        return;
+    }
+    lock_swap();
+    read_swap_page(swap_nr, (char *) page);
+    swap_stat.swap_reads++;
+    unlock_swap();
+}
+
+/**
+ * 选择换入时预读的交换页面范围
+ * 只预读与swap_nr相距不到一簇、并且也被同一页表(同一进程)中的页表项引用的交换页面。
+ * @param[in]	table_ptr	缺页的页表项指针
+ * @param[in]	swap_nr		缺页的交换页面号
+ * @param[out]	want		want[i]为1表示要把交换页面(返回值+i)放入缓存
+ * @retval		预读范围的第一个交换页面号，范围不超过swap_cluster个页面并包含swap_nr
+ */
+static int swap_readaround(unsigned long * table_ptr, int swap_nr, char * want)
+{
+    unsigned long * pg_table = (unsigned long *) ((unsigned long) table_ptr & 0xfffff000);
+    char near[2 * SWAP_CLUSTER];
+    int i, nr, lo, hi;
+
+    memset(near, 0, sizeof(near));
+    for (i = 0 ; i < 1024 ; i++) {
+        if ((pg_table[i] & 1) || !pg_table[i] || pg_table[i] == PAGE_DROPPED) {
+            continue;
+        }
+        nr = (pg_table[i] >> 1) - swap_nr + swap_cluster;
+        if (nr > 0 && nr < 2 * swap_cluster && !swap_cache_find(pg_table[i] >> 1)) {
+            near[nr] = 1;
+        }
+    }
+    /* 从最靠前的一个开始，一簇之内的都读入 */
+    for (lo = 1 ; lo < swap_cluster && !near[lo] ; lo++)
+        /* nothing */ ;
+    hi = swap_cluster;
+    for (i = lo ; i < lo + swap_cluster && i < 2 * swap_cluster ; i++) {
+        if (near[i]) {
+            hi = i;
+        }
+    }
+    for (i = lo ; i <= hi ; i++) {
+        want[i - lo] = near[i] && i != swap_cluster;
+    }
+    return swap_nr - swap_cluster + lo;
+}
+
 /**
  * 把指定页面交换进内存中
  * 把指定页表项的对应页面从交换设备中读入到新申请的内存页面中。修改交换位图中对应位(置位)，同
- * 时修改页表项内容，让它指向该内存页面，并设置相应标志。
+ * 时修改页表项内容，让它指向该内存页面，并设置相应标志。页面已被预读到交换页面缓存中时直接取用，
+ * 否则连同同一进程用到的相邻交换页面一起读入。
  * @param[in]	table_ptr
  * @retval		void
  */
 void swap_in(unsigned long *table_ptr)
 {
-    int swap_nr;
-    unsigned long page;
+    struct swap_cache_entry * p;
+    char want[SWAP_CLUSTER];
+    int swap_nr, first, i;
+    unsigned long page, ra;
 
     if (!swap_bitmap) {
         printk("Trying to swap in without swap bit-map");
@@ -133,10 +314,36 @@ void swap_in(unsigned long *table_ptr)
         printk("No swap page in swap_in\n\r");
         return;
     }
-    if (!(page = get_free_page())) {
-        oom();
+    swap_stat.refaults++;
+    if ((p = swap_cache_find(swap_nr))) {
+        swap_stat.cache_hits++;
+        page = p->page;
+        p->swap_nr = 0;
+    } else {
+        /* 先申请页面：内存不够时要换出页面，也要使用簇缓冲区 */
+        if (!(page = __get_free_page(GFP_NOZERO))) {
+            oom();
+        }
+        lock_swap();
+        memset(want, 0, sizeof(want));
+        first = swap_readaround(table_ptr, swap_nr, want);
+        for (i = swap_cluster ; --i > swap_nr - first && !want[i] ; )
+            /* nothing */ ;
+        /* 读入[first, first+i]，其中至少包含swap_nr */
+        ll_rw_pages(READ, SWAP_DEV, first, i + 1, swap_buffer);
+        swap_stat.swap_reads++;
+        memcpy((void *) page, swap_buffer + ((swap_nr - first) << 12), PAGE_SIZE);
+        for ( ; i >= 0 ; i--) {
+            /* 预读只使用空闲页面，不为此换出别的页面 */
+            if (!want[i] || !(ra = __get_free_pages(0))) {
+                continue;
+            }
+            memcpy((void *) ra, swap_buffer + (i << 12), PAGE_SIZE);
+            swap_cache_add(first + i, ra);
+            swap_stat.readahead++;
+        }
+        unlock_swap();
     }
-    read_swap_page(swap_nr, (char *) page);
     if (setbit(swap_bitmap, swap_nr)) {
         printk("swapping in multiply from same page\n\r");
     }
@@ -144,154 +351,328 @@ void swap_in(unsigned long *table_ptr)
     *table_ptr = page | (PAGE_DIRTY | 7);
 }
 
+/*
+ * 页面回收使用时钟(第二次机会)算法：时钟指针沿页目录和页表循环移动，访问位(PAGE_ACCESSED)被置
+ * 位的页面最近用过，清除访问位后跳过，等指针转回来时还没被访问过才回收。第一圈只回收干净页面(文件
+ * 页面或没写过的页面，直接丢弃即可)，找不到时第二圈才把脏页面写到交换设备。
+ */
+static int swap_task = 0;					/* 时钟指针：任务号 */
+static int dir_entry = LAST_VM_DIR - 1;		/* 时钟指针：页目录项索引 */
+static int page_entry = 1023;				/* 时钟指针：页表项索引 */
+static int need_flush = 0;					/* 清除了访问位，需要刷新TLB */
+
+struct swap_stat swap_stat = {0, };
+
+#define SWAP_SKIP	0		/* 不能回收 */
+#define SWAP_FREED	1		/* 干净页面已释放 */
+#define SWAP_DIRTY	2		/* 可以换出的脏页面，由swap_out()成批写出 */
+
 /**
  * 尝试把页面交换出去(仅在swap_out中被调用)
- * 1. 页面未被修改过，则不必换出，直接释放即可，因为对应页面还可以再直接从相应映像文件中读入
- * 2. 页面被修改过，则尝试换出。
+ * 1. 页面最近被访问过，则清除访问位，给它第二次机会
+ * 2. 页面未被修改过，则不必换出，直接释放即可，因为对应页面还可以再直接从相应映像文件中读入
+ * 3. 页面被修改过并且没有被共享，允许写交换设备时可以换出。MAP_SHARED文件映射的脏页面交回页面
+ *    高速缓冲后释放，由回写写入文件，不会换出。
  * @param[in]   table_ptr   页表项指针
- * @return      页面换或释放成功返回1，失败返回0
+ * @param[in]   dirty_ok    是否可以换出脏页面
+ * @return      SWAP_SKIP, SWAP_FREED或SWAP_DIRTY
  */
-/*static*/ int try_to_swap_out(unsigned long * table_ptr)
+static int try_to_swap_out(unsigned long * table_ptr, int dirty_ok)
 {
-    unsigned long page;
-    unsigned long swap_nr;
+    struct vm_area_struct * vma;
+    unsigned long page, offset;
 
     page = *table_ptr;
     if (!(PAGE_PRESENT & page)) { /* 要换出的页面不存在 */
-        return 0;
+        return SWAP_SKIP;
     }
-    if (page - LOW_MEM > PAGING_MEMORY) { /* 指定物理内存地址高于内存高端或低于LOW_MEM */
-        return 0;
+    if (page - LOW_MEM >= HIGH_MEMORY - LOW_MEM) { /* 指定物理内存地址高于内存高端或低于LOW_MEM */
+        return SWAP_SKIP;
+    }
+    swap_stat.scanned++;
+    if (PAGE_ACCESSED & page) {
+        *table_ptr = page & ~PAGE_ACCESSED;
+        need_flush = 1;
+        return SWAP_SKIP;
     }
     if (PAGE_DIRTY & page) { /* 内存页面已被修改过 */
-        page &= 0xfffff000;
-        if (mem_map[MAP_NR(page)] != 1) {   /* 页面又是被共享的，不宜换出 */
-            return 0;
+        /* MAP_SHARED文件映射的页面属于文件，决不能写到交换设备上 */
+        if ((vma = find_vma(task[swap_task], (dir_entry << 22) + (page_entry << 12)
+                - task[swap_task]->start_code)) && (vma->vm_flags & VM_SHARED)) {
+            offset = vma->vm_offset + (dir_entry << 22) + (page_entry << 12)
+                - task[swap_task]->start_code - vma->vm_start;
+            /* 交回页面高速缓冲后就和干净页面一样释放；不在缓冲中的留到munmap时写回文件 */
+            if (!set_page_dirty(vma->vm_inode, offset / BLOCK_SIZE, page & 0xfffff000)) {
+                return SWAP_SKIP;
+            }
+            goto drop;
         }
-        if (!(swap_nr = get_swap_page())) {
-            return 0;
+        if (!dirty_ok || mem_map[MAP_NR(page)] != 1) {  /* 页面又是被共享的，不宜换出 */
+            return SWAP_SKIP;
         }
-        /* 换出页面的页表项的内容为(swap_nr << 1)|(P = 0) */
-        *table_ptr = swap_nr << 1;
-        invalidate();
-        write_swap_page(swap_nr, (char *) page);
-        free_page(page);
-        return 1;
+        return SWAP_DIRTY;
     }
     /* 执行到这表明页面没有修改过，直接释放即可 */
-    *table_ptr = 0;
+drop:
+    *table_ptr = PAGE_DROPPED;
     invalidate();
-    free_page(page);
-    return 1;
+    free_page(page & 0xfffff000);
+    swap_stat.reclaimed++;
+    return SWAP_FREED;
 }
 
-/*
- * Ok, this has a rather intricate logic - the idea is to make good
- * and fast machine code. If we didn't worry about that, things would
- * be easier.
+/**
+ * 把一批脏页面写到连续的交换页面中(须已锁定簇缓冲区)
+ * 页面内容先复制到簇缓冲区，页表项改为交换页面号后页面就可以释放，然后用一个请求项写出。
+ * @param[in]	victims		页表项指针数组
+ * @param[in]	nr			页面数(不超过swap_cluster)
+ * @retval		换出的页面数
  */
-/*
- * OK,这个函数中有一个非常复杂的逻辑，用于产生逻辑性好并且速度快的机器码。如果我们不对此操心
- * 的话，那么事情可能更容易些。
+static int swap_cluster_out(unsigned long ** victims, int nr)
+{
+    unsigned long page;
+    int swap_nr, i;
+
+    if (!(swap_nr = get_swap_pages(&nr))) {
+        return 0;
+    }
+    for (i = 0 ; i < nr ; i++) {
+        page = *victims[i] & 0xfffff000;
+        memcpy(swap_buffer + (i << 12), (void *) page, PAGE_SIZE);
+        /* 换出页面的页表项的内容为(swap_nr << 1)|(P = 0) */
+        *victims[i] = (swap_nr + i) << 1;
+        free_page(page);
+    }
+    invalidate();
+    ll_rw_pages(WRITE, SWAP_DEV, swap_nr, nr, swap_buffer);
+    swap_stat.swap_writes++;
+    swap_stat.swapped += nr;
+    swap_stat.reclaimed += nr;
+    return nr;
+}
+
+/**
+ * 把时钟指针移到下一个页表项
+ * 依次经过每个任务的进程空间对应的页目录项，跳过不存在的任务和页表。
+ * @param[in/out]	counter		本圈还可以检查的页面数
+ * @return			页表项指针，这一圈已转完返回NULL
  */
+static unsigned long * clock_advance(int * counter)
+{
+    unsigned long pg_table;
+
+    while (*counter > 0) {
+        if (++page_entry >= 1024) {
+            page_entry = 0;
+            if (++dir_entry >= LAST_VM_DIR) {
+                dir_entry = FIRST_VM_DIR;
+                if (++swap_task >= NR_TASKS) {
+                    swap_task = 1;
+                }
+            }
+        }
+        if (!task[swap_task]) {
+            /* 任务不存在，跳过它的整个进程空间 */
+            *counter -= (LAST_VM_DIR - dir_entry) * 1024 - page_entry;
+            dir_entry = LAST_VM_DIR - 1;
+            page_entry = 1023;
+            continue;
+        }
+        pg_table = task_pg_dir(task[swap_task])[dir_entry];
+        if (!(pg_table & 1)) {
+            /* 页表不存在，跳过它剩下的表项 */
+            *counter -= 1024 - page_entry;
+            page_entry = 1023;
+            continue;
+        }
+        (*counter)--;
+        return page_entry + (unsigned long *) (pg_table & 0xfffff000);
+    }
+    return NULL;
+}
+
 /**
- * 把内存页面交换到交换设备中(仅在get_free_page被调用)
- * 从线性地址64MB对应的目录项(FIRST_VM_PAGE>>10)开始，搜索整个4GB线性空间，对有效页目录
- * 二级页表指定的物理内存页面执行交换到交换设备中去的尝试。
+ * 把内存页面交换到交换设备中(仅在get_free_pages被调用)
+ * 时钟指针最多转两圈：第一圈只回收干净页面，第二圈收集可以换出的脏页面，凑满一簇(或找到第一个
+ * 后又检查了一个页表的表项)就一起写出。
  * @return  成功返回1，失败返回0
  */
 /*static*/ int swap_out(void)
 {
-    static int dir_entry = FIRST_VM_PAGE >> 10;	/* 即任务1的第1个目录项索引 */
-    static int page_entry = -1;
-    int counter = VM_PAGES;			/* 表示除去任务0以外的其他任务的所有页数目 */
-    int pg_table;
-
-    /* 首先搜索页目录表，查找第一个有效的页目录项pg_table */
-    while (counter > 0) {
-        pg_table = pg_dir[dir_entry];
-        if (pg_table & 1) {
-            break;
-        }
-        counter -= 1024;    /* 1个页表对应1024个页帧 */
-        dir_entry++;
-        if (dir_entry >= 1024) {
-            /* 检索完整个页目录表，重新从头开始检索（执行不到） */
-            dir_entry = FIRST_VM_PAGE >> 10;
+    unsigned long * victims[SWAP_CLUSTER];
+    unsigned long * table_ptr;
+    int counter, nr = 0;
+
+    counter = VM_PAGES;     /* 表示除去任务0以外的其他任务的所有页数目 */
+    while ((table_ptr = clock_advance(&counter))) {
+        if (try_to_swap_out(table_ptr, 0) == SWAP_FREED) {
+            need_flush = 0;
+            return 1;
         }
     }
-    /* 对取到页目录项对应页表中的页表项开始逐一调用交换函数 */
-    pg_table &= 0xfffff000;
-    while (counter-- > 0) {
-        page_entry++;
-        if (page_entry >= 1024) {
-            /* 页表项索引>=1024，则取下一个有效的页目录项 */
-            page_entry = 0;
-        repeat:
-            dir_entry++;
-            if (dir_entry >= 1024) {
-                /* 检索完整个页目录表，重新从头开始检索（执行不到） */
-                dir_entry = FIRST_VM_PAGE >> 10;
-            }
-            pg_table = pg_dir[dir_entry];
-            if (!(pg_table & 1)) {
-                if ((counter -= 1024) > 0) {
-                    goto repeat;
-                } else {
+    if (swap_bitmap) {
+        lock_swap();
+        counter = VM_PAGES;
+        while (nr < swap_cluster && (table_ptr = clock_advance(&counter))) {
+            switch (try_to_swap_out(table_ptr, 1)) {
+                case SWAP_FREED:
+                    if (nr) {
+                        break;
+                    }
+                    unlock_swap();
+                    need_flush = 0;
+                    return 1;
+                case SWAP_DIRTY:
+                    if (!nr++ && counter > 1024) {
+                        counter = 1024;
+                    }
+                    victims[nr - 1] = table_ptr;
                     break;
-                }
             }
-            pg_table &= 0xfffff000;
         }
-        if (try_to_swap_out(page_entry + (unsigned long *) pg_table)) {
-            /* 成功换出一个页面即退出 */
+        if (nr && swap_cluster_out(victims, nr)) {
+            unlock_swap();
+            need_flush = 0;
             return 1;
         }
+        unlock_swap();
+    }
+    if (need_flush) {
+        need_flush = 0;
+        invalidate();
     }
     printk("Out of swap-memory\n\r");
     return 0;
 }
 
+/*
+ * 预清零页面池。没有其他任务可运行时，任务0在sys_pause()中每次清零一个空闲页面放进池里，缺页处理
+ * 等需要清零页面的地方直接从池中取，不用在分配路径上清零。池中的页面已从伙伴系统取出(mem_map[]
+ * 计数为1)，内存不够时get_free_pages()先把它们还回去。
+ */
+#define NR_ZERO_PAGES	64
+
+static unsigned long zero_pages[NR_ZERO_PAGES];
+static int nr_zero_pages = 0;
+static unsigned long zero_hits = 0;			/* 从池中取到页面的次数 */
+static unsigned long zero_misses = 0;		/* 池空而在分配时清零的次数 */
+
+/* 从预清零页面池中取一个页面，池空返回0 */
+static unsigned long get_zero_page(void)
+{
+    unsigned long flags, page = 0;
+
+    save_flags(flags);
+    cli();
+    if (nr_zero_pages) {
+        page = zero_pages[--nr_zero_pages];
+        zero_hits++;
+    } else {
+        zero_misses++;
+    }
+    restore_flags(flags);
+    return page;
+}
+
+/* 把池中的一个页面还给伙伴系统，返回是否还了页面 */
+static int shrink_zero_pages(void)
+{
+    unsigned long flags, page = 0;
+
+    save_flags(flags);
+    cli();
+    if (nr_zero_pages) {
+        page = zero_pages[--nr_zero_pages];
+    }
+    restore_flags(flags);
+    if (!page) {
+        return 0;
+    }
+    free_page(page);
+    return 1;
+}
+
+/**
+ * 清零一个空闲页面放入预清零页面池(任务0空闲时调用)
+ * 每次只清零一页，以便尽快回到调度程序。只使用现有的空闲页面，不为此回收内存。
+ * @retval		清零了页面返回1，池已满或没有空闲页面返回0
+ */
+int zero_idle_page(void)
+{
+    unsigned long flags, page;
+
+    if (nr_zero_pages >= NR_ZERO_PAGES || !(page = __get_free_pages(0))) {
+        return 0;
+    }
+    memset((void *) page, 0, PAGE_SIZE);
+    save_flags(flags);
+    cli();
+    if (nr_zero_pages < NR_ZERO_PAGES) {
+        zero_pages[nr_zero_pages++] = page;
+        page = 0;
+    }
+    restore_flags(flags);
+    if (page) {
+        free_page(page);
+    }
+    return 1;
+}
+
+/* 显示预清零页面池的统计(在show_mem()中调用) */
+void zero_pages_show(void)
+{
+    printk("Zeroed pages: %d pooled, %d hits, %d misses\n\r",
+        nr_zero_pages, zero_hits, zero_misses);
+}
+
+/**
+ * 在主内存区中申请2^order个物理上连续的页面
+ * 没有足够大的空闲块时先回收slab缓存中的空slab和页面高速缓冲中的页面；单个页面还可以执行交换
+ * 处理。页面不清零。
+ * @param[in]	order	阶(0 ~ NR_MEM_LISTS-1)
+ * @return  起始物理地址，失败返回0
+ */
+unsigned long get_free_pages(int order)
+{
+    unsigned long page;
+
+repeat:
+    if ((page = __get_free_pages(order))) {
+        return page;
+    }
+    if (shrink_zero_pages() || kmem_cache_reap() || shrink_page_cache() ||
+        shrink_dir_index() || shrink_swap_cache() || (!order && swap_out())) {
+        goto repeat;
+    }
+    return 0;
+}
+
 /*
  * Get physical address of first (actually last :-) free page, and mark it
  * used. If no free pages left, return 0.
  */
 /*
- * 获取首个(实际上是最后1个:-)空闲页面，并标志为已使用。如果没有空闲页面，就返回0。
+ * 获取一个空闲页面，并标志为已使用。如果没有空闲页面，就返回0。
  */
 
 /**
  * 在主内存区中申请1页空闲物理页面
+ * 需要清零的页面先从预清零页面池中取，池空时才在这里清零。调用者会覆盖整个页面时(如从设备读入、
+ * 写时复制)应使用GFP_NOZERO，这时也不动用池中的页面。
+ * @param[in]	flags	GFP_ZERO或GFP_NOZERO
  * @return  空闲的页面地址
  */
-unsigned long get_free_page(void)
+unsigned long __get_free_page(int flags)
 {
-	register unsigned long __res;
+    unsigned long page;
 
-/* 在内存映射字节位图中从尾到头地查找值为0的字节项，然后把对应物理内存页面清零 */
-repeat:
-    __asm__("std ; repne ; scasb\n\t"
-        "jne 1f\n\t"
-        "movb $1,1(%%edi)\n\t"
-        "sall $12,%%ecx\n\t"
-        "addl %2,%%ecx\n\t"
-        "movl %%ecx,%%edx\n\t"
-        "movl $1024,%%ecx\n\t"
-        "leal 4092(%%edx),%%edi\n\t"
-        "rep ; stosl\n\t"
-        "movl %%edx,%%eax\n"
-        "1:"
-        :"=a" (__res)
-        :"0" (0), "i" (LOW_MEM), "c" (PAGING_PAGES),
-        "D" (mem_map + PAGING_PAGES - 1)
-        );
-    if (__res >= HIGH_MEMORY) {	/* 页面地址大于实际内存容量，重新寻找 */
-        goto repeat;
+    if (!(flags & GFP_NOZERO) && (page = get_zero_page())) {
+        return page;
     }
-    if (!__res && swap_out()) {	/* 没有得到空闲页面则执行交换处理,并重新查找 */
-        goto repeat;
+    if ((page = get_free_pages(0)) && !(flags & GFP_NOZERO)) {
+        memset((void *) page, 0, PAGE_SIZE);
     }
-    return __res;
+    return page;
 }
 
 /**
@@ -363,5 +744,20 @@ void init_swapping(void)
         swap_bitmap = NULL;
         return;
     }
-    printk("Swap device ok: %d pages (%d bytes) swap-space\n\r", j, j*4096);
+    /* 簇缓冲区：尽量取连续的SWAP_CLUSTER个页面，内存不够时减半 */
+    for (i = SWAP_CLUSTER_ORDER ; i >= 0 ; i--) {
+        if ((swap_buffer = (char *) __get_free_pages(i))) {
+            swap_cluster = 1 << i;
+            break;
+        }
+    }
+    if (!swap_buffer) {
+        printk("Unable to start swapping: out of memory :-)\n\r");
+        free_page((long) swap_bitmap);
+        swap_bitmap = NULL;
+        return;
+    }
+    swap_pages = swap_size;
+    printk("Swap device ok: %d pages (%d bytes) swap-space, %d-page clusters\n\r",
+        j, j*4096, swap_cluster);
 }
@@ -0,0 +1,69 @@
+/*
+ * readbench.c - 测量read()在不同读长度下的吞吐量(字节/秒)
+ *
+ * 在linux-0.12系统中编译运行：
+ *     gcc -o readbench readbench.c
+ *     ./readbench [文件名]
+ *
+ * 先写一个64KB的测试文件(默认/tmp/readbench.dat)并读一遍，使它留在页面高速缓冲中，然后对1KB ~
+ * 64KB的每种读长度反复从头读完整个文件，共读TOTAL字节，用times()返回的滴答数计时。文件已在缓冲中，
+ * 测出的主要是内核把数据复制到用户空间的开销。分别在修改前后的内核上运行，比较两次的结果。
+ */
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/times.h>
+
+#define HZ			100					/* 内核时钟频率，times()返回值的单位 */
+#define FILE_SIZE	(64 * 1024)			/* 测试文件长度 */
+#define TOTAL		(8 * 1024 * 1024)	/* 每种读长度读的总字节数 */
+
+static char buf[FILE_SIZE];
+
+int main(int argc, char ** argv)
+{
+	char * name = (argc > 1) ? argv[1] : "/tmp/readbench.dat";
+	struct tms tms;
+	long start, ticks, done;
+	int fd, size, n;
+
+	for (n = 0 ; n < FILE_SIZE ; n++) {
+		buf[n] = n;
+	}
+	if ((fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(name);
+		return 1;
+	}
+	if (write(fd, buf, FILE_SIZE) != FILE_SIZE) {
+		perror("write");
+		return 1;
+	}
+	lseek(fd, 0, 0);
+	while (read(fd, buf, FILE_SIZE) > 0)
+		/* nothing */ ;
+
+	printf("  size      bytes/s\n");
+	for (size = 1024 ; size <= FILE_SIZE ; size <<= 1) {
+		done = 0;
+		start = times(&tms);
+		while (done < TOTAL) {
+			lseek(fd, 0, 0);
+			while ((n = read(fd, buf, size)) > 0) {
+				done += n;
+			}
+			if (n < 0) {
+				perror("read");
+				return 1;
+			}
+		}
+		if ((ticks = times(&tms) - start) <= 0) {
+			ticks = 1;
+		}
+		printf("%5dK %12ld\n", size / 1024, done / ticks * HZ);
+	}
+	close(fd);
+	if (argc <= 1) {
+		unlink(name);
+	}
+	return 0;
+}